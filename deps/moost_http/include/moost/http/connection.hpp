@@ -2,9 +2,19 @@
 #define __MOOST_HTTP_CONNECTION_HPP__
 
 #include <iostream>
+#include <algorithm>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#elif defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
@@ -25,8 +35,15 @@ class connection
 {
 public:
   /// Construct a connection with the given io_service.
+  /// keepalive_timeout is how many seconds an idle connection is held open
+  /// waiting for the next request, keepalive_max how many requests are
+  /// served on it before it's closed (0 turns keep-alive off).
+  /// read_timeout is how long the client may go quiet while sending a
+  /// request, including the first (0 for no limit).
   explicit connection(boost::asio::io_service& io_service,
-      request_handler_base<RequestHandler>& handler);
+      request_handler_base<RequestHandler>& handler,
+      int keepalive_timeout = 15, int keepalive_max = 100,
+      int read_timeout = 30);
 
   /// Get the socket associated with the connection.
   boost::asio::ip::tcp::socket& socket();
@@ -35,6 +52,22 @@ public:
   void start();
 
 private:
+  /// Read more from the socket, closing it if nothing arrives within
+  /// timeout seconds (0 to wait forever).
+  void start_read(int timeout);
+
+  /// Parse whatever is left in buffer_, and answer it if it's a whole request.
+  void process_buffer();
+
+  /// Close the socket if we've been waiting on the client for too long.
+  void handle_idle_timeout(const boost::system::error_code& e);
+
+  /// Whether the client is happy for the connection to stay open.
+  bool client_keep_alive() const;
+
+  /// Reset for the next request on this connection, or shut it down.
+  void finish_reply();
+
   /// Handle completion of a read operation.
   void handle_read(const boost::system::error_code& e,
       std::size_t bytes_transferred);
@@ -44,7 +77,10 @@ private:
   void handle_write_end(const boost::system::error_code& e);
 
   // this method is passed to the async_delegate
-  void do_async_write(const boost::asio::const_buffer&);
+  void do_async_write(const std::vector<boost::asio::const_buffer>&);
+
+  /// Send (some more of) the reply's file, see reply::write_file.
+  void send_file(const boost::system::error_code& e);
 
   /// Strand to ensure the connection's handlers are not called concurrently.
   boost::asio::io_service::strand strand_;
@@ -60,6 +96,28 @@ private:
   char buffer_[buffer_size_];
   //boost::array<char, 8192> buffer_;
 
+  /// The part of buffer_ not yet consumed by the parser; with pipelining,
+  /// this can hold the start of the next request.
+  char* buffer_begin_;
+  char* buffer_end_;
+
+  /// Closes the connection when the client goes quiet: for read_timeout_
+  /// seconds in a request, or keepalive_timeout_ between requests.
+  boost::asio::deadline_timer idle_timer_;
+  int keepalive_timeout_;
+  int keepalive_max_;
+  int read_timeout_;
+
+  /// requests answered on this connection so far
+  int requests_;
+
+  /// the current reply was sent with Connection: keep-alive
+  bool keep_alive_;
+
+  /// the reply's Content-Length, or -1 if it's delimited by closing
+  long long content_length_;
+  long long content_written_;
+
   /// The incoming request.
   request request_;
 
@@ -74,14 +132,32 @@ private:
 
   /// we have written the last chunk provided by the client
   bool end_;
+
+  /// most of a file sent in one go, so other connections get a turn
+  static const int send_file_chunk_ = 1024 * 1024;
+#ifndef __linux__
+  /// without sendfile, file content is read through here
+  std::vector<char> file_buffer_;
+#endif
 };
 
 template<class RequestHandler>
 connection<RequestHandler>::connection(boost::asio::io_service& io_service,
-    request_handler_base<RequestHandler>& handler)
+    request_handler_base<RequestHandler>& handler,
+    int keepalive_timeout, int keepalive_max, int read_timeout)
 : strand_(io_service),
   socket_(io_service),
   request_handler_(handler),
+  buffer_begin_(buffer_),
+  buffer_end_(buffer_),
+  idle_timer_(io_service),
+  keepalive_timeout_(keepalive_timeout),
+  keepalive_max_(keepalive_max),
+  read_timeout_(read_timeout),
+  requests_(0),
+  keep_alive_(false),
+  content_length_(-1),
+  content_written_(0),
   doing_content_(false),
   end_(false)
 {
@@ -90,52 +166,50 @@ connection<RequestHandler>::connection(boost::asio::io_service& io_service,
 template<class RequestHandler>
 void connection<RequestHandler>::start()
 {
+  start_read(read_timeout_);
+}
+
+template<class RequestHandler>
+void connection<RequestHandler>::start_read(int timeout)
+{
+  if (timeout > 0)
+  {
+    idle_timer_.expires_from_now(boost::posix_time::seconds(timeout));
+    idle_timer_.async_wait(
+        strand_.wrap(
+          boost::bind(&connection<RequestHandler>::handle_idle_timeout, this->shared_from_this(),
+            boost::asio::placeholders::error)));
+  }
   socket_.async_read_some(boost::asio::buffer(buffer_, buffer_size_),
       strand_.wrap(
-        boost::bind(&connection<RequestHandler>::handle_read, connection<RequestHandler>::shared_from_this(),
+        boost::bind(&connection<RequestHandler>::handle_read, this->shared_from_this(),
           boost::asio::placeholders::error,
           boost::asio::placeholders::bytes_transferred)));
 }
 
+template<class RequestHandler>
+void connection<RequestHandler>::handle_idle_timeout(const boost::system::error_code& e)
+{
+  // a cancelled wait can still be queued after the timer was re-armed:
+  if (e == boost::asio::error::operation_aborted ||
+      idle_timer_.expires_at() > boost::asio::deadline_timer::traits_type::now())
+    return;
+
+  boost::system::error_code ignored_ec;
+  socket_.close(ignored_ec);
+}
+
 template<class RequestHandler>
 void connection<RequestHandler>::handle_read( const boost::system::error_code& e,
                                               std::size_t bytes_transferred )
 {
+  idle_timer_.cancel();
+
   if (!e)
   {
-    boost::tribool result;
-    boost::tie(result, boost::tuples::ignore) = request_parser_.parse(
-        request_, buffer_, buffer_ + bytes_transferred);
-   
-    if ( boost::indeterminate(result) )
-    {
-      // need to read more
-      socket_.async_read_some(boost::asio::buffer(buffer_, buffer_size_),
-          strand_.wrap(
-            boost::bind(&connection<RequestHandler>::handle_read, this->shared_from_this(),
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred)));
-      return; // we're all done here!
-    }
-
-    reply_ = reply_ptr(new reply);
-
-    try {
-        if ( result )
-        {
-            request_.origin = socket_.remote_endpoint().address().to_string();
-            request_handler_.handle_request_base(request_, *reply_);
-        }
-        else if ( !result )
-        {
-           reply_->stock_reply(reply::bad_request);
-        }
-    } catch (std::runtime_error& e) {
-        std::cerr << "caught: " << e.what();
-        int i = 0;
-    }
-
-    handle_write(boost::system::error_code());
+    buffer_begin_ = buffer_;
+    buffer_end_ = buffer_ + bytes_transferred;
+    process_buffer();
   }
 
   // If an error occurs then no new asynchronous operations are started. This
@@ -144,6 +218,85 @@ void connection<RequestHandler>::handle_read( const boost::system::error_code& e
   // handler returns. The connection class's destructor closes the socket.
 }
 
+template<class RequestHandler>
+void connection<RequestHandler>::process_buffer()
+{
+  boost::tribool result;
+  boost::tie(result, buffer_begin_) = request_parser_.parse(
+      request_, buffer_begin_, buffer_end_);
+
+  if ( boost::indeterminate(result) )
+  {
+    // need to read more
+    start_read(read_timeout_);
+    return; // we're all done here!
+  }
+
+  reply_ = reply_ptr(new reply);
+  ++requests_;
+
+  try {
+      if ( result )
+      {
+          request_.origin = socket_.remote_endpoint().address().to_string();
+          request_handler_.handle_request_base(request_, *reply_);
+      }
+      else if ( !result )
+      {
+         // we've lost track of where the next request starts:
+         buffer_begin_ = buffer_end_;
+         // so the connection can't be reused either:
+         reply_->add_header("Connection", "close");
+         reply_->stock_reply(reply::bad_request);
+      }
+  } catch (std::runtime_error& e) {
+      std::cerr << "caught: " << e.what();
+  }
+
+  handle_write(boost::system::error_code());
+}
+
+template<class RequestHandler>
+bool connection<RequestHandler>::client_keep_alive() const
+{
+  const std::string conn = request_.header_value("Connection");
+  if (boost::algorithm::icontains(conn, "close"))
+    return false;
+  if (request_.http_version_major > 1 ||
+      (request_.http_version_major == 1 && request_.http_version_minor >= 1))
+    return true;
+  return boost::algorithm::icontains(conn, "keep-alive");
+}
+
+template<class RequestHandler>
+void connection<RequestHandler>::finish_reply()
+{
+  const bool keep_alive = keep_alive_ && content_written_ == content_length_;
+
+  reply_.reset();
+  request_ = request();
+  request_parser_.reset();
+  doing_content_ = false;
+  end_ = false;
+  keep_alive_ = false;
+  content_length_ = -1;
+  content_written_ = 0;
+
+  if (!keep_alive)
+  {
+    // Initiate graceful connection closure.
+    boost::system::error_code ignored_ec;
+    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    return;
+  }
+
+  // the client may already have sent its next request:
+  if (buffer_begin_ != buffer_end_)
+    process_buffer();
+  else
+    start_read(keepalive_timeout_);
+}
+
 template<class RequestHandler>
 boost::asio::ip::tcp::socket& connection<RequestHandler>::socket()
 {
@@ -153,6 +306,12 @@ boost::asio::ip::tcp::socket& connection<RequestHandler>::socket()
 template<class RequestHandler>
 void connection<RequestHandler>::handle_write(const boost::system::error_code& e)
 {
+    if (!e && end_ && reply_->file_fd() >= 0 && reply_->file_length() > 0) {
+        // headers and any content are out, now for the file:
+        send_file(e);
+        return;
+    }
+
     if (e || end_) {
         // signal to the delegate we're done
         try {
@@ -181,30 +340,46 @@ void connection<RequestHandler>::handle_write(const boost::system::error_code& e
     }
 
 	// all done here!
-    // Initiate graceful connection closure.
-	reply_.reset();
-    boost::system::error_code ignored_ec;
-    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    finish_reply();
 }
 
 // this is the write function we pass to the content_async_write callback
 // write one status_code object
 // then write zero or more headers
-// then write content with boost::asio::const_buffers
-// finally write a zero-length buffer to close the socket and end the callback chain
+// then write content, each call gathering whatever the reply had queued
+// finally write a zero-length buffer to end the callback chain; the socket
+// is then closed, or kept for the next request if the reply was complete
 //
 template<class RequestHandler>
-void connection<RequestHandler>::do_async_write(const boost::asio::const_buffer& b)
+void connection<RequestHandler>::do_async_write(const std::vector<boost::asio::const_buffer>& b)
 {
     std::vector<boost::asio::const_buffer> buffers;
 
     if (!doing_content_) {
         doing_content_ = true;
+
+        // we can only reuse the connection if the client can tell where
+        // this reply ends without us closing it:
+        const std::string cl = reply_->header_value("Content-Length");
+        try {
+            content_length_ = cl.empty() ? -1 : boost::lexical_cast<long long>(cl);
+        } catch (boost::bad_lexical_cast&) {
+            content_length_ = -1;
+        }
+        keep_alive_ = content_length_ >= 0 &&
+                      requests_ < keepalive_max_ &&
+                      client_keep_alive() &&
+                      !boost::algorithm::icontains(reply_->header_value("Connection"), "close");
+        reply_->add_header("Connection", keep_alive_ ? "keep-alive" : "close");
+
         buffers = reply_->to_buffers_headers();
     }
-    buffers.push_back(b);
+    for (std::size_t i = 0; i < b.size(); ++i) {
+        buffers.push_back(b[i]);
+        content_written_ += boost::asio::buffer_size(b[i]);
+    }
 
-    if (!boost::asio::detail::buffer_size_helper(b)) {
+    if (b.empty() || !boost::asio::buffer_size(b.back())) {
 		end_ = true;
     }
 
@@ -218,6 +393,77 @@ void connection<RequestHandler>::do_async_write(const boost::asio::const_buffer&
                 boost::asio::placeholders::error)));
 }
 
+template<class RequestHandler>
+void connection<RequestHandler>::send_file(const boost::system::error_code& e)
+{
+    long long& offset = reply_->file_offset();
+    long long& length = reply_->file_length();
+
+    if (e || length <= 0) {
+        handle_write(e);
+        return;
+    }
+
+#ifdef __linux__
+    // straight from the page cache to the socket, as much as it'll take:
+    boost::system::error_code ignored_ec;
+    socket_.native_non_blocking(true, ignored_ec);
+    for (long long sent = 0; length > 0 && sent < send_file_chunk_; ) {
+        off_t off = offset;
+        ssize_t n = ::sendfile(socket_.native_handle(), reply_->file_fd(), &off,
+            static_cast<size_t>(std::min<long long>(length, send_file_chunk_)));
+        if (n > 0) {
+            offset += n;
+            length -= n;
+            sent += n;
+            content_written_ += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            // the socket's gone, or the file is shorter than we said
+            handle_write(boost::system::error_code(n < 0 ? errno : EIO,
+                boost::asio::error::get_system_category()));
+            return;
+        }
+    }
+    if (length <= 0) {
+        handle_write(e);
+        return;
+    }
+    // come back when the socket can take more:
+    socket_.async_write_some(boost::asio::null_buffers(),
+        strand_.wrap(
+            boost::bind(
+                &connection<RequestHandler>::send_file,
+                this->shared_from_this(),
+                boost::asio::placeholders::error)));
+#else
+    file_buffer_.resize(64 * 1024);
+    int n = -1;
+    if (::lseek(reply_->file_fd(), static_cast<long>(offset), SEEK_SET) >= 0)
+        n = ::read(reply_->file_fd(), &file_buffer_[0],
+            static_cast<unsigned int>(std::min<long long>(length, file_buffer_.size())));
+    if (n <= 0) {
+        handle_write(boost::system::error_code(n < 0 ? errno : EIO,
+            boost::asio::error::get_system_category()));
+        return;
+    }
+    offset += n;
+    length -= n;
+    content_written_ += n;
+    boost::asio::async_write(
+        socket_,
+        boost::asio::buffer(&file_buffer_[0], n),
+        strand_.wrap(
+            boost::bind(
+                &connection<RequestHandler>::send_file,
+                this->shared_from_this(),
+                boost::asio::placeholders::error)));
+#endif
+}
+
 }} // moost::http
 
 #endif // __MOOST_HTTP_CONNECTION_HPP__
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
@@ -28,6 +29,7 @@ public:
     created = 201,
     accepted = 202,
     no_content = 204,
+    partial_content = 206,
     multiple_choices = 300,
     moved_permanently = 301,
     moved_temporarily = 302,
@@ -36,6 +38,7 @@ public:
     unauthorized = 401,
     forbidden = 403,
     not_found = 404,
+    requested_range_not_satisfiable = 416,
     internal_server_error = 500,
     not_implemented = 501,
     bad_gateway = 502,
@@ -48,15 +51,19 @@ public:
 	,cancelled_(false)
 	,writing_(false)
     ,held_(false)
+    ,above_high_water_(false)
+    ,writing_bytes_(0)
+    ,queued_(0)
+    ,high_water_mark_(default_high_water_mark)
+    ,max_gather_(default_max_gather_buffers)
+    ,file_fd_(-1)
+    ,file_offset_(0)
+    ,file_length_(0)
   {
   }
 
-#if 0
-  ~reply()
-  {
-      std::cout << "~reply()";
-  }
-#endif
+  /// closes the file given to write_file, if any.
+  ~reply();
 
   /// Convert the reply into a vector of buffers. The buffers do not own the
   /// underlying memory blocks, therefore the reply object must remain valid and
@@ -69,6 +76,9 @@ public:
   const std::vector<header>& get_headers()
   { return headers_; }
 
+  /// value of the named header, or "" if it hasn't been set.
+  const std::string header_value(const std::string& name) const;
+
   // The optional async delegate enables the request handler to write
   // to the client in a non-blocking manner.  The delegate is 
   // called to initiate the first write operation, and
@@ -76,10 +86,20 @@ public:
   // The delegate returns false to end the write sequence.
   // The WriteFunc parameter should be used once (per delegate call).
   // Keep a copy of the WriteFunc to keep the connection alive
+  //
+  // Everything queued while a write is in progress goes out together in
+  // the next one, as a single gather write. A zero-length buffer at the
+  // end of the batch marks the end of the content.
 
-    typedef boost::function< void(const boost::asio::const_buffer&) > WriteFunc;
+    typedef boost::function< void(const std::vector<boost::asio::const_buffer>&) > WriteFunc;
     typedef boost::function< bool(WriteFunc) > AsyncDelegateFunc;
 
+    /// queued bytes above which write_content asks the producer to stop
+    static const size_t default_high_water_mark = 256 * 1024;
+
+    /// most buffers handed to one gather write, by default
+    static const size_t default_max_gather_buffers = 64;
+
 public:
 
    template <typename T>
@@ -100,16 +120,51 @@ public:
 	   status = (status_type)s; 
    }
 
-    void write_content(const std::string& s)
+    // Queue s for the client. Returns false once more than the high water
+    // mark is queued: the producer should stop until the drain callback
+    // says the queue has fallen back to half of it. (The content is queued
+    // either way, so producers that ignore this just use more memory.)
+    bool write_content(const std::string& s)
 	{
         boost::lock_guard<boost::mutex> lock(mutex_);
         buffers_.push_back(s);
-        if (!writing_ && wf_ && !held_) {
-            writing_ = true;
-            wf_(boost::asio::const_buffer(buffers_.front().data(), buffers_.front().length()));
+        queued_ += s.length();
+        start_write();
+        if (high_water_mark_ && queued_ > high_water_mark_) {
+            above_high_water_ = true;
+            return false;
         }
+        return true;
 	}
 
+    // 0 means no limit
+    void set_high_water_mark(size_t bytes)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        high_water_mark_ = bytes;
+    }
+
+    // most queued buffers to hand to one write, at least 1
+    void set_max_gather(size_t buffers)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        max_gather_ = buffers ? buffers : 1;
+    }
+
+    // called (from the connection's thread) when a producer told to stop
+    // by write_content may carry on.
+    void set_drain_cb(boost::function<void(void)> cb)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        drain_cb_ = cb;
+    }
+
+    bool writable()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        return !high_water_mark_ || queued_ <= high_water_mark_;
+    }
+
     void write_hold()
     {
         held_ = true;
@@ -117,12 +172,9 @@ public:
 
     void write_release()
     {
-        held_ = false;
         boost::lock_guard<boost::mutex> lock(mutex_);
-        if (!writing_ && buffers_.size() && wf_) {
-            writing_ = true;
-            wf_(boost::asio::const_buffer(buffers_.front().data(), buffers_.front().length()));
-        }
+        held_ = false;
+        start_write();
     }
 
 	void write_cancel()
@@ -135,34 +187,64 @@ public:
 		write_content("");
 	}
 
+    // Finish the reply with length bytes of an open file, starting at
+    // offset. The connection sends them straight from the file (with
+    // sendfile where there is one), after anything already written.
+    // The reply owns fd from now on.
+    void write_file(int fd, long long offset, long long length)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            file_fd_ = fd;
+            file_offset_ = offset;
+            file_length_ = length;
+        }
+        write_finish();
+    }
+
+    /// the file still to be sent by the connection, fd -1 if none;
+    /// the connection advances offset and length as it goes.
+    int file_fd() const { return file_fd_; }
+    long long& file_offset() { return file_offset_; }
+    long long& file_length() { return file_length_; }
+
 	bool async_write_delegate(WriteFunc wf)
 	{
-        wf_ = wf;
-
-        if (!wf_ || cancelled_) {   
+        if (!wf || cancelled_) {   
             // cancelled by caller || cancelled by us
             if (write_ending_cb_)
                 write_ending_cb_();
             cancelled_ = true;
+            boost::lock_guard<boost::mutex> lock(mutex_);
             wf_ = 0;
+            drain_cb_ = 0;
             return false;
         }
 
+        boost::function<void(void)> drained;
         {
             boost::lock_guard<boost::mutex> lock(mutex_);
+            wf_ = wf;
 
-            if (writing_ && buffers_.size()) {
+            if (writing_) {
                 // previous write has completed:
-                buffers_.pop_front();
+                queued_ -= writing_bytes_;
+                writing_bytes_ = 0;
+                writing_buffers_.clear();
                 writing_ = false;
-            }
 
-            if (!writing_ && buffers_.size() && wf_ && !held_) {
-                // write something new
-                writing_ = true;
-                wf_(boost::asio::const_buffer(buffers_.front().data(), buffers_.front().length()));
+                if (above_high_water_ && queued_ <= high_water_mark_ / 2) {
+                    above_high_water_ = false;
+                    drained = drain_cb_;
+                }
             }
+
+            // write something new
+            start_write();
         }
+        // outside the lock, the producer will want to write_content:
+        if (drained)
+            drained();
         return true;
 	}
 
@@ -173,6 +255,29 @@ public:
 
 private:
 
+    // hand everything queued (up to the end marker) to one write.
+    // call with mutex_ held.
+    void start_write()
+    {
+        if (writing_ || buffers_.empty() || !wf_ || held_)
+            return;
+
+        std::vector<boost::asio::const_buffer> bufs;
+        std::list<std::string>::iterator it = buffers_.begin();
+        while (it != buffers_.end() && bufs.size() < max_gather_) {
+            const bool last = it->empty();
+            bufs.push_back(boost::asio::const_buffer(it->data(), it->length()));
+            writing_bytes_ += it->length();
+            ++it;
+            if (last)
+                break;
+        }
+        // the list nodes (and so the string data) don't move:
+        writing_buffers_.splice(writing_buffers_.end(), buffers_, buffers_.begin(), it);
+        writing_ = true;
+        wf_(bufs);
+    }
+
 	std::map<std::string, size_t> headersGuard_;
 
 	/// The headers to be included in the reply.
@@ -180,12 +285,24 @@ private:
 
 	WriteFunc wf_;
 	boost::function<void(void)> write_ending_cb_;
+	boost::function<void(void)> drain_cb_;
 	bool cancelled_;
     bool writing_;
     bool held_;             // can pause content writing
+    bool above_high_water_; // write_content has asked the producer to stop
 
     boost::mutex mutex_;	// for protecting _buffers:
-    std::list<std::string> buffers_;
+    std::list<std::string> buffers_;            // waiting to be written
+    std::list<std::string> writing_buffers_;    // being written now
+    size_t writing_bytes_;
+    size_t queued_;         // bytes in both lists
+    size_t high_water_mark_;
+    size_t max_gather_;
+
+    // see write_file:
+    int file_fd_;
+    long long file_offset_;
+    long long file_length_;
 };
 
 typedef boost::shared_ptr<reply> reply_ptr;
@@ -43,8 +43,10 @@ public:
     return boost::make_tuple(result, begin);
   }
 
+  /// Consume up to the remaining content-length bytes, advancing begin past
+  /// them so anything left over belongs to the next (pipelined) request.
   template<typename InputIterator>
-  boost::tribool consume_body(request & req, InputIterator begin, InputIterator end)
+  boost::tribool consume_body(request & req, InputIterator& begin, InputIterator end)
   {
     if (content_to_read_ < 0)
       return false; // probably bad content-length
@@ -31,16 +31,47 @@ public:
     return request_handler_;
   }
 
+  /// Hold idle connections open for up to timeout seconds between requests,
+  /// serving at most max_requests on each. Call before run().
+  void set_keepalive(int timeout, int max_requests)
+  {
+    keepalive_timeout_ = timeout;
+    keepalive_max_ = max_requests;
+    new_connection_.reset(new_connection());
+  }
+
+  /// Close connections whose client goes quiet for timeout seconds while
+  /// sending a request (0 for no limit). Call before run().
+  void set_read_timeout(int timeout)
+  {
+    read_timeout_ = timeout;
+    new_connection_.reset(new_connection());
+  }
+
   /// Run the server's io_service loop.
   void run();
 
   /// Stop the server.
   void stop();
 
+  /// The port listened on, 0 until run() has started listening. Useful
+  /// when constructed with port 0, to listen on any free one.
+  int port() const
+  {
+    boost::mutex::scoped_lock lock(port_mutex_);
+    return port_;
+  }
+
 private:
   /// Handle completion of an asynchronous accept operation.
   void handle_accept(const boost::system::error_code& e);
 
+  connection<RequestHandler>* new_connection()
+  {
+    return new connection<RequestHandler>(io_service_, request_handler_,
+        keepalive_timeout_, keepalive_max_, read_timeout_);
+  }
+
   /// The number of threads that will call io_service::run().
   std::size_t thread_pool_size_;
 
@@ -53,11 +84,20 @@ private:
   /// The handler for all incoming requests.
   RequestHandler request_handler_;
 
+  /// Keep-alive and timeout settings handed to each connection.
+  int keepalive_timeout_;
+  int keepalive_max_;
+  int read_timeout_;
+
   /// The next connection to be accepted.
   boost::shared_ptr< connection<RequestHandler> > new_connection_;
 
   /// The endpoint of the address to bind
   boost::asio::ip::tcp::endpoint endpoint_;
+
+  /// The port actually bound, see port().
+  int port_;
+  mutable boost::mutex port_mutex_;
 };
 
 template<class RequestHandler>
@@ -66,7 +106,11 @@ server<RequestHandler>::server(const std::string& address, int port,
   : thread_pool_size_(thread_pool_size),
     acceptor_(io_service_),
     request_handler_(),
-    new_connection_(new connection<RequestHandler>(io_service_, request_handler_))
+    keepalive_timeout_(15),
+    keepalive_max_(100),
+    read_timeout_(30),
+    new_connection_(new_connection()),
+    port_(0)
 {
   boost::asio::ip::tcp::resolver resolver(io_service_);
   boost::asio::ip::tcp::resolver::query query(address, boost::lexical_cast<std::string>(port));
@@ -79,7 +123,7 @@ void server<RequestHandler>::handle_accept(const boost::system::error_code& e)
   if (!e)
   {
     new_connection_->start();
-    new_connection_.reset(new connection<RequestHandler>(io_service_, request_handler_));
+    new_connection_.reset(new_connection());
   }
   acceptor_.async_accept(new_connection_->socket(),
     boost::bind(&server<RequestHandler>::handle_accept, this, boost::asio::placeholders::error));
@@ -93,6 +137,10 @@ void server<RequestHandler>::run()
   acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
   acceptor_.bind(endpoint_);
   acceptor_.listen();
+  {
+    boost::mutex::scoped_lock lock(port_mutex_);
+    port_ = acceptor_.local_endpoint().port();
+  }
 
   // pump the first async accept into the loop
   acceptor_.async_accept(new_connection_->socket(),
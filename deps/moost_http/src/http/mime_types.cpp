@@ -13,6 +13,10 @@ struct mapping
   { "html", "text/html" },
   { "jpg", "image/jpeg" },
   { "png", "image/png" },
+  { "mp3", "audio/mpeg" },
+  { "aac", "audio/mp4" },
+  { "mp4", "audio/mp4" },
+  { "m4a", "audio/mp4" },
   { 0, 0 } // Marks end of list.
 };
 
@@ -2,6 +2,12 @@
 #include <string>
 #include <boost/algorithm/string.hpp>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace moost { namespace http {
 
 namespace status_strings {
@@ -14,6 +20,8 @@ const std::string accepted =
   "HTTP/1.1 202 Accepted\r\n";
 const std::string no_content =
   "HTTP/1.1 204 No Content\r\n";
+const std::string partial_content =
+  "HTTP/1.1 206 Partial Content\r\n";
 const std::string multiple_choices =
   "HTTP/1.1 300 Multiple Choices\r\n";
 const std::string moved_permanently =
@@ -30,6 +38,8 @@ const std::string forbidden =
   "HTTP/1.1 403 Forbidden\r\n";
 const std::string not_found =
   "HTTP/1.1 404 Not Found\r\n";
+const std::string requested_range_not_satisfiable =
+  "HTTP/1.1 416 Requested Range Not Satisfiable\r\n";
 const std::string internal_server_error =
   "HTTP/1.1 500 Internal Server Error\r\n";
 const std::string not_implemented =
@@ -51,6 +61,8 @@ boost::asio::const_buffer to_buffer(reply::status_type status)
     return boost::asio::buffer(accepted);
   case reply::no_content:
     return boost::asio::buffer(no_content);
+  case reply::partial_content:
+    return boost::asio::buffer(partial_content);
   case reply::multiple_choices:
     return boost::asio::buffer(multiple_choices);
   case reply::moved_permanently:
@@ -67,6 +79,8 @@ boost::asio::const_buffer to_buffer(reply::status_type status)
     return boost::asio::buffer(forbidden);
   case reply::not_found:
     return boost::asio::buffer(not_found);
+  case reply::requested_range_not_satisfiable:
+    return boost::asio::buffer(requested_range_not_satisfiable);
   case reply::internal_server_error:
     return boost::asio::buffer(internal_server_error);
   case reply::not_implemented:
@@ -90,6 +104,12 @@ const char crlf[] = { '\r', '\n' };
 } // misc_strings
 
 
+reply::~reply()
+{
+  if (file_fd_ >= 0)
+    ::close(file_fd_);
+}
+
 std::vector<boost::asio::const_buffer> reply::to_buffers_headers()
 {
   std::vector<boost::asio::const_buffer> buffers;
@@ -165,6 +185,11 @@ const char not_found[] =
   "<head><title>Not Found</title></head>"
   "<body><h1>404 Not Found</h1></body>"
   "</html>";
+const char requested_range_not_satisfiable[] =
+  "<html>"
+  "<head><title>Requested Range Not Satisfiable</title></head>"
+  "<body><h1>416 Requested Range Not Satisfiable</h1></body>"
+  "</html>";
 const char internal_server_error[] =
   "<html>"
   "<head><title>Internal Server Error</title></head>"
@@ -214,6 +239,8 @@ std::string to_string(reply::status_type status)
     return forbidden;
   case reply::not_found:
     return not_found;
+  case reply::requested_range_not_satisfiable:
+    return requested_range_not_satisfiable;
   case reply::internal_server_error:
     return internal_server_error;
   case reply::not_implemented:
@@ -256,4 +283,11 @@ void reply::add_header( const std::string& name, const std::string& value, bool
     headers_[it->second].value = value;
 }
 
+const std::string reply::header_value( const std::string& name ) const
+{
+  std::map<std::string, size_t>::const_iterator it =
+    headersGuard_.find(boost::to_lower_copy(name));
+  return it == headersGuard_.end() ? std::string() : headers_[it->second].value;
+}
+
 }} // moost::http
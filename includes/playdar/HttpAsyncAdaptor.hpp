@@ -18,6 +18,8 @@
 #ifndef HTTP_ASYNC_ADAPTOR
 #define HTTP_ASYNC_ADAPTOR
 
+#include <sstream>
+
 #include "streaming_strategy.h"
 #include "moost/http/reply.hpp"
 
@@ -34,9 +36,19 @@ public:
         m_reply->set_status(200);  // OK, until proven otherwise
     }
 
-    virtual void write_content(const char *buffer, int size)
+    virtual bool write_content(const char *buffer, int size)
+    {
+        return m_reply->write_content(std::string(buffer, size));
+    }
+
+    virtual bool writable()
     {
-        m_reply->write_content(std::string(buffer, size));
+        return m_reply->writable();
+    }
+
+    virtual void set_resume_cb(boost::function<void(void)> cb)
+    {
+        m_reply->set_drain_cb(cb);
     }
 
     virtual void write_finish()
@@ -44,6 +56,11 @@ public:
         m_reply->write_finish();
     }
 
+    virtual void write_file(int fd, long long offset, long long length)
+    {
+        m_reply->write_file(fd, offset, length);
+    }
+
     virtual void write_cancel()
     {
         // something went wrong, set the http status code (if it's not too late)
@@ -52,7 +69,7 @@ public:
         m_reply->write_finish();
     }
 
-    virtual void set_content_length(int contentLength)
+    virtual void set_content_length(long long contentLength)
     {
         m_reply->add_header("Content-Length", contentLength);
     }
@@ -67,6 +84,23 @@ public:
         m_reply->set_status(status);
     }
 
+    virtual void set_content_range(long long first, long long last, long long total)
+    {
+        std::ostringstream os;
+        os << "bytes " << first << "-" << last << "/";
+        if (total < 0) os << "*"; else os << total;
+        m_reply->set_status(206);
+        m_reply->add_header("Content-Range", os.str());
+    }
+
+    virtual void set_range_not_satisfiable(long long total)
+    {
+        std::ostringstream os;
+        os << "bytes */" << total;
+        m_reply->set_status(416);
+        m_reply->add_header("Content-Range", os.str());
+    }
+
     virtual void set_finished_cb(boost::function<void(void)> cb)
     {
         m_reply->set_write_ending_cb(cb);
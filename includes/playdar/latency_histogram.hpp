@@ -0,0 +1,99 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __LATENCY_HISTOGRAM_H__
+#define __LATENCY_HISTOGRAM_H__
+
+#include <boost/thread/mutex.hpp>
+
+namespace playdar {
+
+/*
+    Histogram of response times in milliseconds, in roughly logarithmic
+    buckets. Counts are halved every so often, so percentiles follow
+    changes in behaviour (eg: a network resolver getting slower).
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+        : m_total(0)
+    {
+        for(int i = 0; i < num_buckets; i++) m_counts[i] = 0;
+    }
+
+    void add(unsigned int ms)
+    {
+        int b = 0;
+        while(b < num_buckets-1 && ms > bucket_limit(b)) b++;
+        boost::mutex::scoped_lock lk(m_mut);
+        m_counts[b]++;
+        if(++m_total >= decay_samples)
+        {
+            m_total = 0;
+            for(int i = 0; i < num_buckets; i++)
+            {
+                m_counts[i] /= 2;
+                m_total += m_counts[i];
+            }
+        }
+    }
+
+    /// number of samples currently counted (decayed)
+    unsigned int count() const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        return m_total;
+    }
+
+    /// upper bound in ms of the bucket holding the pc'th percentile,
+    /// or 0 if there are no samples.
+    unsigned int percentile(unsigned int pc) const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        if(m_total == 0) return 0;
+        unsigned int want = (m_total * pc + 99) / 100;
+        unsigned int seen = 0;
+        for(int i = 0; i < num_buckets; i++)
+        {
+            seen += m_counts[i];
+            if(seen >= want) return bucket_limit(i);
+        }
+        return bucket_limit(num_buckets-1);
+    }
+
+private:
+    static const int num_buckets = 16;
+    static const unsigned int decay_samples = 2000;
+
+    static unsigned int bucket_limit(int b)
+    {
+        static const unsigned int limits[num_buckets] =
+            { 1, 2, 5, 10, 20, 50, 100, 200, 500,
+              1000, 2000, 5000, 10000, 20000, 50000, 100000 };
+        return limits[b];
+    }
+
+    unsigned int m_counts[num_buckets];
+    unsigned int m_total;
+    mutable boost::mutex m_mut;
+};
+
+}
+
+#endif
@@ -42,6 +42,9 @@ public:
     const std::string postvar( const std::string& s ) const{ return m_postvars.find(s)->second; }
     const std::vector<std::string>& parts() const{ return m_parts; }
     const std::string& useragent() const { return m_useragent; }
+    /// a single "Range: bytes=first-[last]" header, as offset and length
+    /// (-1 to the end). false if there's none, or it's one we don't handle.
+    bool byte_range( long long& offset, long long& length ) const;
 private:
     
     void collect_parts( const std::string & url, std::vector<std::string>& parts );
@@ -49,6 +52,7 @@ private:
     
     std::string m_url;
     std::string m_useragent;
+    std::string m_range;
     std::vector<std::string> m_parts;
     std::map<std::string, std::string> m_getvars;
     std::map<std::string, std::string> m_postvars;    
@@ -46,7 +46,8 @@ private:
     void serve_body(const class playdar_response&, moost::http::reply& rep);
     void serve_static_file(const moost::http::request&, moost::http::reply& rep);
     void serve_track( moost::http::reply& rep, int tid);
-    void serve_sid( moost::http::reply& rep, source_uid sid);
+    void serve_sid( moost::http::reply& rep, source_uid sid,
+                    long long offset = -1, long long length = -1 );
     void serve_dynamic( moost::http::reply& rep, 
                         std::string tpl, std::map<std::string,std::string> vars);
 
@@ -19,8 +19,13 @@
 #ifndef _PLUGIN_ADAPTOR_H_
 #define _PLUGIN_ADAPTOR_H_
 
+#include <map>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
 #include "json_spirit/json_spirit.h"
 #include "playdar/types.h"
+#include "playdar/latency_histogram.hpp"
 //#include "playdar/streaming_strategy.h"
 #include "resolver_service.h"
 
@@ -59,9 +64,13 @@ public:
     virtual bool query_exists(const query_uid & qid) = 0;
     
     virtual std::vector< ri_ptr > get_results(query_uid qid) = 0;
+    /// results added since version "since", sets version to pass next time.
+    virtual std::vector< ri_ptr > get_results_since(query_uid qid, size_t since, size_t& version) = 0;
     virtual int num_results(query_uid qid) = 0;
     virtual rq_ptr rq(const query_uid & qid) = 0;
     virtual void cancel_query(const query_uid & qid) = 0;
+    /// call if results of recent queries may be out of date, eg: library rescanned.
+    virtual void invalidate_result_cache() = 0;
     
     virtual ResolverService * rs() const { return m_rs; }
     virtual const std::string hostname() const = 0;
@@ -84,6 +93,53 @@ public:
     void set_scriptpath(std::string s) { m_scriptpath = s; }
     void set_localonly(bool t) { m_localonly = t; }
 
+    /// measuring how long this resolver takes from start_resolving
+    /// to reporting its first results for a query:
+    void mark_dispatched(const query_uid& qid)
+    {
+        boost::mutex::scoped_lock lk(m_mut_dispatched);
+        m_dispatched[qid] = boost::posix_time::microsec_clock::universal_time();
+    }
+    
+    void mark_reported(const query_uid& qid)
+    {
+        boost::posix_time::ptime t;
+        {
+            boost::mutex::scoped_lock lk(m_mut_dispatched);
+            std::map< query_uid, boost::posix_time::ptime >::iterator it = m_dispatched.find(qid);
+            if(it == m_dispatched.end()) return; // not first results, or not from the pipeline
+            t = it->second;
+            m_dispatched.erase(it);
+        }
+        boost::posix_time::time_duration d = 
+            boost::posix_time::microsec_clock::universal_time() - t;
+        m_latency.add( d.total_milliseconds() );
+    }
+    
+    /// @return true if the resolver had been given qid, but not reported results yet.
+    /// if it timed_out (the pipeline waited its time and moved on), that
+    /// counts as a sample of at least the target time. otherwise (it was cut
+    /// short, or the query went away) there's nothing to learn from it.
+    bool forget_dispatched(const query_uid& qid, bool timed_out)
+    {
+        boost::posix_time::ptime t;
+        {
+            boost::mutex::scoped_lock lk(m_mut_dispatched);
+            std::map< query_uid, boost::posix_time::ptime >::iterator it = m_dispatched.find(qid);
+            if(it == m_dispatched.end()) return false;
+            t = it->second;
+            m_dispatched.erase(it);
+        }
+        if(!timed_out) return true;
+        boost::posix_time::time_duration d = 
+            boost::posix_time::microsec_clock::universal_time() - t;
+        unsigned int ms = d.total_milliseconds();
+        m_latency.add( ms > m_targettime ? ms : m_targettime );
+        return true;
+    }
+    
+    const LatencyHistogram& latency() const { return m_latency; }
+
     virtual ss_ptr get_ss( const source_uid& sid ) = 0;
     virtual ri_ptr get_ri( const source_uid& sid ) = 0;
     
@@ -101,6 +157,10 @@ private:
     bool m_localonly;
     std::string m_scriptpath;
     
+    // when each pending query was passed to this resolver:
+    std::map< query_uid, boost::posix_time::ptime > m_dispatched;
+    boost::mutex m_mut_dispatched;
+    LatencyHistogram m_latency;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -119,6 +119,7 @@ public:
             }
             v.push_back( rip );
         }
+        mark_reported( qid );
         m_resolver->add_results( qid, v, rs()->name() );
         return true;
     }
@@ -138,6 +139,11 @@ public:
         return m_resolver->get_results(qid); 
     }
     
+    virtual std::vector< ri_ptr > get_results_since(query_uid qid, size_t since, size_t& version)
+    {
+        return m_resolver->get_results_since(qid, since, version); 
+    }
+    
     virtual rq_ptr rq(const query_uid & qid)
     {
         return m_resolver->rq(qid); 
@@ -153,6 +159,11 @@ public:
         m_resolver->cancel_query(qid); 
     }
 
+    virtual void invalidate_result_cache()
+    {
+        m_resolver->invalidate_result_cache();
+    }
+
     virtual query_uid dispatch(boost::shared_ptr<ResolverQuery> rq)
     { 
         return m_resolver->dispatch(rq); 
@@ -20,6 +20,8 @@
 #define __RESOLVED_ITEM_H__
 
 #include <string>
+#include <cstring>
+#include <boost/cstdint.hpp>
 #include <boost/function.hpp>
 #include <boost/foreach.hpp>
 #include "playdar/types.h"
@@ -27,44 +29,78 @@
 
 namespace playdar {
 
+/*
+    A playable result, as a set of json fields.
+
+    The well-known fields (sid, score, url, artist etc) live in typed
+    members, so the hot accessors and sorting don't do string-keyed map
+    lookups. Anything else, or a well-known field reported with an
+    unexpected json type, goes in an overflow map. Through the json_value
+    API it all looks like one json object, as before.
+*/
 class ResolvedItem
 {
 public:
 
     ResolvedItem()
+        : m_score(-1.0), m_present(0)
     {
         
     }
     
     ResolvedItem( const json_spirit::Object& jsonobj )
+        : m_score(-1.0), m_present(0)
     {
-        json_spirit::obj_to_map( jsonobj, m_jsonmap );
+        BOOST_FOREACH( const json_spirit::Pair& p, jsonobj )
+        {
+            set_value( p.name_, p.value_ );
+        }
     }
     
     virtual ~ResolvedItem(){};
     
+    /// fields in name order, like the json object we were made from.
     json_spirit::Object get_json( bool stripUrl = false ) const
     {
         using namespace json_spirit;
         
         Object o;
-        map_to_obj( m_jsonmap, o );
+        o.reserve( num_fields + m_extras.size() );
+        std::map< std::string, Value >::const_iterator x = m_extras.begin();
+        for( int f = 0; f < num_fields; ++f )
+        {
+            if( !has_field(f) ) continue;
+            for( ; x != m_extras.end() && x->first < fieldinfo(f).name; ++x )
+                o.push_back( Pair( x->first, x->second ) );
+            o.push_back( Pair( fieldinfo(f).name, field_value(f) ) );
+        }
+        for( ; x != m_extras.end(); ++x )
+            o.push_back( Pair( x->first, x->second ) );
         return o;
     }
     
-    void rm_json_value( const std::string& v ){ m_jsonmap.erase( v ); }
-    const source_uid id() const         { return json_value( "sid", ""); }
-    void set_id(const source_uid& s)    { set_json_value( "sid", s ); }
+    void rm_json_value( const std::string& v )
+    {
+        int f = field_for( v );
+        if( f != f_none ) m_present &= ~(1 << f);
+        m_extras.erase( v );
+    }
+    
+    const source_uid& id() const        { return str_field( f_sid ); }
+    void set_id(const source_uid& s)    { set_str_field( f_sid, s ); }
 
-    void set_score( const double s )    { set_json_value( "score", s ); }
-    const float score() const           { return (float) json_value( "score",  -1.0); }
-    void set_preference( const short p ){ set_json_value( "preference", p ); }
-    const short preference() const      { return json_value( "preference",  -1); }
+    void set_score( const double s )    { m_score = s; m_present |= 1 << f_score; m_extras.erase( "score" ); }
+    const float score() const           { return has_field( f_score ) ? (float) m_score : -1.0f; }
+    void set_preference( const short p ){ set_int_field( f_preference, p ); }
+    const short preference() const      { return has_field( f_preference ) ? (short) m_ints[ fieldinfo(f_preference).idx ] : -1; }
     
-    const std::string source() const    { return json_value( "source", "" ); }
+    const std::string& source() const   { return str_field( f_source ); }
+    const std::string& artist() const   { return str_field( f_artist ); }
+    const std::string& album() const    { return str_field( f_album ); }
+    const std::string& track() const    { return str_field( f_track ); }
     
-    virtual void set_url(const std::string& s)  { m_jsonmap["url"] = s; }
-    virtual const std::string url() const  { return json_value( "url", "" ); }
+    virtual void set_url(const std::string& s)  { set_str_field( f_url, s ); }
+    virtual const std::string url() const  { return str_field( f_url ); }
     
     /// extra headers to send in the request for this url.
     /// typically only used for http urls, but could be implemented for 
@@ -74,8 +110,8 @@ public:
     {
         using namespace json_spirit;
         std::vector<std::string> headers;
-        std::map< std::string, Value >::const_iterator i = m_jsonmap.find( "extra_headers" );
-        if( i != m_jsonmap.end() && i->second.type() == array_type )
+        std::map< std::string, Value >::const_iterator i = m_extras.find( "extra_headers" );
+        if( i != m_extras.end() && i->second.type() == array_type )
         {
             BOOST_FOREACH( Value v, i->second.get_array() )
             {
@@ -90,10 +126,14 @@ public:
     template< typename T >
     bool has_json_value( const std::string& s ) const
     {
+        int f = field_for( s );
+        if( f != f_none && has_field( f ) )
+            return fieldinfo(f).type == json_type<T>();
+        
         std::map< std::string, json_spirit::Value >::const_iterator i = 
-            m_jsonmap.find( s );
+            m_extras.find( s );
         
-        return i != m_jsonmap.end() &&
+        return i != m_extras.end() &&
         i->second.type() == json_type<T>();
     }
     
@@ -105,10 +145,16 @@ public:
     template< typename T >
     T json_value( const std::string& s, const T& def ) const
     {
+        int f = field_for( s );
+        if( f != f_none && has_field( f ) )
+            return fieldinfo(f).type == json_type<T>()
+                ? field_value( f ).get_value<T>()
+                : def;
+        
         std::map< std::string, json_spirit::Value >::const_iterator i = 
-            m_jsonmap.find( s );
+            m_extras.find( s );
         
-        return i != m_jsonmap.end() && i->second.type() == json_type<T>() 
+        return i != m_extras.end() && i->second.type() == json_type<T>() 
             ? i->second.get_value<T>()
             : def;
     }
@@ -116,14 +162,116 @@ public:
     template< typename T >
     void set_json_value( const std::string& k, const T& v )
     {
-        m_jsonmap[k] = v;
+        set_value( k, json_spirit::Value( v ) );
     }
 
-    void set_source(const std::string& s)   { m_jsonmap["source"] = s; }
+    void set_source(const std::string& s)   { set_str_field( f_source, s ); }
 
     
 private:
-    std::map< std::string, json_spirit::Value > m_jsonmap;
+    // well-known fields, in name order:
+    enum field { f_album, f_artist, f_bitrate, f_duration, f_preference, f_score, 
+                 f_sid, f_size, f_source, f_track, f_url, num_fields, f_none = -1 };
+    
+    struct field_info
+    {
+        const char * name;
+        json_spirit::Value_type type;
+        int idx; // into m_strs or m_ints
+    };
+    
+    static const field_info& fieldinfo( int f )
+    {
+        static const field_info info[num_fields] = {
+            { "album",      json_spirit::str_type,  0 },
+            { "artist",     json_spirit::str_type,  1 },
+            { "bitrate",    json_spirit::int_type,  0 },
+            { "duration",   json_spirit::int_type,  1 },
+            { "preference", json_spirit::int_type,  2 },
+            { "score",      json_spirit::real_type, 0 },
+            { "sid",        json_spirit::str_type,  2 },
+            { "size",       json_spirit::int_type,  3 },
+            { "source",     json_spirit::str_type,  3 },
+            { "track",      json_spirit::str_type,  4 },
+            { "url",        json_spirit::str_type,  5 } };
+        return info[f];
+    }
+    
+    /// binary search of the well-known names, f_none if not one of them.
+    static int field_for( const std::string& k )
+    {
+        int lo = 0, hi = num_fields - 1;
+        while( lo <= hi )
+        {
+            int mid = (lo + hi) / 2;
+            int c = std::strcmp( k.c_str(), fieldinfo(mid).name );
+            if( c == 0 ) return mid;
+            if( c < 0 ) hi = mid - 1;
+            else lo = mid + 1;
+        }
+        return f_none;
+    }
+    
+    bool has_field( int f ) const { return (m_present & (1 << f)) != 0; }
+    
+    const std::string& str_field( int f ) const
+    {
+        static const std::string empty;
+        return has_field( f ) ? m_strs[ fieldinfo(f).idx ] : empty;
+    }
+    
+    void set_str_field( int f, const std::string& s )
+    {
+        m_strs[ fieldinfo(f).idx ] = s;
+        m_present |= 1 << f;
+        m_extras.erase( fieldinfo(f).name );
+    }
+    
+    void set_int_field( int f, boost::int64_t i )
+    {
+        m_ints[ fieldinfo(f).idx ] = i;
+        m_present |= 1 << f;
+        m_extras.erase( fieldinfo(f).name );
+    }
+    
+    json_spirit::Value field_value( int f ) const
+    {
+        switch( fieldinfo(f).type )
+        {
+            case json_spirit::str_type:  return json_spirit::Value( m_strs[ fieldinfo(f).idx ] );
+            case json_spirit::int_type:  return json_spirit::Value( m_ints[ fieldinfo(f).idx ] );
+            case json_spirit::real_type: return json_spirit::Value( m_score );
+            default:                     return json_spirit::Value();
+        }
+    }
+    
+    /// into a typed field if it's a well-known one of the right type,
+    /// otherwise into the overflow map.
+    void set_value( const std::string& k, const json_spirit::Value& v )
+    {
+        int f = field_for( k );
+        if( f != f_none && fieldinfo(f).type == v.type() )
+        {
+            switch( v.type() )
+            {
+                case json_spirit::str_type:  set_str_field( f, v.get_str() ); break;
+                case json_spirit::int_type:  set_int_field( f, v.get_int64() ); break;
+                case json_spirit::real_type: set_score( v.get_real() ); break;
+                default: break;
+            }
+            return;
+        }
+        if( f != f_none ) m_present &= ~(1 << f);
+        m_extras[k] = v;
+    }
+    
+    std::string m_strs[6];
+    boost::int64_t m_ints[4];
+    double m_score;
+    unsigned short m_present; // bit per well-known field that is set
+    
+    // everything else:
+    std::map< std::string, json_spirit::Value > m_extras;
     
     template< typename T > 
     static json_spirit::Value_type json_type();
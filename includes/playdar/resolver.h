@@ -27,8 +27,13 @@
 
 #include "playdar/types.h"
 #include "playdar/resolver_query.hpp"
+#include "playdar/result_cache.hpp"
+#include "playdar/scorer.h"
 #include "playdar/resolver_service.h"
 #include "playdar/utils/uuid.h"
+#include "playdar/utils/sharded_map.hpp"
+#include "playdar/utils/expiry_wheel.hpp"
+#include "playdar/utils/worker_pool.hpp"
 
 #include <DynamicClass.hpp>
 
@@ -65,12 +70,12 @@ public:
                      const std::vector< ri_ptr >& results,
                      std::string via);
     std::vector< ri_ptr > get_results(query_uid qid);
+    std::vector< ri_ptr > get_results_since(query_uid qid, size_t since, size_t& version);
     int num_results(query_uid qid);
     
     bool query_exists(const query_uid & qid);
     bool add_new_query(boost::shared_ptr<ResolverQuery> rq);
     void cancel_query(const query_uid & qid);
-    void cancel_query_timeout(query_uid qid);
 
     rq_ptr rq(const query_uid & qid);
     ss_ptr get_ss(const source_uid & sid);
@@ -79,6 +84,10 @@ public:
     
     size_t num_seen_queries();
     
+    /// null if the result cache is disabled in config.
+    const ResultCache * result_cache() const { return m_result_cache; }
+    void invalidate_result_cache();
+    
     const std::vector< pa_ptr >& resolvers() const
     { return m_resolvers; }
 
@@ -103,6 +112,13 @@ public:
         return 21600; // 6 hours.
     }
     
+    /// granularity in seconds of the stale-query sweep. queries live for
+    /// up to this long past max_query_lifetime before being deleted.
+    const time_t expiry_granularity() const
+    {
+        return 60;
+    }
+    
     std::string gen_uuid() const
     {
         return m_uuid_gen();
@@ -114,8 +130,23 @@ public:
                        unsigned short lastweight,
                        boost::shared_ptr<boost::asio::deadline_timer> oldtimer);
     void run_pipeline( rq_ptr rq, unsigned short lastweight );
+    void pipeline_finished( rq_ptr rq,
+                        unsigned short lastweight,
+                        boost::shared_ptr<boost::asio::deadline_timer> oldtimer);
+    /// latency samples for the resolvers of weight that didn't answer in time.
+    void record_timeouts( const rq_ptr& rq, unsigned short weight );
+    
+    /// true if rq has enough good results to stop descending the pipeline.
+    bool enough_results( const rq_ptr& rq );
+    void stop_resolving( const rq_ptr& rq );
+    
+    /// ms to wait for this resolver before moving down the pipeline.
+    unsigned int pipeline_targettime( const pa_ptr& pap ) const;
+    
+    void dispatch_runner(const std::pair<rq_ptr, unsigned short>& p);
+    void callback_runner();
     
-    void dispatch_runner();
+    void expire_queries(const boost::system::error_code& e);
     
     bool create_comet_session(const std::string& sessionId, rq_callback_t cb);
     void remove_comet_session(const std::string& sessionId);
@@ -124,31 +155,43 @@ protected:
 
 
     static std::string sortname(const std::string& name);
+    
+    static std::string cache_key(const rq_ptr & rq);
+    bool serve_from_cache(rq_ptr rq);
+    void forward_cached_result(const query_uid & qid, ri_ptr rip);
 
-    static float calculate_score( const rq_ptr & rq,  // query
-                           const ri_ptr & ri,  // candidate
-                           std::string & reason );  // fail reason
+    void score_results( const rq_ptr & rq,
+                        const std::vector< ri_ptr >& results,
+                        std::vector< ri_ptr >& scored );
 
 private:
     boost::asio::io_service::work * m_work;
     boost::asio::io_service * m_io_service;
+
+    // for firing query callbacks, see post_callbacks():
+    void post_callbacks(boost::function<void()> job);
+    boost::asio::io_service::work * m_cb_work;
+    boost::asio::io_service * m_cb_io_service;
+    boost::thread_group m_cb_threads;
     
     query_uid generate_qid();
     source_uid generate_sid();
     
     MyApplication * m_app;
     
-    std::map< query_uid, rq_ptr > m_queries;
-    std::map< source_uid, ri_ptr > m_sid2ri;
-    // timers used to auto-cancel queries that are inactive for long enough:
-    std::map< query_uid, boost::asio::deadline_timer* > m_qidtimers;
+    // lock-striped, so reporting resolvers and pollers rarely contend:
+    utils::sharded_map< query_uid, rq_ptr > m_queries;
+    utils::sharded_map< source_uid, ri_ptr > m_sid2ri;
+    // timer wheel used to auto-cancel queries that are inactive for long enough,
+    // advanced every expiry_granularity() seconds by m_expiry_timer:
+    void schedule_expiry(const query_uid & qid, time_t secs);
+    utils::expiry_wheel< query_uid > m_expiry_wheel;
+    boost::asio::deadline_timer * m_expiry_timer;
     
     // newest-first list of dispatched qids:
     std::deque< query_uid > m_qidlist;
     boost::mutex m_mut_qidlist;
     
-    bool m_exiting;
-    boost::thread * m_t;
     boost::thread * m_iothr;
     unsigned int m_id_counter;
 
@@ -157,13 +200,29 @@ private:
 
     std::map< std::string, ResolverService* > m_pluginNameMap;
     
-    boost::mutex m_mut_results; // when adding results
-    
-    // for dispatching to the pipeline:
-    std::deque< std::pair<rq_ptr, unsigned short> > m_pending;
+    // for dispatching to the pipeline, the query and the weight it's at:
+    utils::worker_pool< std::pair<rq_ptr, unsigned short> > m_dispatch_pool;
     boost::mutex m_mutex;
-    boost::condition m_cond;
 
+    // schedule pipeline from measured resolver latency, see "pipeline" config:
+    bool m_adaptive_pipeline;
+    unsigned int m_adaptive_percentile;
+    unsigned int m_adaptive_min_samples;
+    unsigned int m_adaptive_max_wait;
+    
+    // when to stop descending the pipeline, see "pipeline" config:
+    float m_solved_score;
+    unsigned int m_enough_results;
+    float m_enough_score;
+    int m_enough_preference;
+    
+    // recent queries, reused by identical queries. see "result_cache" config:
+    ResultCache * m_result_cache;
+    bool m_cache_coalesce;
+    
+    // scores results resolvers didn't score, see "scoring" config:
+    Scorer * m_scorer;
+    
     // StreamingStrategy factories
     std::map< std::string, boost::function<ss_ptr(std::string)> > m_ss_factories;
     
@@ -22,12 +22,18 @@
 #include "playdar/types.h"
 #include "playdar/config.hpp"
 #include "playdar/resolved_item.h"
+#include "playdar/utils/normalize.hpp"
+#include "playdar/utils/word_weights.hpp"
 
 #include "json_spirit/json_spirit.h"
+#include <algorithm>
+#include <deque>
 #include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/thread/mutex.hpp>
 #include "time.h"
 
@@ -36,19 +42,68 @@ namespace playdar {
 // Represents a search query to resolve a particular track
 // Contains results, as they are found
 
-class ResolverQuery
+class ResolverQuery : public boost::enable_shared_from_this<ResolverQuery>
 {
 public:
+    /// runs a job on some other thread, see set_callback_executor.
+    typedef boost::function< void ( boost::function<void()> ) > executor_t;
+
     ResolverQuery()
-        : m_solved(false), m_cancelled(false), m_stopped(false),  m_origin_local(false)
+        : m_callbacks(new std::vector<rq_callback_t>), m_delivering(false),
+          m_solved(false), m_solved_score(1.0), m_cancelled(false), m_stopped(false),  m_origin_local(false)
     {
         // set initial "last access" time:
         time(&m_atime);
     }
     
     void set_origin_local(bool b) { m_origin_local = b; }
+
+    /// callbacks for new results are fired by jobs given to exec, instead
+    /// of on whichever thread adds the results. only for queries owned by
+    /// an rq_ptr, set it before registering callbacks.
+    void set_callback_executor(executor_t exec) { m_executor = exec; }
+    
+    /// a result scoring at least this "solves" the query.
+    void set_solved_score(float s) { m_solved_score = s; }
+    float solved_score() const { return m_solved_score; }
     bool origin_local() const { return m_origin_local; }
     
+    /// track query fields as utils::match_name, for scoring candidates.
+    struct normalized_track
+    {
+        std::string artist, album, track;
+        // the same, split into words:
+        std::vector<std::string> artist_tokens, track_tokens;
+        // how much each of those words counts, and the totals,
+        // see utils::weigh_words:
+        std::vector<float> artist_weights, track_weights;
+        float artist_weight, track_weight;
+    };
+    
+    /// worked out on first use and kept, so scoring a batch of results
+    /// doesn't redo it for every candidate. only meaningful if isValidTrack().
+    boost::shared_ptr< const normalized_track > normalized() const
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        if( !m_normalized )
+        {
+            boost::shared_ptr< normalized_track > n( new normalized_track );
+            n->artist = normalize( "artist" );
+            n->album  = normalize( "album" );
+            n->track  = normalize( "track" );
+            if( !n->artist.empty() )
+                boost::split( n->artist_tokens, n->artist, boost::is_any_of(" ") );
+            if( !n->track.empty() )
+                boost::split( n->track_tokens, n->track, boost::is_any_of(" ") );
+            n->artist_weight = utils::weigh_words( n->artist_tokens.size(), 
+                utils::string_words( n->artist_tokens ), n->artist_weights );
+            n->track_weight = utils::weigh_words( n->track_tokens.size(), 
+                utils::string_words( n->track_tokens ), n->track_weights );
+            m_normalized = n;
+        }
+        return m_normalized;
+    }
+    
     /// when was this query last "used"
     time_t atime() const
     {
@@ -76,7 +131,8 @@ public:
     {
         boost::mutex::scoped_lock lock(m_mut);
         m_cancelled = true;
-        m_callbacks.clear();
+        m_callbacks.reset( new std::vector<rq_callback_t> );
+        m_undelivered.clear();
         std::cout << "RQ::cancel() for " << id() << std::endl;
     }
     
@@ -146,27 +202,45 @@ public:
     size_t num_results() const
     {
         boost::mutex::scoped_lock lock(m_mut);
-        return m_results.size();
+        return m_arrivals.size();
     }
 
+    /// results sorted on score/preference.
     std::vector< ri_ptr > results()
+    {
+        return *results_snapshot();
+    }
+
+    /// shared, read-only copy of the sorted results. it's only rebuilt
+    /// after new results arrive, so polling the same query is cheap.
+    boost::shared_ptr< const std::vector< ri_ptr > > results_snapshot() const
     {
         time(&m_atime);
-        // sort results on score/preference.
-        // TODO this could be memoized
-        boost::function
-                    < bool 
-                    (   const ri_ptr &, 
-                        const ri_ptr &
-                    ) > sortfun = 
-                    boost::bind(&ResolverQuery::sorter, this, _1, _2);
-        
         boost::mutex::scoped_lock lock(m_mut);
-        sort(m_results.begin(), m_results.end(), sortfun);
-        return m_results; 
+        if( !m_snapshot )
+            m_snapshot.reset( new std::vector< ri_ptr >( m_results ) );
+        return m_snapshot;
     }
 
-    bool sorter(const ri_ptr & lhs, const ri_ptr & rhs)
+    /// goes up by one for each result added.
+    size_t version() const
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        return m_arrivals.size();
+    }
+
+    /// results added after version "since", in the order they arrived.
+    /// @param version set to the current version, to pass as "since" next time.
+    std::vector< ri_ptr > results_since( size_t since, size_t& version ) const
+    {
+        time(&m_atime);
+        boost::mutex::scoped_lock lock(m_mut);
+        version = m_arrivals.size();
+        if( since >= version ) return std::vector< ri_ptr >();
+        return std::vector< ri_ptr >( m_arrivals.begin() + since, m_arrivals.end() );
+    }
+
+    static bool sorter(const ri_ptr & lhs, const ri_ptr & rhs)
     {
         // if equal scores, prefer item with higher preference 
         // usually this indicates network reliability or user-configured preference
@@ -178,48 +252,61 @@ public:
     }
 
     // add a single result
-    void add_result( ri_ptr rip )
+    /// @return false if the query is cancelled, checked under the same lock
+    /// as cancel(), so a result that's added is in the results cancel() sees.
+    bool add_result( ri_ptr rip )
     {
-        if (!m_cancelled) {
+        {
             boost::mutex::scoped_lock lock(m_mut);
-            if (rip->score() == 1.0) {
+            if (m_cancelled) return false;
+            if (rip->score() >= m_solved_score) {
                 m_solved = true;
             }
-			m_results.push_back(rip); 
-            // fire callbacks:
-            BOOST_FOREACH(rq_callback_t & cb, m_callbacks) {
-				cb(id(), rip);
-            }
+            insert_result(rip);
+            queue_callbacks(m_callbacks, rip);
         }
+        deliver_callbacks();
+        return true;
     }
 
     // add a vector of results
     void add_results(const std::vector< ri_ptr >& results) 
     { 
         if (!m_cancelled) {
-            boost::mutex::scoped_lock lock(m_mut);
-            BOOST_FOREACH(const ri_ptr& rip, results) {
-				m_results.push_back(rip); 
-            }
-
-            BOOST_FOREACH(const ri_ptr& rip, results) {
-                // decide if this result "solves" the query:
-                // for now just assume score of 1 means solved.
-                if(rip->score() == 1.0) {
-                    m_solved = true;
-                }
-                // fire callbacks:
-                BOOST_FOREACH(rq_callback_t & cb, m_callbacks) {
-					cb(id(), rip);
+            {
+                boost::mutex::scoped_lock lock(m_mut);
+                BOOST_FOREACH(const ri_ptr& rip, results) {
+                    // decide if this result "solves" the query:
+                    if(rip->score() >= m_solved_score) {
+                        m_solved = true;
+                    }
+                    insert_result(rip);
+                    queue_callbacks(m_callbacks, rip);
                 }
             }
+            deliver_callbacks();
         }
     }
 
-    void register_callback(rq_callback_t cb)
+    /// if replay is set, cb is also fired for the results found so far,
+    /// so it sees every result exactly once.
+    void register_callback(rq_callback_t cb, bool replay = false)
     {
-        boost::mutex::scoped_lock lock(m_mut);
-        m_callbacks.push_back( cb );
+        {
+            boost::mutex::scoped_lock lock(m_mut);
+            // copy-on-write, lists already queued for delivery are unaffected:
+            boost::shared_ptr< std::vector<rq_callback_t> > cbs( 
+                new std::vector<rq_callback_t>( *m_callbacks ) );
+            cbs->push_back( cb );
+            m_callbacks = cbs;
+            if (replay && !m_arrivals.empty()) {
+                callbacks_ptr just_cb( new std::vector<rq_callback_t>( 1, cb ) );
+                BOOST_FOREACH(const ri_ptr& rip, m_arrivals) {
+                    queue_callbacks(just_cb, rip);
+                }
+            }
+        }
+        deliver_callbacks();
     }
     
     bool solved()   const { return m_solved; }
@@ -230,7 +317,12 @@ public:
     const json_spirit::Value_type param_type( const std::string& param ) const { return m_qryobj_map.find( param )->second.type(); }
     
     template<typename T>
-    void set_param( const std::string& param, const T& value ){ m_qryobj_map[param] = value; }
+    void set_param( const std::string& param, const T& value )
+    { 
+        m_qryobj_map[param] = value; 
+        boost::mutex::scoped_lock lock(m_mut);
+        m_normalized.reset();
+    }
     
     std::string str() const
     {
@@ -278,19 +370,108 @@ protected:
     std::map<std::string,json_spirit::Value> m_qryobj_map;
 
 private:
+    /// keeps m_results sorted as results arrive, so readers never sort.
+    /// equal-ranked results stay in arrival order. caller holds m_mut.
+    void insert_result( const ri_ptr& rip )
+    {
+        m_results.insert( std::upper_bound( m_results.begin(), m_results.end(),
+                                            rip, &ResolverQuery::sorter ),
+                          rip );
+        m_arrivals.push_back( rip );
+        m_snapshot.reset();
+    }
+
+    std::string normalize( const std::string& param ) const
+    {
+        std::map<std::string,json_spirit::Value>::const_iterator it = m_qryobj_map.find( param );
+        if( it == m_qryobj_map.end() || it->second.type() != json_spirit::str_type )
+            return "";
+        return utils::match_name( it->second.get_str() );
+    }
+
+    typedef boost::shared_ptr< const std::vector<rq_callback_t> > callbacks_ptr;
+    
+    /// caller holds m_mut.
+    void queue_callbacks( const callbacks_ptr& cbs, const ri_ptr& rip )
+    {
+        if( !cbs->empty() )
+            m_undelivered.push_back( std::make_pair( cbs, rip ) );
+    }
+    
+    /// fires queued callbacks without holding m_mut, so a slow subscriber
+    /// doesn't hold up other resolvers reporting results, or readers.
+    /// only one delivery runs at a time, in queue order; anyone else
+    /// finding a delivery underway leaves their results for it to send.
+    /// with an executor, the delivery runs there, so the thread adding
+    /// results never waits for callbacks at all.
+    void deliver_callbacks()
+    {
+        {
+            boost::mutex::scoped_lock lock(m_mut);
+            if( m_delivering || m_undelivered.empty() ) return;
+            m_delivering = true;
+        }
+        if( m_executor )
+            m_executor( boost::bind( &ResolverQuery::drain_callbacks, shared_from_this() ) );
+        else
+            drain_callbacks();
+    }
+
+    /// fires callbacks until the queue is empty. m_delivering is set by the caller.
+    void drain_callbacks()
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        while( !m_undelivered.empty() )
+        {
+            std::deque< std::pair<callbacks_ptr, ri_ptr> > batch;
+            batch.swap( m_undelivered );
+            lock.unlock();
+            try
+            {
+                typedef std::pair<callbacks_ptr, ri_ptr> pending_t;
+                BOOST_FOREACH( const pending_t& p, batch )
+                {
+                    if( m_cancelled ) break;
+                    BOOST_FOREACH( const rq_callback_t& cb, *p.first )
+                        cb( id(), p.second );
+                }
+            }
+            catch(...)
+            {
+                lock.lock();
+                m_delivering = false;
+                throw;
+            }
+            lock.lock();
+        }
+        m_delivering = false;
+    }
+
     query_uid m_uuid;
-    std::vector< ri_ptr > m_results;
+    std::vector< ri_ptr > m_results;  // sorted on score/preference
+    std::vector< ri_ptr > m_arrivals; // in the order added, index is the version
+    // shared sorted copy of m_results, null once stale:
+    mutable boost::shared_ptr< const std::vector< ri_ptr > > m_snapshot;
     std::string m_from_name;
     std::string m_comet_session_id;
         
     // list of functors to fire on new result:
-    std::vector<rq_callback_t> m_callbacks;
+    // replaced, not modified, when a callback is added:
+    callbacks_ptr m_callbacks;
+    // results waiting for callbacks to be fired, and who to fire:
+    std::deque< std::pair<callbacks_ptr, ri_ptr> > m_undelivered;
+    bool m_delivering; // a thread is in drain_callbacks(), or one is queued
+    executor_t m_executor; // runs drain_callbacks(), if set
+    
+    // see normalized():
+    mutable boost::shared_ptr< const normalized_track > m_normalized;
 
-    // for protecting m_results and m_callbacks
+    // for protecting m_results, m_arrivals, m_snapshot and the callback queue
     mutable boost::mutex m_mut;     
 
     // set to true once we get a decent result
     bool m_solved;
+    float m_solved_score;
 
     // set to true if trying to cancel/delete this query (if so, don't bother working with it)
     bool m_cancelled;
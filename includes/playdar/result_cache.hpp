@@ -0,0 +1,164 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __RESULT_CACHE_H__
+#define __RESULT_CACHE_H__
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+#include "time.h"
+
+#include "playdar/types.h"
+#include "playdar/resolver_query.hpp"
+
+namespace playdar {
+
+/*
+    Remembers the most recent query dispatched for each normalized
+    artist/album/track key, so identical queries arriving shortly after
+    can reuse its results instead of running the whole pipeline again.
+
+    The cached query still owns its results; entries only hold a weak
+    reference, and go away after ttl seconds, when the query is
+    cancelled, or when the cache is cleared (eg: library changed).
+*/
+class ResultCache
+{
+public:
+    ResultCache(size_t max_entries, time_t ttl)
+        : m_max_entries(max_entries), m_ttl(ttl), m_hits(0), m_misses(0)
+    {}
+
+    /// @return the cached query for this key, or null if there isn't a fresh one.
+    rq_ptr lookup(const std::string& key)
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        return lookup_locked(key);
+    }
+
+    /// lookup(), and if there isn't a fresh one make rq the cached query,
+    /// under the same lock: of identical queries arriving together, only
+    /// the first misses, and the others find it.
+    /// @return the cached query, or null if rq is now cached.
+    rq_ptr lookup_or_insert(const std::string& key, const rq_ptr& rq)
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        rq_ptr cached = lookup_locked(key);
+        if(!cached) insert_locked(key, rq);
+        return cached;
+    }
+
+    /// make rq the cached query for key, replacing any older one.
+    void insert(const std::string& key, const rq_ptr& rq)
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        insert_locked(key, rq);
+    }
+
+    void clear()
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        m_entries.clear();
+        m_order.clear();
+    }
+
+    size_t size() const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        return m_entries.size();
+    }
+
+    size_t hits() const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        return m_hits;
+    }
+
+    size_t misses() const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        return m_misses;
+    }
+
+    size_t max_entries() const { return m_max_entries; }
+    time_t ttl() const      { return m_ttl; }
+
+private:
+    // callers hold m_mut:
+    rq_ptr lookup_locked(const std::string& key)
+    {
+        std::map<std::string, entry>::iterator it = m_entries.find(key);
+        if(it != m_entries.end())
+        {
+            rq_ptr rq = it->second.rq.lock();
+            if(rq && !rq->cancelled() && time(0) - it->second.ctime < m_ttl)
+            {
+                ++m_hits;
+                return rq;
+            }
+            m_order.erase(it->second.pos);
+            m_entries.erase(it);
+        }
+        ++m_misses;
+        return rq_ptr();
+    }
+
+    void insert_locked(const std::string& key, const rq_ptr& rq)
+    {
+        std::map<std::string, entry>::iterator it = m_entries.find(key);
+        if(it != m_entries.end())
+        {
+            m_order.erase(it->second.pos);
+        }
+        else if(m_entries.size() >= m_max_entries && !m_order.empty())
+        {
+            // evict oldest:
+            m_entries.erase(m_order.front());
+            m_order.pop_front();
+        }
+        entry& e = m_entries[key];
+        e.rq = rq;
+        e.ctime = time(0);
+        e.pos = m_order.insert(m_order.end(), key);
+    }
+
+    struct entry
+    {
+        boost::weak_ptr<ResolverQuery> rq;
+        time_t ctime;
+        std::list<std::string>::iterator pos; // in m_order
+    };
+
+    std::map<std::string, entry> m_entries;
+    std::list<std::string> m_order; // keys, oldest first
+
+    size_t m_max_entries;
+    time_t m_ttl;
+    size_t m_hits;
+    size_t m_misses;
+
+    // protects m_entries, m_order and the counters
+    mutable boost::mutex m_mut;
+};
+
+}
+
+#endif
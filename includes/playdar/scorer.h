@@ -0,0 +1,51 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __SCORER_H__
+#define __SCORER_H__
+
+#include <string>
+#include "playdar/resolver_query.hpp"
+
+namespace playdar {
+
+// Scores how well a result's names match a track query. The resolver
+// uses one of these, chosen by the "scoring.method" config option, for
+// results that a resolver didn't score itself.
+
+class Scorer
+{
+public:
+    virtual ~Scorer(){}
+    
+    virtual std::string name() const = 0;
+    
+    /// @return score 0-1, or 0 if it's not a match.
+    /// @param q the query, art/trk the candidate's artist and track,
+    ///        all normalized with utils::match_name.
+    /// @param reason will be set to the fail reason.
+    /// called from several threads at once, so must not modify the scorer.
+    virtual float score( const ResolverQuery::normalized_track& q,
+                         const std::string& art,
+                         const std::string& trk,
+                         std::string& reason ) const = 0;
+};
+
+}
+
+#endif
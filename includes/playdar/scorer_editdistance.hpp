@@ -0,0 +1,102 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __EDITDISTANCE_SCORER_H__
+#define __EDITDISTANCE_SCORER_H__
+
+#include "playdar/scorer.h"
+#include "playdar/utils/levenshtein.h"
+
+namespace playdar {
+
+/// string similarity algo that combines art,alb,trk from the original
+/// query against a potential match.
+/// this is mostly just edit-distance, with some extra checks.
+/// TODO albums are ignored atm.
+class EditDistanceScorer : public Scorer
+{
+public:
+    std::string name() const { return "editdistance"; }
+    
+    float score( const ResolverQuery::normalized_track& q,
+                 const std::string& art,
+                 const std::string& trk,
+                 std::string& reason ) const
+    {
+        // original names from the query:
+        const std::string& o_art = q.artist;
+        const std::string& o_trk = q.track;
+
+        // short-circuit for exact match
+        if(o_art == art && o_trk == trk) return 1.0;
+        // tolerances:
+        float tol_art = 1.5;
+        float tol_trk = 1.5;
+        //float tol_alb = 1.5; // album rating unsed atm.
+    
+        // names less than this many chars aren't dismissed based on % edit-dist:
+        unsigned int grace_len = 6; 
+    
+        // anything further than this fails the checks below, so the edit
+        // distances needn't be worked out exactly past it:
+        int max_arted = o_art.length() ? (int) o_art.length() - 1 : 0;
+        if( o_art.length() > grace_len && (int)(o_art.length()/tol_art) < max_arted )
+            max_arted = (int)(o_art.length()/tol_art);
+        int max_trked = o_trk.length() ? (int) o_trk.length() - 1 : 0;
+        if( o_trk.length() > grace_len && (int)(o_trk.length()/tol_trk) < max_trked )
+            max_trked = (int)(o_trk.length()/tol_trk);
+    
+        // the real deal, with edit distances:
+        unsigned int trked = utils::levenshtein( trk, o_trk, max_trked );
+        unsigned int arted = utils::levenshtein( art, o_art, max_arted );
+    
+        // if % edit distance is greater than tolerance, fail them outright:
+        if( o_art.length() > grace_len &&
+           arted > o_art.length()/tol_art )
+        {
+            reason = "artist name tolerance";
+            return 0.0;
+        }
+        if( o_trk.length() > grace_len &&
+           trked > o_trk.length()/tol_trk )
+        {
+            reason = "track name tolerance";
+            return 0.0;
+        }
+        // if edit distance longer than original name, fail them outright:
+        if( arted >= o_art.length() )
+        {
+            reason = "artist name editdist >= length";
+            return 0.0;
+        }
+        if( trked >= o_trk.length() )
+        {
+            reason = "track name editdist >= length";
+            return 0.0;
+        }
+    
+        // combine the edit distance of artist & track into a final score:
+        float artdist_pc = (o_art.length()-arted) / (float) o_art.length();
+        float trkdist_pc = (o_trk.length()-trked) / (float) o_trk.length();
+        return artdist_pc * trkdist_pc;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __TOKEN_SCORER_H__
+#define __TOKEN_SCORER_H__
+
+#include <vector>
+#include <boost/thread/tss.hpp>
+#include "playdar/scorer.h"
+#include "playdar/utils/levenshtein.h"
+#include "playdar/utils/word_weights.hpp"
+
+namespace playdar {
+
+/// compares names word by word, as a weighted overlap (jaccard) of the
+/// query's and the candidate's words, so extra qualifiers cost little:
+/// "title" vs "title (live)", or "artist" vs "artist feat. someone".
+/// words like "live", "remix" or a year, and words after "feat", count for less
+/// (the query's weights come with its normalized_track, see utils::weigh_words).
+/// words of 4+ letters one edit apart count as mostly matching, for typos.
+class TokenScorer : public Scorer
+{
+public:
+    /// names less similar than min_similarity (0-1) fail outright.
+    TokenScorer( float min_similarity = 0.5 )
+        : m_min_similarity( min_similarity )
+    {}
+    
+    std::string name() const { return "token"; }
+    
+    float score( const ResolverQuery::normalized_track& q,
+                 const std::string& art,
+                 const std::string& trk,
+                 std::string& reason ) const
+    {
+        // short-circuit for exact match
+        if(q.artist == art && q.track == trk) return 1.0;
+        
+        scratch * sc = m_scratch.get();
+        if( !sc )
+        {
+            sc = new scratch;
+            m_scratch.reset( sc );
+        }
+        float artsim = similarity( q.artist_tokens, q.artist_weights, 
+                                   q.artist_weight, art, *sc );
+        if( artsim < m_min_similarity )
+        {
+            reason = "artist name tolerance";
+            return 0.0;
+        }
+        float trksim = similarity( q.track_tokens, q.track_weights, 
+                                   q.track_weight, trk, *sc );
+        if( trksim < m_min_similarity )
+        {
+            reason = "track name tolerance";
+            return 0.0;
+        }
+        return artsim * trksim;
+    }
+    
+private:
+    // a word in a candidate name, as an offset and length:
+    struct word
+    {
+        size_t pos, len;
+        bool used;
+    };
+    
+    struct cand_word
+    {
+        const std::string& s; const std::vector<word>& v;
+        cand_word( const std::string& s, const std::vector<word>& v ) : s(s), v(v) {}
+        void operator()( size_t i, const char *& w, size_t& len ) const
+        { w = s.data() + v[i].pos; len = v[i].len; }
+    };
+    
+    // buffers for the candidate's words, kept per scoring thread so
+    // scoring a batch of results doesn't allocate for each one:
+    struct scratch
+    {
+        std::vector<word> cwords;
+        std::vector<float> cweights;
+        std::string cw;
+    };
+    
+    /// weighted jaccard similarity 0-1 of the query words and candidate name.
+    static float similarity( const std::vector<std::string>& qwords, 
+                             const std::vector<float>& qweights,
+                             float qtotal,
+                             const std::string& name,
+                             scratch& sc )
+    {
+        std::vector<word>& cwords = sc.cwords;
+        cwords.clear();
+        for( size_t p = 0; p < name.length(); )
+        {
+            size_t e = name.find( ' ', p );
+            if( e == std::string::npos ) e = name.length();
+            if( e > p )
+            {
+                word w = { p, e - p, false };
+                cwords.push_back( w );
+            }
+            p = e + 1;
+        }
+        float ctotal = utils::weigh_words( cwords.size(), cand_word( name, cwords ), sc.cweights );
+        if( qtotal + ctotal == 0 ) return 1.0f;
+        
+        // each query word matches at most one candidate word:
+        float matched = 0;
+        for( size_t i = 0; i < qwords.size(); ++i )
+        {
+            const std::string& qw = qwords[i];
+            int best = -1;
+            float bestmatch = 0;
+            for( size_t j = 0; j < cwords.size(); ++j )
+            {
+                if( cwords[j].used ) continue;
+                float m = 0;
+                if( cwords[j].len == qw.length() && 
+                    name.compare( cwords[j].pos, cwords[j].len, qw ) == 0 )
+                    m = 1.0f;
+                else if( qw.length() >= 4 && cwords[j].len + 1 >= qw.length() &&
+                         cwords[j].len <= qw.length() + 1 )
+                {
+                    sc.cw.assign( name, cwords[j].pos, cwords[j].len );
+                    if( utils::levenshtein( qw, sc.cw, 1 ) <= 1 ) m = 0.9f;
+                }
+                if( m > bestmatch ) { bestmatch = m; best = j; }
+                if( m == 1.0f ) break;
+            }
+            if( best >= 0 )
+            {
+                cwords[best].used = true;
+                // a match is worth the lesser of the two words' weights:
+                float wt = qweights[i] < sc.cweights[best] ? qweights[i] : sc.cweights[best];
+                matched += bestmatch * wt;
+            }
+        }
+        return matched / ( qtotal + ctotal - matched );
+    }
+    
+    mutable boost::thread_specific_ptr<scratch> m_scratch;
+    float m_min_similarity;
+};
+
+}
+
+#endif
@@ -52,6 +52,8 @@ public:
         , m_url(url)
         , m_thread(0)
         , m_abort(false)
+        , m_range_offset(-1)
+        , m_range_length(-1)
     {
         url = boost::to_lower_copy( m_url );
         std::vector<std::string> parts;
@@ -67,8 +69,11 @@ public:
     CurlStreamingStrategy(const CurlStreamingStrategy& other)
         : m_curl(0)
         , m_url(other.url())
+        , m_protocol(other.m_protocol)
         , m_thread(0)
         , m_abort(false)
+        , m_range_offset(other.m_range_offset)
+        , m_range_length(other.m_range_length)
     {
         reset();
     }
@@ -92,6 +97,14 @@ public:
         m_slist_headers = curl_slist_append(m_slist_headers, header.c_str());
     }
 
+    /// fetched with CURLOPT_RANGE, so a seek only downloads what's needed
+    bool set_range(long long offset, long long length)
+    {
+        m_range_offset = offset;
+        m_range_length = length;
+        return true;
+    }
+
     std::string mime_type()
     {
         if( m_url.size() < 3 )
@@ -112,6 +125,9 @@ public:
     {
         m_abort = false;
         m_firstWriteFunc = true;
+        m_blocked = false;
+        m_paused = false;
+        m_got_content_range = false;
     }
 
     /// curl callback when data from fetching an url has arrived
@@ -132,6 +148,21 @@ public:
             {
                 inst->m_reply->set_mime_type(v[1]);
             }
+            else if( v[0] == "content-range" && inst->m_range_offset >= 0 )
+            {
+                // upstream honoured our range, pass on which bytes these are
+                long long first, last, total = -1;
+                if( sscanf(v[1].c_str(), "bytes %lld-%lld/%lld", &first, &last, &total) >= 2 )
+                {
+                    inst->m_reply->set_content_range(first, last, total);
+                    inst->m_got_content_range = true;
+                }
+                else if( sscanf(v[1].c_str(), "bytes */%lld", &total) == 1 )
+                {
+                    // upstream said 416, pass on how big the file is
+                    inst->m_reply->set_range_not_satisfiable(total);
+                }
+            }
             // content-length is dealt with in curl_writefunc
         } else {
             // status code?
@@ -159,9 +190,18 @@ public:
             // (with file urls we don't get curl_headfunc callbacks)
             double fContentLength;
             if (CURLE_OK == curl_easy_getinfo(inst->m_curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &fContentLength)) {
-                int nContentLength = (int) fContentLength;
+                long long nContentLength = (long long) fContentLength;
                 if (nContentLength >= 0) {
                     inst->m_reply->set_content_length(nContentLength);
+
+                    // file urls have no headers to say the range was honoured, but
+                    // it always is. The total is only known for open ended ranges.
+                    if (inst->m_protocol == "file" && inst->m_range_offset >= 0 && !inst->m_got_content_range) {
+                        inst->m_reply->set_content_range(
+                            inst->m_range_offset,
+                            inst->m_range_offset + nContentLength - 1,
+                            inst->m_range_length < 0 ? inst->m_range_offset + nContentLength : -1);
+                    }
                 }
             }
             // last chance to set mime type
@@ -171,7 +211,20 @@ public:
         }
 
         size_t len = size * nmemb;
-        inst->m_reply->write_content((const char*) vptr, len);
+        boost::mutex::scoped_lock lk(inst->m_mutex);
+        if (inst->m_blocked && inst->m_protocol != "file") {
+            // the client is behind: curl holds on to this data and stops
+            // reading until curl_progressfunc unpauses it
+            inst->m_paused = true;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        // curl can't pause file transfers, so wait for the client here:
+        while (inst->m_blocked && !inst->m_abort)
+            inst->m_cond.wait(lk);
+        if (inst->m_abort)
+            return 0;
+        if (!inst->m_reply->write_content((const char*) vptr, len))
+            inst->m_blocked = true;
         return len;
     }
     
@@ -180,11 +233,24 @@ public:
     {
         CurlStreamingStrategy * inst = ((CurlStreamingStrategy*)clientp);
         //cout << "Curl has downloaded: " << dlnow << " : " << dltotal << endl;
+        {
+            // curl_easy_pause isn't safe from other threads, so we wait
+            // for the client to catch up here, on the curl thread:
+            boost::mutex::scoped_lock lk(inst->m_mutex);
+            while( inst->m_paused && inst->m_blocked && !inst->m_abort )
+                inst->m_cond.wait(lk);
+        }
         if( inst->m_abort )
         {
             std::cout << "Aborting in-progress download." << std::endl;
             return 1; // non-zero aborts download.
         }
+        if( inst->m_paused )
+        {
+            inst->m_paused = false;
+            // delivers the held data to curl_writefunc before returning:
+            curl_easy_pause( inst->m_curl, CURLPAUSE_CONT );
+        }
         return 0;
     }
     
@@ -226,6 +292,8 @@ public:
 		m_reply = aa;
         m_reply->set_finished_cb(
             boost::bind(&CurlStreamingStrategy::write_ending, shared_from_this()));
+        m_reply->set_resume_cb(
+            boost::bind(&CurlStreamingStrategy::write_resume, shared_from_this()));
 
         // do the blocking-fetch in a thread:
         m_thread = new boost::thread( 
@@ -234,13 +302,26 @@ public:
 
 protected:
 
+    // callback from m_reply: the client has caught up.
+    void write_resume()
+    {
+        boost::mutex::scoped_lock lk(m_mutex);
+        m_blocked = false;
+        m_cond.notify_all();
+    }
+
     // callback from m_reply: the connection has finished writing.
     void write_ending()
     {
         // release our shared ptrs
         m_reply->set_finished_cb(0);
+        m_reply->set_resume_cb(0);
         if (m_thread) {
-            m_abort = true;
+            {
+                boost::mutex::scoped_lock lk(m_mutex);
+                m_abort = true;
+                m_cond.notify_all();
+            }
             m_thread->join();
             //delete m_thread;
         }
@@ -260,6 +341,14 @@ protected:
         curl_easy_setopt( handle, CURLOPT_MAXREDIRS, 5 );
         curl_easy_setopt( handle, CURLOPT_USERAGENT, "Playdar (libcurl)" );
         curl_easy_setopt( handle, CURLOPT_HTTPHEADER, m_slist_headers );
+        if( m_range_offset >= 0 )
+        {
+            std::ostringstream r;
+            r << m_range_offset << "-";
+            if( m_range_length >= 0 ) r << m_range_offset + m_range_length - 1;
+            m_range = r.str();
+            curl_easy_setopt( handle, CURLOPT_RANGE, m_range.c_str() );
+        }
         curl_easy_setopt( handle, CURLOPT_WRITEFUNCTION, &CurlStreamingStrategy::curl_writefunc );
         curl_easy_setopt( handle, CURLOPT_WRITEDATA, this );
         curl_easy_setopt( handle, CURLOPT_HEADERFUNCTION, &CurlStreamingStrategy::curl_headfunc );
@@ -294,6 +383,18 @@ protected:
     boost::thread* m_thread;
     bool m_abort;
     bool m_firstWriteFunc;
+
+    // back-pressure from the client, see curl_writefunc:
+    boost::mutex m_mutex;
+    boost::condition m_cond;
+    bool m_blocked;     // m_reply wants us to stop writing
+    bool m_paused;      // curl is holding data for us
+
+    // byte range asked for by set_range, offset -1 for everything:
+    long long m_range_offset;
+    long long m_range_length;
+    std::string m_range;        // as given to CURLOPT_RANGE
+    bool m_got_content_range;   // upstream sent a content-range header
     
     /////
     AsyncAdaptor_ptr m_reply;
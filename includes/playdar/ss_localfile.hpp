@@ -19,69 +19,143 @@
 #ifndef __LOCAL_FILE_STRAT_H__
 #define __LOCAL_FILE_STRAT_H__
 
-#include <fstream>  
 #include <sstream>
-#include <iostream>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <boost/algorithm/string.hpp>
+#include <boost/enable_shared_from_this.hpp>
 
-#include <boost/filesystem.hpp> 
+#include "moost/http/mime_types.hpp"
+#include "playdar/logger.h"
+#include "playdar/streaming_strategy.h"
+#include "playdar/utils/urlencoding.hpp"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 namespace playdar {
 
+/*
+    Streams file:// urls from the local disk.
+
+    Rather than reading the file on a thread and copying it through
+    write_content (as CurlStreamingStrategy does), it opens the file and
+    hands it to the adaptor, and the http server sends it from there on
+    its own threads (with sendfile, where there is one).
+*/
 class LocalFileStreamingStrategy : public StreamingStrategy
 {
 public:
 
-    LocalFileStreamingStrategy(const std::string& p)
-        : m_uri(p)
+    LocalFileStreamingStrategy(const std::string& url)
+        : m_url(url)
+        , m_range_offset(-1)
+        , m_range_length(-1)
     {
-        m_connected=false;
     }
-    
-    ~LocalFileStreamingStrategy()
-    {
-        reset();
-    }
-    
-    size_t read_bytes(char * buf, size_t size)
+
+    /// not shared between replies, so each gets its own range
+    virtual boost::shared_ptr<StreamingStrategy> get_instance()
     {
-        if(!m_connected) do_connect();
-        if(!m_connected) return 0;
-        size_t len = m_is.read(buf, size).gcount();
-        if(len==0) reset();
-        return m_is.gcount();
+        return boost::shared_ptr<StreamingStrategy>(new LocalFileStreamingStrategy(*this));
     }
-    
+
     std::string debug()
     { 
         std::ostringstream s;
-        s << "LocalFileStreamingStrategy(" << m_uri << ")";
+        s << "LocalFileStreamingStrategy(" << m_url << ")";
         return s.str();
     }
 
     void reset()
     {
-        if(m_is.is_open()) m_is.close();
-        m_connected = false;
     }
-    
-private:
 
-    void do_connect()
+    /// just an offset and length for the server to send from, no reading
+    bool set_range(long long offset, long long length)
+    {
+        m_range_offset = offset;
+        m_range_length = length;
+        return true;
+    }
+
+    void start_reply(AsyncAdaptor_ptr aa)
     {
-        reset();
-        //cout << debug() << endl;
-        m_is.open(m_uri.c_str(), std::ios::in | std::ios::binary);
-        if(!m_is.is_open())
+        int fd = open_file();
+        struct stat st;
+        if( fd < 0 || fstat( fd, &st ) != 0 )
         {
-            std::cout << "Failed to open file: " << m_uri << std::endl;
+            log::error() << "Failed to open file: " << m_url << std::endl;
+            if( fd >= 0 ) ::close( fd );
+            aa->set_status_code( 404 );
+            aa->set_content_length( 0 );
+            aa->write_finish();
             return;
         }
-        m_connected = true;
+
+        const long long size = st.st_size;
+        long long offset = 0, length = size;
+        if( m_range_offset >= 0 )
+        {
+            if( m_range_offset >= size )
+            {
+                ::close( fd );
+                aa->set_range_not_satisfiable( size );
+                aa->set_content_length( 0 );
+                aa->write_finish();
+                return;
+            }
+            offset = m_range_offset;
+            length = size - offset;
+            if( m_range_length >= 0 && m_range_length < length )
+                length = m_range_length;
+            aa->set_content_range( offset, offset + length - 1, size );
+        }
+
+        aa->set_content_length( length );
+        aa->set_mime_type( mime_type() );
+        aa->write_file( fd, offset, length );
+    }
+
+private:
+
+    /// the scanner's urls are just file:// and the path, unencoded,
+    /// but try decoding too in case it came from somewhere else.
+    int open_file()
+    {
+        std::string path( m_url );
+        if( boost::istarts_with( path, "file://" ) )
+            path = path.substr( 7 );
+        if( path.size() > 2 && path[0] == '/' && path[2] == ':' )
+            path = path.substr( 1 ); // windows: file:///C:/...
+
+        int fd = ::open( path.c_str(), O_RDONLY | O_BINARY );
+        if( fd < 0 )
+            fd = ::open( playdar::utils::url_decode( path ).c_str(), O_RDONLY | O_BINARY );
+        return fd;
     }
-    
-    std::string m_uri;
-    std::ifstream m_is;
-    bool m_connected;
+
+    std::string mime_type()
+    {
+        size_t dot = m_url.rfind( '.' );
+        if( dot == std::string::npos )
+            return "application/octet-stream";
+        std::string ext = boost::to_lower_copy( m_url.substr( dot + 1 ) );
+        std::string type = moost::http::mime_types::extension_to_type( ext );
+        return type == "text/plain" ? "application/octet-stream" : type;
+    }
+
+    std::string m_url;
+    long long m_range_offset;   // see set_range
+    long long m_range_length;
 };
 
 }
@@ -26,15 +26,28 @@
 namespace playdar {
 
 // StreamingStrategies receive an AsyncAdaptor via start_reply.
+//
+// The adaptor only buffers so much for a slow client: once write_content
+// returns false (or writable() does) the producer should stop writing
+// until the resume callback is called, so memory per stream stays capped.
 
 class AsyncAdaptor
 {
 public:
-    virtual void set_content_length(int contentLength) = 0;
+    virtual void set_content_length(long long contentLength) = 0;
     virtual void set_mime_type(const std::string& mimetype) = 0;
     virtual void set_status_code(int status) = 0;
-    virtual void write_content(const char *buffer, int size) = 0;
+    /// makes it a 206 reply for bytes first..last of total (-1 if unknown)
+    virtual void set_content_range(long long first, long long last, long long total) = 0;
+    /// makes it a 416 reply, for a range that starts past the end of total bytes
+    virtual void set_range_not_satisfiable(long long total) = 0;
+    virtual bool write_content(const char *buffer, int size) = 0;
+    virtual bool writable() = 0;
+    virtual void set_resume_cb(boost::function<void(void)> cb) = 0;
     virtual void write_finish() = 0;
+    /// finish with length bytes of the open file fd from offset, sent
+    /// without copying them through write_content. Takes ownership of fd.
+    virtual void write_file(int fd, long long offset, long long length) = 0;
     virtual void write_cancel() = 0;
     virtual void set_finished_cb(boost::function<void(void)> cb) = 0;
 };
@@ -57,6 +70,11 @@ public:
 
     virtual void set_extra_header(const std::string& header){};
 
+    /// Only send length bytes starting at offset (or to the end if length
+    /// is -1). Call before start_reply; returns false if the strategy can't
+    /// do ranges, in which case it sends everything as usual.
+    virtual bool set_range(long long offset, long long length){ return false; }
+
     /// called when we want to use a SS to stream.
     /// could make a copy if the implementation requires it.
     virtual boost::shared_ptr<StreamingStrategy> get_instance()
@@ -0,0 +1,99 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_EXPIRY_WHEEL_H_
+#define _PLAYDAR_UTILS_EXPIRY_WHEEL_H_
+
+#include <utility>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace playdar { namespace utils {
+
+/*
+    Timer wheel: items are scheduled a number of ticks ahead, and each
+    advance() moves one tick on and hands back the items due on it.
+    Scheduling is O(1) and a tick only touches the items in its slot,
+    unlike a timer per item, which costs a heap insert and an allocation.
+
+    The caller drives the ticks, eg from one repeating deadline_timer.
+    Items further ahead than the number of slots go round the wheel more
+    than once, so size it for the usual wait to keep each tick short.
+*/
+template <typename T>
+class expiry_wheel : boost::noncopyable
+{
+public:
+    explicit expiry_wheel(size_t slots)
+        : m_slots(slots ? slots : 1), m_current(0)
+    {}
+
+    /// item is due on the ahead'th advance() from now, the next one if 0.
+    void schedule(const T& item, size_t ahead)
+    {
+        if(ahead < 1) ahead = 1;
+        boost::mutex::scoped_lock lk(m_mut);
+        const size_t n = m_slots.size();
+        m_slots[ (m_current + ahead % n) % n ].push_back(
+            std::make_pair( (ahead - 1) / n, item ) );
+    }
+
+    /// moves on one tick.
+    /// @return the items due now, in the order they were scheduled.
+    std::vector<T> advance()
+    {
+        std::vector<T> due;
+        boost::mutex::scoped_lock lk(m_mut);
+        m_current = (m_current + 1) % m_slots.size();
+        slot& s = m_slots[m_current];
+        size_t kept = 0;
+        for(size_t i = 0; i < s.size(); i++)
+        {
+            if(s[i].first == 0)
+            {
+                due.push_back(s[i].second);
+            }
+            else // another time round
+            {
+                --s[i].first;
+                s[kept++] = s[i];
+            }
+        }
+        s.resize(kept);
+        return due;
+    }
+
+    /// number of ticks before items go round the wheel more than once.
+    size_t slots() const
+    {
+        return m_slots.size();
+    }
+
+private:
+    /// each entry is the number of turns left, and the item
+    typedef std::vector< std::pair<size_t, T> > slot;
+
+    boost::mutex m_mut;
+    std::vector<slot> m_slots;
+    size_t m_current;
+};
+
+}} // ns
+
+#endif //_PLAYDAR_UTILS_EXPIRY_WHEEL_H_
@@ -25,6 +25,11 @@ namespace playdar { namespace utils {
 
 int levenshtein(const std::string & source, const std::string & target);
 
+/// as above, but gives up once the distance is known to exceed
+/// max_distance, returning max_distance+1. negative means no limit.
+int levenshtein(const std::string & source, const std::string & target,
+                int max_distance);
+
 }}
 
 #endif
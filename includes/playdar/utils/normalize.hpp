@@ -0,0 +1,241 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_NORMALIZE_H_
+#define _PLAYDAR_UTILS_NORMALIZE_H_
+
+#include <string>
+
+/*
+    Normalization of artist/album/track names for matching, shared by
+    the resolver's scoring and the local library / boffin sortnames.
+
+    Names are treated as UTF-8. Letters are lowercased and accents are
+    stripped (Latin, plus lowercasing of Greek and Cyrillic), so "Björk"
+    and "bjork" compare equal. Whitespace runs become a single space and
+    the ends are trimmed. Bytes that aren't valid UTF-8 are kept as-is.
+    Pure-ASCII names take a fast path and come out the same as the old
+    tolower+trim sortnames.
+*/
+namespace playdar { namespace utils {
+
+namespace normalize_detail {
+
+    /// ASCII folding for a Latin-1 Supplement / Latin Extended-A code
+    /// point (U+00C0..U+017F), 0 if it's left alone.
+    inline const char * latin_fold( unsigned int cp )
+    {
+        static const char * table[0x180 - 0xC0] = {
+            "a", "a", "a", "a", "a", "a", "ae", "c", // U+00C0
+            "e", "e", "e", "e", "i", "i", "i", "i", // U+00C8
+            "d", "n", "o", "o", "o", "o", "o", 0 , // U+00D0
+            "o", "u", "u", "u", "u", "y", "th", "ss", // U+00D8
+            "a", "a", "a", "a", "a", "a", "ae", "c", // U+00E0
+            "e", "e", "e", "e", "i", "i", "i", "i", // U+00E8
+            "d", "n", "o", "o", "o", "o", "o", 0 , // U+00F0
+            "o", "u", "u", "u", "u", "y", "th", "y", // U+00F8
+            "a", "a", "a", "a", "a", "a", "c", "c", // U+0100
+            "c", "c", "c", "c", "c", "c", "d", "d", // U+0108
+            "d", "d", "e", "e", "e", "e", "e", "e", // U+0110
+            "e", "e", "e", "e", "g", "g", "g", "g", // U+0118
+            "g", "g", "g", "g", "h", "h", "h", "h", // U+0120
+            "i", "i", "i", "i", "i", "i", "i", "i", // U+0128
+            "i", "i", "ij", "ij", "j", "j", "k", "k", // U+0130
+            "k", "l", "l", "l", "l", "l", "l", "l", // U+0138
+            "l", "l", "l", "n", "n", "n", "n", "n", // U+0140
+            "n", "n", "n", "n", "o", "o", "o", "o", // U+0148
+            "o", "o", "oe", "oe", "r", "r", "r", "r", // U+0150
+            "r", "r", "s", "s", "s", "s", "s", "s", // U+0158
+            "s", "s", "t", "t", "t", "t", "t", "t", // U+0160
+            "u", "u", "u", "u", "u", "u", "u", "u", // U+0168
+            "u", "u", "u", "u", "w", "w", "y", "y", // U+0170
+            "y", "z", "z", "z", "z", "z", "z", "s", // U+0178
+        };
+        return cp >= 0xC0 && cp < 0x180 ? table[cp - 0xC0] : 0;
+    }
+
+    /// flags a byte that isn't valid UTF-8, see next_codepoint.
+    const unsigned int raw_byte = 0x80000000;
+
+    /// decodes the code point at s[i] and moves i past it. a byte that
+    /// doesn't start valid UTF-8 comes back as itself, or'd with raw_byte.
+    inline unsigned int next_codepoint( const std::string& s, size_t& i )
+    {
+        const unsigned char c = s[i];
+        const int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+        if( c < 0x80 )
+        {
+            ++i;
+            return c;
+        }
+        if( c < 0xC2 || c > 0xF4 || i + extra >= s.length() )
+        {
+            ++i;
+            return raw_byte | c;
+        }
+        unsigned int cp = c & (0x3F >> extra);
+        for( int k = 1; k <= extra; ++k )
+        {
+            const unsigned char cc = s[i+k];
+            if( (cc & 0xC0) != 0x80 ) { ++i; return raw_byte | c; }
+            cp = (cp << 6) | (cc & 0x3F);
+        }
+        i += extra + 1;
+        return cp;
+    }
+
+    inline void append_utf8( std::string& out, unsigned int cp )
+    {
+        if( cp < 0x80 )
+            out += (char) cp;
+        else if( cp < 0x800 )
+        {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else if( cp < 0x10000 )
+        {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            out += (char)(0xF0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    inline bool is_space( unsigned int cp )
+    {
+        return (cp > 0 && cp <= ' ') || cp == 0xA0 || (cp >= 0x2000 && cp <= 0x200A) || cp == 0x3000;
+    }
+    
+    /// adds folded cp to out, collapsing whitespace. 
+    /// a pending space is only written once something follows it.
+    inline void append_folded( std::string& out, unsigned int cp, bool& space )
+    {
+        if( is_space( cp ) )
+        {
+            space = !out.empty();
+            return;
+        }
+        if( cp >= 0x300 && cp < 0x370 ) return; // combining accents
+        if( space ) { out += ' '; space = false; }
+        
+        if( cp & raw_byte )
+        {
+            out += (char)(cp & 0xFF);
+            return;
+        }        
+        if( cp < 0x80 )
+        {
+            out += (cp >= 'A' && cp <= 'Z') ? (char)(cp + 32) : (char) cp;
+            return;
+        }
+        if( const char * f = latin_fold( cp ) )
+        {
+            out += f;
+            return;
+        }
+        if( cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2 ) cp += 0x20;       // Greek capitals
+        else if( cp >= 0x410 && cp <= 0x42F ) cp += 0x20;                // Cyrillic capitals
+        else if( cp >= 0x400 && cp <= 0x40F ) cp += 0x50;
+        if( cp == 0x451 ) cp = 0x435;                                    // ё -> е
+        else if( cp == 0x2018 || cp == 0x2019 ) cp = '\'';               // curly quotes
+        else if( cp == 0x201C || cp == 0x201D ) cp = '"';
+        else if( cp >= 0x2010 && cp <= 0x2015 ) cp = '-';                // dashes
+        append_utf8( out, cp );
+    }
+}
+
+/// the sortname of a name, written into out (reusing its buffer).
+inline void sortname_into( const std::string& name, std::string& out )
+{
+    using namespace normalize_detail;
+    out.clear();
+    bool space = false;
+    size_t i = 0;
+    // fast path while it's ASCII:
+    for( ; i < name.length(); ++i )
+    {
+        const unsigned char c = name[i];
+        if( c >= 0x80 ) break;
+        if( c > 0 && c <= ' ' )
+            space = !out.empty();
+        else
+        {
+            if( space ) { out += ' '; space = false; }
+            out += (c >= 'A' && c <= 'Z') ? (char)(c + 32) : (char) c;
+        }
+    }
+    while( i < name.length() )
+        append_folded( out, next_codepoint( name, i ), space );
+}
+
+/// lowercased, accent-stripped, whitespace-collapsed and trimmed.
+/// this is what the library stores as artist/album/track sortname.
+inline std::string sortname( const std::string& name )
+{
+    std::string out;
+    out.reserve( name.length() );
+    sortname_into( name, out );
+    return out;
+}
+
+/// the sortname, also ignoring ASCII punctuation and a leading "the ",
+/// so "The Guns N' Roses" and "guns n roses" match. for comparing
+/// names, not for storing.
+inline void match_name_into( const std::string& name, std::string& out )
+{
+    sortname_into( name, out );
+    std::string::iterator w = out.begin();
+    bool space = false;
+    for( std::string::const_iterator r = out.begin(); r != out.end(); ++r )
+    {
+        const unsigned char c = *r;
+        if( c == ' ' )
+            space = w != out.begin();
+        else if( c < 0x80 && !(c >= 'a' && c <= 'z') && !(c >= '0' && c <= '9') && c != '&' )
+            continue; // punctuation
+        else
+        {
+            if( space ) { *w++ = ' '; space = false; }
+            *w++ = c;
+        }
+    }
+    out.erase( w, out.end() );
+    if( out.length() > 4 && out.compare( 0, 4, "the " ) == 0 )
+        out.erase( 0, 4 );
+    if( out.empty() ) // all punctuation, eg: "!!!"
+        sortname_into( name, out );
+}
+
+inline std::string match_name( const std::string& name )
+{
+    std::string out;
+    out.reserve( name.length() );
+    match_name_into( name, out );
+    return out;
+}
+
+}}
+
+#endif //_PLAYDAR_UTILS_NORMALIZE_H_
@@ -0,0 +1,130 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_SHARDED_MAP_H_
+#define _PLAYDAR_UTILS_SHARDED_MAP_H_
+
+#include <map>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+namespace playdar { namespace utils {
+
+/*
+    Thread-safe map split into a number of shards by key hash, each with
+    its own reader/writer lock. Threads working on different keys rarely
+    contend, and lookups on the same shard can run concurrently.
+
+    Values are returned by copy, so V should be cheap to copy (shared_ptr).
+    Lookups of missing keys return a default-constructed V.
+*/
+template <typename K, typename V>
+class sharded_map : boost::noncopyable
+{
+public:
+    explicit sharded_map(size_t nshards = 16)
+        : m_nshards(nshards ? nshards : 1),
+          m_shards(new shard[m_nshards])
+    {}
+
+    V get(const K& k) const
+    {
+        const shard& s = shard_for(k);
+        boost::shared_lock<boost::shared_mutex> lk(s.mut);
+        typename std::map<K,V>::const_iterator it = s.map.find(k);
+        return it == s.map.end() ? V() : it->second;
+    }
+
+    bool exists(const K& k) const
+    {
+        const shard& s = shard_for(k);
+        boost::shared_lock<boost::shared_mutex> lk(s.mut);
+        return s.map.find(k) != s.map.end();
+    }
+
+    /// adds k->v unless k is already present.
+    /// @return true if inserted, false if k already existed.
+    bool insert(const K& k, const V& v)
+    {
+        shard& s = shard_for(k);
+        boost::unique_lock<boost::shared_mutex> lk(s.mut);
+        return s.map.insert(std::make_pair(k, v)).second;
+    }
+
+    /// adds or replaces k->v
+    void set(const K& k, const V& v)
+    {
+        shard& s = shard_for(k);
+        boost::unique_lock<boost::shared_mutex> lk(s.mut);
+        s.map[k] = v;
+    }
+
+    /// removes k, returning the value it had (or V() if absent).
+    /// only one of several concurrent callers gets the value.
+    V take(const K& k)
+    {
+        shard& s = shard_for(k);
+        boost::unique_lock<boost::shared_mutex> lk(s.mut);
+        typename std::map<K,V>::iterator it = s.map.find(k);
+        if(it == s.map.end()) return V();
+        V v = it->second;
+        s.map.erase(it);
+        return v;
+    }
+
+    bool erase(const K& k)
+    {
+        shard& s = shard_for(k);
+        boost::unique_lock<boost::shared_mutex> lk(s.mut);
+        return s.map.erase(k) > 0;
+    }
+
+    /// not a snapshot: shards are counted one at a time.
+    size_t size() const
+    {
+        size_t n = 0;
+        for(size_t i = 0; i < m_nshards; i++)
+        {
+            boost::shared_lock<boost::shared_mutex> lk(m_shards[i].mut);
+            n += m_shards[i].map.size();
+        }
+        return n;
+    }
+
+private:
+    struct shard
+    {
+        mutable boost::shared_mutex mut;
+        std::map<K,V> map;
+    };
+
+    shard& shard_for(const K& k) const
+    {
+        return m_shards[ boost::hash<K>()(k) % m_nshards ];
+    }
+
+    size_t m_nshards;
+    boost::scoped_array<shard> m_shards;
+};
+
+}} // ns
+
+#endif //_PLAYDAR_UTILS_SHARDED_MAP_H_
@@ -0,0 +1,141 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_STATEMENT_CACHE_H_
+#define _PLAYDAR_UTILS_STATEMENT_CACHE_H_
+
+#include <map>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "sqlite3pp.h"
+
+namespace playdar { namespace utils {
+
+/*
+    Keeps compiled statements for one sqlite connection, keyed by their
+    SQL text, so hot queries are parsed once instead of on every call.
+
+    A statement is checked out for as long as a statement_cache::query
+    or ::command is in scope, and reset and handed back when it goes,
+    so nested or concurrent uses of the same SQL each get their own.
+    Bind every parameter each time: bindings aren't cleared in between.
+
+        utils::statement_cache::query qry(cache, "SELECT name FROM artist WHERE id = ?");
+        qry->bind(1, id);
+        for(sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) ...
+*/
+class statement_cache : boost::noncopyable
+{
+public:
+    /// keeps at most capacity idle statements, extra ones are finalized.
+    explicit statement_cache( sqlite3pp::database& db, size_t capacity = 64 )
+        : m_db( db ), m_capacity( capacity )
+    {}
+
+    sqlite3pp::database& db() { return m_db; }
+
+    template <class Stmt>
+    class scoped : boost::noncopyable
+    {
+    public:
+        scoped( statement_cache& sc, const std::string& sql )
+            : m_sc( sc ), m_sql( sql ), m_stmt( sc.checkout<Stmt>( m_sql ) )
+        {}
+
+        ~scoped()
+        {
+            m_sc.checkin( m_sql, m_stmt );
+        }
+
+        Stmt& operator*() const { return *m_stmt; }
+        Stmt* operator->() const { return m_stmt.get(); }
+
+    private:
+        statement_cache& m_sc;
+        std::string m_sql;
+        boost::shared_ptr<Stmt> m_stmt;
+    };
+
+    typedef scoped<sqlite3pp::query> query;
+    typedef scoped<sqlite3pp::command> command;
+
+    /// number of idle statements held.
+    size_t size()
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        return m_queries.size() + m_commands.size();
+    }
+
+    /// finalizes all idle statements.
+    void clear()
+    {
+        boost::mutex::scoped_lock lk( m_mut );
+        m_queries.clear();
+        m_commands.clear();
+    }
+
+private:
+    template <class Stmt> struct idle
+    {
+        typedef std::multimap< std::string, boost::shared_ptr<Stmt> > type;
+    };
+
+    idle<sqlite3pp::query>::type& idle_for( sqlite3pp::query* ) { return m_queries; }
+    idle<sqlite3pp::command>::type& idle_for( sqlite3pp::command* ) { return m_commands; }
+
+    template <class Stmt>
+    boost::shared_ptr<Stmt> checkout( const std::string& sql )
+    {
+        {
+            boost::mutex::scoped_lock lk( m_mut );
+            typename idle<Stmt>::type& m = idle_for( (Stmt*)0 );
+            typename idle<Stmt>::type::iterator it = m.find( sql );
+            if( it != m.end() )
+            {
+                boost::shared_ptr<Stmt> p( it->second );
+                m.erase( it );
+                return p;
+            }
+        }
+        // prepare outside the lock, throws database_error on bad sql:
+        return boost::shared_ptr<Stmt>( new Stmt( m_db, sql.c_str() ) );
+    }
+
+    template <class Stmt>
+    void checkin( const std::string& sql, const boost::shared_ptr<Stmt>& p )
+    {
+        // an unfinished statement holds its read transaction open:
+        p->reset();
+        boost::mutex::scoped_lock lk( m_mut );
+        if( m_queries.size() + m_commands.size() >= m_capacity ) return;
+        idle_for( (Stmt*)0 ).insert( std::make_pair( sql, p ) );
+    }
+
+    sqlite3pp::database& m_db;
+    size_t m_capacity;
+    boost::mutex m_mut;
+    idle<sqlite3pp::query>::type m_queries;
+    idle<sqlite3pp::command>::type m_commands;
+};
+
+}} // namespaces
+
+#endif
@@ -0,0 +1,95 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_WORD_WEIGHTS_H_
+#define _PLAYDAR_UTILS_WORD_WEIGHTS_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+    How much each word of a normalized name counts when names are compared
+    word by word (see TokenScorer): words like "live", "remix" or a year,
+    and words after "feat", count for less than the rest.
+*/
+namespace playdar { namespace utils {
+
+inline bool is_qualifier_word( const char * w, size_t len )
+{
+    static const char * qualifiers[] = {
+        "acoustic", "demo", "edit", "explicit", "extended", "feat", 
+        "featuring", "ft", "instrumental", "live", "mix", "mono", 
+        "original", "radio", "remaster", "remastered", "remix", 
+        "stereo", "version", "vs", 0 };
+    for( const char ** q = qualifiers; *q; ++q )
+        if( std::strlen( *q ) == len && std::strncmp( *q, w, len ) == 0 ) 
+            return true;
+    return false;
+}
+
+/// as in "remastered 2009"
+inline bool is_year_word( const char * w, size_t len )
+{
+    if( len != 4 || !( std::strncmp( w, "19", 2 ) == 0 || std::strncmp( w, "20", 2 ) == 0 ) )
+        return false;
+    return w[2] >= '0' && w[2] <= '9' && w[3] >= '0' && w[3] <= '9';
+}
+
+inline bool is_featuring_word( const char * w, size_t len )
+{
+    return ( len == 2 && std::strncmp( w, "ft", 2 ) == 0 ) ||
+           ( len == 4 && std::strncmp( w, "feat", 4 ) == 0 ) ||
+           ( len == 9 && std::strncmp( w, "featuring", 9 ) == 0 ) ||
+           ( len == 2 && std::strncmp( w, "vs", 2 ) == 0 );
+}
+
+/// weights the n words of a name, in order, into weights.
+/// get(i, w, len) gives the i'th word. @return the total weight.
+template< typename GetWord >
+float weigh_words( size_t n, GetWord get, std::vector<float>& weights )
+{
+    float total = 0;
+    bool featuring = false;
+    weights.resize( n );
+    for( size_t i = 0; i < n; ++i )
+    {
+        const char * w; size_t len;
+        get( i, w, len );
+        float wt = 1.0f;
+        if( is_qualifier_word( w, len ) || is_year_word( w, len ) ) wt = 0.2f;
+        else if( featuring ) wt = 0.3f;
+        if( is_featuring_word( w, len ) ) featuring = true;
+        weights[i] = wt;
+        total += wt;
+    }
+    return total;
+}
+
+/// GetWord for weigh_words over a vector of words.
+struct string_words
+{
+    const std::vector<std::string>& v;
+    string_words( const std::vector<std::string>& v ) : v(v) {}
+    void operator()( size_t i, const char *& w, size_t& len ) const
+    { w = v[i].data(); len = v[i].length(); }
+};
+
+}}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _PLAYDAR_UTILS_WORKER_POOL_H_
+#define _PLAYDAR_UTILS_WORKER_POOL_H_
+
+#include <deque>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace playdar { namespace utils {
+
+/*
+    A queue of work items and a number of threads that take them off it,
+    oldest first, and pass each to the work function. While one item is
+    being worked on for a long time (eg a resolver blocking on the
+    network), the other threads carry on with the rest of the queue.
+
+    The work function should catch its own exceptions: one escaping it
+    ends the program, as with any boost::thread.
+*/
+template <typename T>
+class worker_pool : boost::noncopyable
+{
+public:
+    worker_pool()
+        : m_stopping(false)
+    {}
+
+    ~worker_pool()
+    {
+        stop();
+    }
+
+    /// starts nthreads (at least one) threads calling work for each item.
+    void start(size_t nthreads, boost::function<void (const T&)> work)
+    {
+        m_work = work;
+        if(nthreads < 1) nthreads = 1;
+        for(size_t i = 0; i < nthreads; i++)
+        {
+            m_threads.create_thread(
+                boost::bind(&worker_pool<T>::runner, this));
+        }
+    }
+
+    /// queues item, to be worked on by the next free thread.
+    void post(const T& item)
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        m_pending.push_front(item);
+        m_cond.notify_one();
+    }
+
+    /// number of items waiting for a thread.
+    size_t pending() const
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        return m_pending.size();
+    }
+
+    /// drops the items still waiting, and waits for the threads to finish
+    /// the ones they are working on.
+    void stop()
+    {
+        {
+            boost::mutex::scoped_lock lk(m_mut);
+            if(m_stopping) return;
+            m_stopping = true;
+            m_pending.clear();
+        }
+        m_cond.notify_all();
+        m_threads.join_all();
+    }
+
+private:
+    void runner()
+    {
+        while(true)
+        {
+            T item;
+            {
+                boost::mutex::scoped_lock lk(m_mut);
+                while(m_pending.empty() && !m_stopping) m_cond.wait(lk);
+                if(m_stopping) return;
+                item = m_pending.back();
+                m_pending.pop_back();
+            }
+            m_work(item);
+        }
+    }
+
+    boost::function<void (const T&)> m_work;
+    std::deque<T> m_pending;
+    mutable boost::mutex m_mut;
+    boost::condition m_cond;
+    bool m_stopping;
+    boost::thread_group m_threads;
+};
+
+}} // ns
+
+#endif //_PLAYDAR_UTILS_WORKER_POOL_H_
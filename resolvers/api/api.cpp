@@ -156,7 +156,21 @@ api::authed_http_handler(const playdar_request& req, playdar_response& resp, pla
             }
             Object r;
             Array qresults;
-            vector< ri_ptr > results = m_pap->get_results(req.getvar("qid"));
+            // with "since", only results added after that version are sent,
+            // in the order they were found. pass back "version" next poll.
+            vector< ri_ptr > results;
+            size_t version;
+            if(req.getvar_exists("since"))
+            {
+                results = m_pap->get_results_since(req.getvar("qid"), 
+                                                   atoi(req.getvar("since").c_str()),
+                                                   version);
+            }
+            else
+            {
+                results = m_pap->get_results(req.getvar("qid"));
+                version = results.size();
+            }
             BOOST_FOREACH(ri_ptr rip, results)
             {
                 qresults.push_back( rip->get_json());
@@ -164,6 +178,7 @@ api::authed_http_handler(const playdar_request& req, playdar_response& resp, pla
             r.push_back( Pair("qid", req.getvar("qid")) );
             r.push_back( Pair("refresh_interval", 1000) ); //TODO something better?
             r.push_back( Pair("query", m_pap->rq(req.getvar("qid"))->get_json()) );
+            r.push_back( Pair("version", (boost::int64_t) version) );
             r.push_back( Pair("results", qresults) );
             
             write_formatted( r, response );
@@ -21,11 +21,13 @@
 #include <string>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include "playdar/utils/normalize.hpp"
 
 using namespace std;
 
 BoffinDb::BoffinDb(const std::string& boffinDbFilePath, const std::string& playdarDbFilePath)
 : m_db( boffinDbFilePath.c_str() )
+, m_stmts( m_db )
 {
     // confirm DB is correct version, or create schema if first run
     check_db();
@@ -121,9 +123,9 @@ BoffinDb::get_tag_cloud(int limit /* = 0 */)
 boost::tuple<int, int>
 BoffinDb::summary()
 {
-    sqlite3pp::query qry(m_db, "SELECT count(duration), sum(duration) FROM pd.file");
-    sqlite3pp::query::iterator i = qry.begin();
-    if (i != qry.end()) {
+    playdar::utils::statement_cache::query qry(m_stmts, "SELECT count(duration), sum(duration) FROM pd.file");
+    sqlite3pp::query::iterator i = qry->begin();
+    if (i != qry->end()) {
         return i->get_columns<int, int>(0, 1);
     }
     return boost::tuple<int, int>(-1, -1);
@@ -174,16 +176,18 @@ BoffinDb::get_tag_id(const std::string& tag, BoffinDb::CreateFlag create /* = Bo
 {
     std::string tag_sortname(sortname(tag));
 
-    sqlite3pp::query qry(m_db, "SELECT rowid FROM tag WHERE name = ?");
-    qry.bind(1, tag_sortname.data());
-    sqlite3pp::query::iterator it = qry.begin();
-    if (it != qry.end())
-        return it->get<int>(0);
+    {
+        playdar::utils::statement_cache::query qry(m_stmts, "SELECT rowid FROM tag WHERE name = ?");
+        qry->bind(1, tag_sortname.data());
+        sqlite3pp::query::iterator it = qry->begin();
+        if (it != qry->end())
+            return it->get<int>(0);
+    }
 
     if (create == BoffinDb::Create) {
-        sqlite3pp::command cmd(m_db, "INSERT INTO tag (name) VALUES (?)");
-        cmd.bind(1, tag_sortname.data());
-        int result = cmd.execute();
+        playdar::utils::statement_cache::command cmd(m_stmts, "INSERT INTO tag (name) VALUES (?)");
+        cmd->bind(1, tag_sortname.data());
+        int result = cmd->execute();
         if (SQLITE_OK == result)
             return (int) m_db.last_insert_rowid();
     }
@@ -198,10 +202,10 @@ BoffinDb::get_artist_id(const std::string& artist)
     std::string artist_sortname(sortname(artist));
 
     {
-        sqlite3pp::query qry(m_db, "SELECT id FROM pd.artist WHERE sortname = ?");
-        qry.bind(1, artist_sortname.data());
-        sqlite3pp::query::iterator it = qry.begin();
-        if (it != qry.end()) {
+        playdar::utils::statement_cache::query qry(m_stmts, "SELECT id FROM pd.artist WHERE sortname = ?");
+        qry->bind(1, artist_sortname.data());
+        sqlite3pp::query::iterator it = qry->begin();
+        if (it != qry->end()) {
             return it->get<int>(0);
         }
     }
@@ -209,11 +213,9 @@ BoffinDb::get_artist_id(const std::string& artist)
     return 0;
 }
 
+// must match Library::sortname, as we look up the library's artist table.
 string
 BoffinDb::sortname(const string& name)
 {
-    string data(name);
-    std::transform(data.begin(), data.end(), data.begin(), ::tolower);
-    boost::trim(data);
-    return data;
+    return playdar::utils::sortname(name);
 }
@@ -26,6 +26,7 @@
 #include <boost/foreach.hpp>
 
 #include "sqlite3pp.h"
+#include "playdar/utils/statement_cache.hpp"
 #include <iostream>
 
 class BoffinDb
@@ -76,11 +77,11 @@ public:
             std::vector<Tag> tags;
             while (getResultLine( fileId, tags )) {
                 BOOST_FOREACH(Tag& tag, tags) {
-                    sqlite3pp::command cmd( m_db, "INSERT INTO track_tag (rowid, track, tag, weight) VALUES (null, ?, ?, ?)" );
-                    cmd.bind(1, fileId);
-                    cmd.bind(2, get_tag_id( tag.first ));
-                    cmd.bind(3, tag.second);
-                    cmd.execute();
+                    playdar::utils::statement_cache::command cmd( m_stmts, "INSERT INTO track_tag (rowid, track, tag, weight) VALUES (null, ?, ?, ?)" );
+                    cmd->bind(1, fileId);
+                    cmd->bind(2, get_tag_id( tag.first ));
+                    cmd->bind(3, tag.second);
+                    cmd->execute();
                 }
                 tags.clear();
             }
@@ -94,14 +95,14 @@ public:
     {
         int tagId = get_tag_id(tag, NoCreate);
         if (tagId > 0) {
-            sqlite3pp::query qry( m_db,
+            playdar::utils::statement_cache::query qry( m_stmts,
                 "SELECT pd.file_join.file, artist, track_tag.weight FROM pd.file_join "
                 "INNER JOIN track_tag ON pd.file_join.track = track_tag.track "
                 "WHERE tag = ? AND weight > ?");
             
-            qry.bind(1, tagId);
-            qry.bind(2, minWeight);
-            for(sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+            qry->bind(1, tagId);
+            qry->bind(2, minWeight);
+            for(sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
                 onFile( i->get<int>(0), i->get<int>(1), i->get<float>(2) );
             }
         }
@@ -112,12 +113,13 @@ public:
     int files_by_artist(const std::string& artist, Functor onFile)
     {
         int count = 0;
-        sqlite3pp::query qry( m_db,
+        const std::string artist_sortname( sortname(artist) );
+        playdar::utils::statement_cache::query qry( m_stmts,
             "SELECT file, artist FROM pd.file_join "
             "INNER JOIN pd.artist ON pd.file_join.artist = pd.artist.id "
             "WHERE pd.artist.sortname = ?");
-        qry.bind(1, sortname(artist).data());
-        for(sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i, count++) {
+        qry->bind(1, artist_sortname.data());
+        for(sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i, count++) {
             onFile( i->get<int>(0), i->get<int>(1) );
         }
         return count;
@@ -128,11 +130,11 @@ public:
     int files_by_artist(int artistId, Functor onFile)
     {
         int count = 0;
-        sqlite3pp::query qry( m_db,
+        playdar::utils::statement_cache::query qry( m_stmts,
             "SELECT file, artist FROM pd.file_join "
             "WHERE artist = ?");
-        qry.bind(1, artistId);
-        for(sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i, count++) {
+        qry->bind(1, artistId);
+        for(sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i, count++) {
             onFile( i->get<int>(0), i->get<int>(1) );
         }
         return count;
@@ -145,10 +147,17 @@ public:
         return m_db;
     }
 
+    // compiled statements on db()
+    playdar::utils::statement_cache& stmts()
+    {
+        return m_stmts;
+    }
+
 private:
     void check_db();
     void create_db_schema();
     sqlite3pp::database m_db;
+    playdar::utils::statement_cache m_stmts;
 };
 
 #endif
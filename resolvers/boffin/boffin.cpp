@@ -259,7 +259,7 @@ boffin::resolve(boost::shared_ptr<ResolverQuery> rq)
             BOOST_FOREACH(const TrackResult& t, *rqlResults) {
                 json_spirit::Object js;
                 js.reserve(13);
-                playdar::ResolvedItemBuilder::createFromFid( m_db->db(), t.trackId, js );
+                playdar::ResolvedItemBuilder::createFromFid( m_db->stmts(), t.trackId, js );
                 js.push_back( json_spirit::Pair( "sid", m_pap->gen_uuid()) );
                 js.push_back( json_spirit::Pair( "source", hostname) );
                 js.push_back( json_spirit::Pair( "weight", t.weight) );
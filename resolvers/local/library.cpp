@@ -21,12 +21,16 @@
 #include <iostream>
 #include <cstdio>
 #include <sstream>
+#include <ctime>
+#include <algorithm>
 
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
 
 #include "library_sql.h"
+#include "ngram_index.hpp"
 #include "playdar/logger.h"
+#include "playdar/utils/normalize.hpp"
 
 using namespace std;
 
@@ -34,17 +38,48 @@ namespace playdar {
 
 
 Library::Library(const string& dbfilepath)
- : m_db( dbfilepath.c_str() )
+ : m_db( dbfilepath.c_str() ), m_stmts( m_db )
 {
     m_dbfilepath = dbfilepath;
     // confirm DB is correct version, or create schema if first run
     check_db();
+    // WAL lets the readers carry on while the scanner/indexer writes.
+    // a no-op (stays "delete") on sqlite older than 3.7.0:
+    m_db.execute("PRAGMA journal_mode=WAL");
+    m_db.set_busy_timeout(5000);
     log::info() << "library DB opened ok" << endl;
 }
 
 Library::~Library()
 {
     log::info() << "DTOR library" << endl;
+    BOOST_FOREACH( connection* c, m_readers )
+    {
+        delete c;
+    }
+}
+
+Library::reader::reader( Library& lib )
+    : m_lib( lib ), m_conn( 0 )
+{
+    {
+        boost::mutex::scoped_lock lock(m_lib.m_mut_readers);
+        if( !m_lib.m_readers.empty() )
+        {
+            m_conn = m_lib.m_readers.back();
+            m_lib.m_readers.pop_back();
+            return;
+        }
+    }
+    m_conn = new connection( m_lib.m_dbfilepath );
+    m_conn->db.execute("PRAGMA query_only=1"); // ignored by sqlite < 3.8.0
+    m_conn->db.set_busy_timeout(5000);
+}
+
+Library::reader::~reader()
+{
+    boost::mutex::scoped_lock lock(m_lib.m_mut_readers);
+    m_lib.m_readers.push_back( m_conn );
 }
 
 void
@@ -87,6 +122,64 @@ Library::check_db()
     
 }
 
+/// sortnames and the ngram index depend on how names are normalized.
+/// false if the db was made with an older version of that.
+bool
+Library::sortnames_current()
+{
+    return db_get_one(string("SELECT value FROM playdar_system WHERE key = 'sortname_version'"), 0) 
+        == sortname_version;
+}
+
+/// redoes sortnames and the ngram index if they're not current.
+/// run by the scanner, it takes a while on a big library.
+void
+Library::update_sortnames()
+{
+    if( sortnames_current() ) return;
+    log::info() << "Name normalization changed, updating sortnames..." << endl;
+    const char * tables[] = { "artist", "album", "track" };
+    {
+        boost::mutex::scoped_lock lock(m_mut);
+        sqlite3pp::transaction xct(m_db);
+        BOOST_FOREACH( const char * table, tables )
+        {
+            vector< pair<int, string> > names;
+            sqlite3pp::query qry(m_db, (string("SELECT id, name FROM ") + table).c_str());
+            for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+                names.push_back( make_pair( (*i).get<int>(0), string((*i).get<const char *>(1)) ) );
+            }
+            // names that now clash with another keep their old sortname:
+            sqlite3pp::command cmd(m_db, (string("UPDATE OR IGNORE ") + table + " SET sortname = ? WHERE id = ?").c_str());
+            int kept = 0;
+            for(size_t i = 0; i < names.size(); ++i)
+            {
+                string sn = sortname(names[i].second);
+                cmd.bind(1, sn.c_str(), true);
+                cmd.bind(2, names[i].first);
+                cmd.execute();
+                if( m_db.changes() == 0 ) ++kept;
+                cmd.reset();
+            }
+            if( kept )
+            {
+                log::warning() << kept << "of" << names.size() << table 
+                               << "names kept their old sortname, the new one"
+                                  " clashes with another's" << endl;
+            }
+        }
+        sqlite3pp::command cmd(m_db, "INSERT OR REPLACE INTO playdar_system(key, value) VALUES('sortname_version', ?)");
+        cmd.bind(1, sortname_version);
+        cmd.execute();
+        xct.commit();
+    }
+    BOOST_FOREACH( const char * table, tables )
+    {
+        build_index(table);
+    }
+    set_last_modified(time(0));
+}
+
 void
 Library::create_db_schema()
 {
@@ -104,26 +197,30 @@ Library::create_db_schema()
     }
     log::info() << "Schema created, reopening." << endl;
     m_db.connect( m_dbfilepath.c_str() ); // this will close/flush and reopen
+    // nothing stored yet, so nothing made the old way:
+    sqlite3pp::command cmd(m_db, "INSERT OR REPLACE INTO playdar_system(key, value) VALUES('sortname_version', ?)");
+    cmd.bind(1, sortname_version);
+    cmd.execute();
 }
 
 bool
 Library::remove_file( const string& url )
 {
     boost::mutex::scoped_lock lock(m_mut);
-    sqlite3pp::query qry(m_db, "SELECT id FROM file WHERE url = ?");
-    qry.bind(1, url.c_str(), true);
+    utils::statement_cache::query qry(m_stmts, "SELECT id FROM file WHERE url = ?");
+    qry->bind(1, url.c_str(), true);
     int fileid = 0;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         fileid = (*i).get<int>(0);
         break; // should only be one row
     }
     if(fileid==0) return false;
-    sqlite3pp::command cmd1(m_db, "DELETE FROM file_join WHERE file = ?");
-    sqlite3pp::command cmd2(m_db, "DELETE FROM file WHERE id = ?");
-    cmd1.bind(1, fileid);
-    cmd2.bind(1, fileid);
-    cmd1.execute();
-    cmd2.execute();
+    utils::statement_cache::command cmd1(m_stmts, "DELETE FROM file_join WHERE file = ?");
+    utils::statement_cache::command cmd2(m_stmts, "DELETE FROM file WHERE id = ?");
+    cmd1->bind(1, fileid);
+    cmd2->bind(1, fileid);
+    cmd1->execute();
+    cmd2->execute();
     return true;
 }
 
@@ -132,10 +229,10 @@ Library::add_dir( const string& url, int mtime)
 {
     boost::mutex::scoped_lock lock(m_mut);
     remove_file( url );
-    sqlite3pp::command cmd(m_db, "INSERT INTO file(url, size, mtime) VALUES (?, 0, ?)");
-    cmd.bind(1, url.c_str(), true);
-    cmd.bind(2, mtime);
-    return cmd.execute();        
+    utils::statement_cache::command cmd(m_stmts, "INSERT INTO file(url, size, mtime) VALUES (?, 0, ?)");
+    cmd->bind(1, url.c_str(), true);
+    cmd->bind(2, mtime);
+    return cmd->execute();        
 }
 
 int 
@@ -146,15 +243,15 @@ Library::add_file(  const string& url, int mtime, int size, const string& md5, c
     int fileid = 0;
     remove_file(url);
 
-    sqlite3pp::command cmd(m_db, "INSERT INTO file(url, size, mtime, md5, mimetype, duration, bitrate) VALUES (?, ?, ?, ?, ?, ?, ?)");
-    cmd.bind(1, url.c_str(), true);
-    cmd.bind(2, size);
-    cmd.bind(3, mtime);
-    cmd.bind(4, md5.c_str(), true);
-    cmd.bind(5, mimetype.c_str(), true);
-    cmd.bind(6, duration);
-    cmd.bind(7, bitrate);
-    if(cmd.execute() != SQLITE_OK){
+    utils::statement_cache::command cmd(m_stmts, "INSERT INTO file(url, size, mtime, md5, mimetype, duration, bitrate) VALUES (?, ?, ?, ?, ?, ?, ?)");
+    cmd->bind(1, url.c_str(), true);
+    cmd->bind(2, size);
+    cmd->bind(3, mtime);
+    cmd->bind(4, md5.c_str(), true);
+    cmd->bind(5, mimetype.c_str(), true);
+    cmd->bind(6, duration);
+    cmd->bind(7, bitrate);
+    if(cmd->execute() != SQLITE_OK){
         log::warning() << "Error inserting into file table"<<endl;
         return 0;
     }
@@ -169,13 +266,13 @@ Library::add_file(  const string& url, int mtime, int size, const string& md5, c
     }
     int albid = get_album_id(artid, album);
     // Now add the association
-    sqlite3pp::command cmd2(m_db, "INSERT INTO file_join(file, artist ,album, track) VALUES (?,?,?,?)");
-    cmd2.bind(1, fileid);
-    cmd2.bind(2, artid);
-    cmd2.bind(3, albid);
-    cmd2.bind(4, trkid);
+    utils::statement_cache::command cmd2(m_stmts, "INSERT INTO file_join(file, artist ,album, track) VALUES (?,?,?,?)");
+    cmd2->bind(1, fileid);
+    cmd2->bind(2, artid);
+    cmd2->bind(3, albid);
+    cmd2->bind(4, trkid);
     boost::mutex::scoped_lock lock(m_mut);
-    if(cmd2.execute() != SQLITE_OK){
+    if(cmd2->execute() != SQLITE_OK){
         log::warning() << "Error inserting into file_join table"<<endl;
         return 0;
     }
@@ -189,9 +286,9 @@ Library::get_artist_id(const string& name_orig)
     int id = 0;
     string sortname = Library::sortname(name_orig);
     if((id = m_artistcache[sortname])) return id;
-    sqlite3pp::query qry(m_db, "SELECT id FROM artist WHERE sortname = ?");
-    qry.bind(1, sortname.c_str(), true);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::statement_cache::query qry(m_stmts, "SELECT id FROM artist WHERE sortname = ?");
+    qry->bind(1, sortname.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         id = (*i).get<int>(0);
         break; // should only be one row
     }
@@ -201,10 +298,10 @@ Library::get_artist_id(const string& name_orig)
         return id;
     }
     // not found, insert it.
-    sqlite3pp::command cmd(m_db, "INSERT INTO artist(id,name,sortname) VALUES(NULL,?,?)");
-    cmd.bind(1,name_orig.c_str(),true);
-    cmd.bind(2,sortname.c_str(),true);
-    if(SQLITE_OK != cmd.execute()){
+    utils::statement_cache::command cmd(m_stmts, "INSERT INTO artist(id,name,sortname) VALUES(NULL,?,?)");
+    cmd->bind(1,name_orig.c_str(),true);
+    cmd->bind(2,sortname.c_str(),true);
+    if(SQLITE_OK != cmd->execute()){
         log::warning() << "Failed to insert artist: " << name_orig << endl;
         return 0;
     }
@@ -221,10 +318,10 @@ Library::get_track_id(int artistid, const string& name_orig)
     int id = 0;
     string sortname = Library::sortname(name_orig);
     if((id = m_trackcache[artistid][sortname])) return id;
-    sqlite3pp::query qry(m_db, "SELECT id FROM track WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artistid);
-    qry.bind(2, sortname.c_str(), true);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::statement_cache::query qry(m_stmts, "SELECT id FROM track WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artistid);
+    qry->bind(2, sortname.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         id = (*i).get<int>(0);
         break; // should only be one row
     }
@@ -234,11 +331,11 @@ Library::get_track_id(int artistid, const string& name_orig)
         return id;
     }
     // not found, insert it.
-    sqlite3pp::command cmd(m_db, "INSERT INTO track(id,artist,name,sortname) VALUES(NULL,?,?,?)");
-    cmd.bind(1, artistid);
-    cmd.bind(2, name_orig.c_str(), true);
-    cmd.bind(3, sortname.c_str(), true);
-    if(SQLITE_OK != cmd.execute()){
+    utils::statement_cache::command cmd(m_stmts, "INSERT INTO track(id,artist,name,sortname) VALUES(NULL,?,?,?)");
+    cmd->bind(1, artistid);
+    cmd->bind(2, name_orig.c_str(), true);
+    cmd->bind(3, sortname.c_str(), true);
+    if(SQLITE_OK != cmd->execute()){
         log::warning() << "Failed to insert track: " << name_orig << endl;
         return 0;
     }
@@ -255,10 +352,10 @@ Library::get_album_id(int artistid, const string& name_orig)
     int id = 0;
     string sortname = Library::sortname(name_orig);
     if((id = m_albumcache[artistid][sortname])) return id;
-    sqlite3pp::query qry(m_db, "SELECT id FROM album WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artistid);
-    qry.bind(2, sortname.c_str(), true);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::statement_cache::query qry(m_stmts, "SELECT id FROM album WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artistid);
+    qry->bind(2, sortname.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         id = (*i).get<int>(0);
         break; // should only be one row
     }
@@ -268,11 +365,11 @@ Library::get_album_id(int artistid, const string& name_orig)
         return id;
     }
     // not found, insert it.
-    sqlite3pp::command cmd(m_db, "INSERT INTO album(id,artist,name,sortname) VALUES(NULL,?,?,?)");
-    cmd.bind(1, artistid);
-    cmd.bind(2, name_orig.c_str(), true);
-    cmd.bind(3, sortname.c_str(), true);
-    if(SQLITE_OK != cmd.execute()){
+    utils::statement_cache::command cmd(m_stmts, "INSERT INTO album(id,artist,name,sortname) VALUES(NULL,?,?,?)");
+    cmd->bind(1, artistid);
+    cmd->bind(2, name_orig.c_str(), true);
+    cmd->bind(3, sortname.c_str(), true);
+    if(SQLITE_OK != cmd->execute()){
         log::warning() << "Failed to insert album: " << name_orig << endl;
         return 0;
     }
@@ -285,10 +382,10 @@ Library::get_album_id(int artistid, const string& name_orig)
 int
 Library::get_random_fid()
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     string sql = "SELECT id FROM file WHERE size > 0 AND rowid > (abs(random()) % (SELECT max(rowid) FROM file)) LIMIT 1";
-    sqlite3pp::query qry(m_db, sql.c_str());
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i)
+    utils::statement_cache::query qry(r.stmts(), sql.c_str());
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i)
     {
         return (*i).get<int>(0);
     }
@@ -298,16 +395,19 @@ Library::get_random_fid()
 vector<scorepair>
 Library::search_catalogue(string table, string name_orig)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     vector<scorepair> results;
     if(table != "artist" && table != "track" && table != "album") return results;
     if(name_orig.length()<3) return results;
     string name = sortname(name_orig);
     map<string,int> ngrammap = ngrams(name);
-    map<string,int>::const_iterator iter = ngrammap.begin();
+    if(ngrammap.empty()) return results;
+    map<string,int>::const_iterator iter;
+    // the IN list is padded to a multiple of 8 so there are only a few
+    // distinct statements for the cache. padding repeats the last ngram:
+    size_t numq = (ngrammap.size() + 7) & ~size_t(7);
     string q("?");
-    iter++;
-    for( ; iter!=ngrammap.end(); ++iter)
+    for(size_t k = 1; k < numq; ++k)
     {
         q += ", ?";
     }
@@ -315,12 +415,15 @@ Library::search_catalogue(string table, string name_orig)
     sql +=       "FROM " + table + "_search_index as s ";
     sql +=       "WHERE ngram IN (" + q + ") ";
     sql +=       "GROUP BY s.id ORDER BY sum(s.num) DESC LIMIT 10";
-    sqlite3pp::query qry(m_db, sql.c_str());
+    utils::statement_cache::query qry(r.stmts(), sql.c_str());
     int numn = 0;
     for(iter = ngrammap.begin(); iter!=ngrammap.end(); ++iter){
-        qry.bind(++numn, iter->first.c_str(), true);
+        qry->bind(++numn, iter->first.c_str(), true);
     }
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+    while(numn < (int)numq){
+        qry->bind(++numn, ngrammap.rbegin()->first.c_str(), true);
+    }
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
         scorepair sp;
         sp.id = (*i).get<int>(0);
         sp.score = (float) (*i).get<int>(1);
@@ -332,16 +435,19 @@ Library::search_catalogue(string table, string name_orig)
 vector<scorepair>
 Library::search_catalogue_for_artist(int artistid, string table, string name_orig)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     vector<scorepair> results;
     if(table != "track" && table != "album") return results;
     if(name_orig.length()<3) return results;
     string name = sortname(name_orig);
     map<string,int> ngrammap = ngrams(name);
-    map<string,int>::const_iterator iter = ngrammap.begin();
+    if(ngrammap.empty()) return results;
+    map<string,int>::const_iterator iter;
+    // the IN list is padded to a multiple of 8 so there are only a few
+    // distinct statements for the cache. padding repeats the last ngram:
+    size_t numq = (ngrammap.size() + 7) & ~size_t(7);
     string q("?");
-    iter++;
-    for( ; iter!=ngrammap.end(); ++iter)
+    for(size_t k = 1; k < numq; ++k)
     {
         q += ", ?";
     }
@@ -351,13 +457,16 @@ Library::search_catalogue_for_artist(int artistid, string table, string name_ori
     sql +=       "WHERE " + table +".artist = ? AND ";
     sql +=       "ngram IN (" + q + ") ";
     sql +=       "GROUP BY s.id ORDER BY sum(s.num) DESC LIMIT 10";
-    sqlite3pp::query qry(m_db, sql.c_str());
-    qry.bind(1, artistid);
+    utils::statement_cache::query qry(r.stmts(), sql.c_str());
+    qry->bind(1, artistid);
     int numn = 1;
     for(iter = ngrammap.begin(); iter!=ngrammap.end(); ++iter){
-        qry.bind(++numn, iter->first.c_str(), true);
+        qry->bind(++numn, iter->first.c_str(), true);
     }
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+    while(numn < 1 + (int)numq){
+        qry->bind(++numn, ngrammap.rbegin()->first.c_str(), true);
+    }
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
         scorepair sp;
         sp.id = (*i).get<int>(0);
         sp.score = (float) (*i).get<int>(1);
@@ -370,14 +479,14 @@ Library::search_catalogue_for_artist(int artistid, string table, string name_ori
 vector<artist_ptr>
 Library::list_artists()
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     vector<artist_ptr> results;
     string sql = "SELECT id ";
     sql +=       "FROM artist ";
     sql +=       "ORDER BY sortname ASC";
-    sqlite3pp::query qry(m_db, sql.c_str());
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
-        results.push_back( load_artist((*i).get<int>(0)) );
+    utils::statement_cache::query qry(r.stmts(), sql.c_str());
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
+        results.push_back( load_artist(r.stmts(), (*i).get<int>(0)) );
     }
     return results;
 }
@@ -385,16 +494,16 @@ Library::list_artists()
 vector<track_ptr> 
 Library::list_artist_tracks(artist_ptr artist)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     vector< boost::shared_ptr<Track> > results;
     string sql = "SELECT id ";
     sql +=       "FROM track ";
     sql +=       "WHERE artist = ? ";
     sql +=       "ORDER BY sortname ASC";
-    sqlite3pp::query qry(m_db, sql.c_str());
-    qry.bind(1, artist->id());
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
-        results.push_back( load_track( (*i).get<int>(0) ) );
+    utils::statement_cache::query qry(r.stmts(), sql.c_str());
+    qry->bind(1, artist->id());
+    for (sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i) {
+        results.push_back( load_track( r.stmts(), (*i).get<int>(0) ) );
     }
     return results;
 }
@@ -402,16 +511,88 @@ Library::list_artist_tracks(artist_ptr artist)
 vector<int>
 Library::get_fids_for_tid(int tid)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     vector<int> results;
-    sqlite3pp::query qry(m_db, "SELECT file.id FROM file, file_join WHERE file_join.file=file.id AND file_join.track = ? ORDER BY bitrate DESC");
-    qry.bind(1, tid);
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::statement_cache::query qry(r.stmts(), "SELECT file.id FROM file, file_join WHERE file_join.file=file.id AND file_join.track = ? ORDER BY bitrate DESC");
+    qry->bind(1, tid);
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         results.push_back( (*i).get<int>(0) );
     }
     return results;
 }
 
+vector<LibraryFile>
+Library::files_for_tracks(const vector<int>& tids)
+{
+    vector<LibraryFile> results;
+    if(tids.empty()) return results;
+    reader r(*this);
+    // padded to a multiple of 8 for the statement cache, as search_catalogue:
+    size_t numq = (tids.size() + 7) & ~size_t(7);
+    string q("?");
+    for(size_t k = 1; k < numq; ++k)
+    {
+        q += ", ?";
+    }
+    string sql = "SELECT file.id, file.url, file.size, file.mimetype, file.duration, file.bitrate, ";
+    sql +=       "file_join.artist, file_join.album, file_join.track, ";
+    sql +=       "artist.name, coalesce(album.name, ''), track.name ";
+    sql +=       "FROM file_join ";
+    sql +=       "JOIN file ON file.id = file_join.file ";
+    sql +=       "JOIN artist ON artist.id = file_join.artist ";
+    sql +=       "JOIN track ON track.id = file_join.track ";
+    sql +=       "LEFT JOIN album ON album.id = file_join.album ";
+    sql +=       "WHERE file_join.track IN (" + q + ") ";
+    sql +=       "ORDER BY file.bitrate DESC";
+    utils::statement_cache::query qry(r.stmts(), sql.c_str());
+    for(size_t k = 0; k < numq; ++k)
+    {
+        qry->bind((int)k + 1, tids[ k < tids.size() ? k : tids.size() - 1 ]);
+    }
+    map< int, vector<LibraryFile> > bytrack;
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
+        LibraryFile f;
+        f.id = (*i).get<int>(0);
+        f.url = string((*i).get<const char *>(1));
+        f.size = (*i).get<int>(2);
+        f.mimetype = string((*i).get<const char *>(3));
+        f.duration = (*i).get<int>(4);
+        f.bitrate = (*i).get<int>(5);
+        f.piartid = (*i).get<int>(6);
+        f.pialbid = (*i).get<int>(7);
+        f.pitrkid = (*i).get<int>(8);
+        f.artist = string((*i).get<const char *>(9));
+        f.album = string((*i).get<const char *>(10));
+        f.track = string((*i).get<const char *>(11));
+        bytrack[f.pitrkid].push_back(f);
+    }
+    BOOST_FOREACH( int tid, tids )
+    {
+        map< int, vector<LibraryFile> >::iterator it = bytrack.find(tid);
+        if(it == bytrack.end()) continue;
+        results.insert(results.end(), it->second.begin(), it->second.end());
+        bytrack.erase(it); // in case tids has repeats
+    }
+    return results;
+}
+
+namespace {
+
+struct ngram_row
+{
+    string ngram;
+    int id;
+    int num;
+    bool operator<(const ngram_row& o) const
+    {
+        int c = ngram.compare(o.ngram);
+        return c < 0 || (c == 0 && id < o.id);
+    }
+};
+
+}
+
+/// rebuilds the whole ngram index for table.
 bool 
 Library::build_index(string table)
 {
@@ -420,44 +601,154 @@ Library::build_index(string table)
     boost::mutex::scoped_lock lock(m_mut);
     
     cout << "Building index for " << table << endl;
-    string searchtable = table + "_search_index";
-        m_db.execute(string("DELETE FROM "+searchtable).c_str());
-    sqlite3pp::query qry(m_db, string("SELECT id, sortname FROM "+table).c_str());
-    int num_names = 0;
-    int num_ngrams = 0;
-    int id;
-    char const * name;
+    vector< pair<int, string> > names;
+    {
+        sqlite3pp::query qry(m_db, string("SELECT id, sortname FROM "+table).c_str());
+        for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+            names.push_back( make_pair( (*i).get<int>(0), string((*i).get<const char *>(1)) ) );
+        }
+    }
+    return write_index(table, names, true, 0);
+}
+
+/// indexes just the names added to table since it was last indexed,
+/// or does a full build_index if the index is empty.
+/// ids only ever go up (AUTOINCREMENT), so the highest id indexed is
+/// kept in playdar_system, and anything above it is new. that survives
+/// restarts, and a scan that stopped before indexing what it added.
+bool
+Library::update_index(string table)
+{
+    if(table != "artist" && table != "track" && table != "album") return false;
+    
+    boost::mutex::scoped_lock lock(m_mut);
     
-    sqlite3pp::command cmd_i(m_db, string(  "INSERT INTO "+searchtable+
-                                            "(ngram, id, num) VALUES (?,?,?)").c_str() );
-
-    sqlite3pp::command cmd_u(m_db, string(  "UPDATE "+searchtable+" SET num=num+? "+
-                                            "WHERE ngram=? AND id=?").c_str());
-
-    for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
-        id   = (*i).get<int>(0);
-        name = (*i).get<char const*>(1);
-        num_names++;
-        cmd_i.bind(2, id); // set id
-        cmd_u.bind(3, id); // set id
-        map<string,int> ngrammap = ngrams(name);
+    bool empty;
+    {
+        sqlite3pp::query qry(m_db, string("SELECT 1 FROM "+table+"_search_index LIMIT 1").c_str());
+        empty = qry.begin() == qry.end();
+    }
+    int upto = indexed_upto(table);
+    string sql = "SELECT id, sortname FROM "+table;
+    if(!empty)
+    {
+        if(upto >= 0) 
+            sql += " WHERE id > ?";
+        else // indexed before we kept track, look for names missing from it:
+            sql += " WHERE id NOT IN (SELECT DISTINCT id FROM "+table+"_search_index)";
+    }
+    vector< pair<int, string> > names;
+    {
+        sqlite3pp::query qry(m_db, sql.c_str());
+        if(!empty && upto >= 0) qry.bind(1, upto);
+        for (sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i) {
+            names.push_back( make_pair( (*i).get<int>(0), string((*i).get<const char *>(1)) ) );
+        }
+    }
+    if(!empty && names.empty() && upto >= 0) return true;
+    cout << "Updating index for " << table << endl;
+    return write_index(table, names, empty, upto);
+}
+
+/// highest id of table that's in its ngram index, or -1 if not known.
+/// expects m_mut held.
+int
+Library::indexed_upto(const string& table)
+{
+    string key = "indexed_" + table;
+    utils::statement_cache::query qry(m_stmts, "SELECT value FROM playdar_system WHERE key = ?");
+    qry->bind(1, key.c_str(), true);
+    for(sqlite3pp::query::iterator i = qry->begin(); i != qry->end(); ++i){
+        return (*i).get<int>(0);
+    }
+    return -1;
+}
+
+/// counts the ngrams of names in memory, then writes them to table's
+/// search index sorted, in one go. if full, the index is emptied first,
+/// and its unique index is dropped while loading and made again after.
+/// records the highest id indexed (at least upto) with the rows, see update_index.
+/// expects m_mut held.
+bool
+Library::write_index(const string& table, const vector< pair<int, string> >& names, 
+                     bool full, int upto)
+{
+    string searchtable = table + "_search_index";
+    string sqlindex = searchtable + "_ngram_" + table;
+    vector<ngram_row> rows;
+    for(size_t k = 0; k < names.size(); ++k)
+    {
+        if(names[k].first > upto) upto = names[k].first;
+        map<string,int> ngrammap = ngrams(names[k].second);
         for(map<string,int>::const_iterator it = ngrammap.begin(); it != ngrammap.end(); ++it)
         {
-            num_ngrams++;
-            cmd_u.bind(1, it->second);
-            cmd_u.bind(2, it->first.c_str());
-            cmd_u.execute();
-            cmd_u.reset();
-            if(m_db.changes()==0) { // update failed, do insert
-                cmd_i.bind(1, it->first.c_str());
-                cmd_i.bind(3, it->second);
-                cmd_i.execute();
-                cmd_i.reset();
-            }            
+            ngram_row r;
+            r.ngram = it->first;
+            r.id = names[k].first;
+            r.num = it->second;
+            rows.push_back(r);
         }
     }
-    cout << "Finished indexing " << table << " - " << num_names <<" names, " << num_ngrams << " ngrams." << endl;
-    return true;
+    sort(rows.begin(), rows.end());
+    
+    // a savepoint, not a transaction, as the scanner may have one open:
+    if(m_db.execute("SAVEPOINT write_index") != SQLITE_OK)
+    {
+        log::warning() << "Couldn't start indexing " << table << endl;
+        return false;
+    }
+    bool ok = true;
+    if(full)
+    {
+        ok = m_db.execute(string("DROP INDEX IF EXISTS "+sqlindex).c_str()) == SQLITE_OK
+          && m_db.execute(string("DELETE FROM "+searchtable).c_str()) == SQLITE_OK;
+    }
+    if(ok)
+    {
+        sqlite3pp::command cmd(m_db, string( "INSERT OR REPLACE INTO "+searchtable+
+                                             "(ngram, id, num) VALUES (?,?,?)").c_str() );
+        for(size_t k = 0; ok && k < rows.size(); ++k)
+        {
+            cmd.bind(1, rows[k].ngram.c_str(), true);
+            cmd.bind(2, rows[k].id);
+            cmd.bind(3, rows[k].num);
+            ok = cmd.execute() == SQLITE_OK;
+            cmd.reset();
+        }
+    }
+    if(ok && full)
+    {
+        ok = m_db.execute(string("CREATE UNIQUE INDEX IF NOT EXISTS "+sqlindex+
+                                 " ON "+searchtable+"(ngram, id)").c_str()) == SQLITE_OK;
+    }
+    if(ok)
+    {
+        string key = "indexed_" + table;
+        sqlite3pp::command cmd(m_db, "INSERT OR REPLACE INTO playdar_system(key, value) VALUES(?, ?)");
+        cmd.bind(1, key.c_str(), true);
+        cmd.bind(2, upto);
+        ok = cmd.execute() == SQLITE_OK;
+    }
+    if(!ok)
+    {
+        log::warning() << "Error indexing " << table << ": " << m_db.error_msg() << endl;
+        m_db.execute("ROLLBACK TO write_index");
+    }
+    m_db.execute("RELEASE write_index");
+    if(ok)
+    {
+        cout << "Finished indexing " << table << " - " << names.size() <<" names, " 
+             << rows.size() << " ngrams." << endl;
+    }
+    return ok;
+}
+
+bool
+Library::load_ngram_index(const string& table, NgramIndex& idx)
+{
+    if(table != "artist" && table != "track" && table != "album") return false;
+    reader r(*this);
+    return idx.load(r.db(), table);
 }
 
 // horribly inefficient:
@@ -466,14 +757,16 @@ Library::ngrams(const string& str_orig)
 {
     int n=3;
     map<string,int> m;
-    //TODO trim etc
-    string str = " " +sortname(str_orig) +" ";
-    size_t num = str.length() - (n-1);
-    string ngram;
-    for(size_t j = 0; j < num; j++){
-         ngram = str.substr(j, n);
-         if(m[ngram]) m[ngram]++;
-         else m[ngram]=1;
+    string str = " " + utils::match_name(str_orig) + " ";
+    // n code points, not bytes, so accented/non-latin names aren't split
+    // mid-character. starts[] holds the offset of each code point:
+    vector<size_t> starts;
+    for(size_t j = 0; j < str.length(); j++){
+        if((str[j] & 0xC0) != 0x80) starts.push_back(j);
+    }
+    starts.push_back(str.length());
+    for(size_t j = 0; j + n < starts.size(); j++){
+        m[ str.substr(starts[j], starts[j+n] - starts[j]) ]++;
     }
     return m;
 }
@@ -499,10 +792,26 @@ Library::num_tracks()
     return db_get_one(string("SELECT count(*) FROM track"), 0);
 }
 
+int
+Library::last_modified()
+{
+    return db_get_one(string("SELECT value FROM playdar_system WHERE key = 'last_modified'"), 0);
+}
+
+void
+Library::set_last_modified(int t)
+{
+    boost::mutex::scoped_lock lock(m_mut);
+    utils::statement_cache::command cmd(m_stmts, "INSERT OR REPLACE INTO playdar_system(key, value) VALUES('last_modified', ?)");
+    cmd->bind(1, t);
+    cmd->execute();
+}
+
 LibraryFile_ptr
 Library::file_from_fid(int fid)
 {
-    return file_from_fid( m_db, fid );
+    reader r(*this);
+    return file_from_fid( r.stmts(), fid );
 }
 
 
@@ -510,10 +819,10 @@ Library::file_from_fid(int fid)
 map<string, int>
 Library::file_mtimes()
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     map<string, int> ret;
-    sqlite3pp::query qry(m_db, "SELECT url, mtime FROM file");
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::statement_cache::query qry(r.stmts(), "SELECT url, mtime FROM file");
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ret[ string((*i).get<const char *>(0)) ] = (*i).get<int>(1);
     }
     return ret;
@@ -523,10 +832,10 @@ Library::file_mtimes()
 template <typename T> T
 Library::db_get_one(string sql, T def)
 {
-    boost::mutex::scoped_lock lock(m_mut);
+    reader r(*this);
     T val;
-    sqlite3pp::query qry(m_db, sql.c_str());
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    utils::statement_cache::query qry(r.stmts(), sql.c_str());
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         val = (*i).get<T>(def);
         return val;
     }
@@ -542,11 +851,11 @@ Library::get_name(string table, int id)
 string
 Library::get_field(string table, int id, string field)
 {
-    boost::mutex::scoped_lock lock(m_mut);
-    sqlite3pp::query qry(m_db, string("SELECT "+field+" FROM "+table+" WHERE id = ?").c_str() );
-    qry.bind(1, id);
+    reader r(*this);
+    utils::statement_cache::query qry(r.stmts(), string("SELECT "+field+" FROM "+table+" WHERE id = ?").c_str() );
+    qry->bind(1, id);
     string result("");
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         result = string((*i).get<const char *>(0));
         break; // should only be one row
     }
@@ -554,36 +863,10 @@ Library::get_field(string table, int id, string field)
 }
 
 
-// replace whitespace and other control codes with ' ' and replace multiple spaces with single
-static
-string 
-fixspaces(const string& s)
-{
-    string r;
-    bool prevWasSpace = false;
-    r.reserve(s.length());
-    for (string::const_iterator i = s.begin(); i != s.end(); i++) {
-        if (*i > 0 && *i <= ' ') {
-            if (!prevWasSpace) {
-                r += ' ';
-                prevWasSpace = true;
-            }
-        } else {
-            r += *i;
-            prevWasSpace = false;
-        }
-    }
-    return r;
-}
-
-
 string
 Library::sortname(const string& name)
 {
-    string data(name);
-    std::transform(data.begin(), data.end(), data.begin(), ::tolower);
-    boost::trim(data);
-    return fixspaces(data);
+    return utils::sortname(name);
 }
 
 // CATALOGUE LOADING (TODO) some factory of singletons->shared pointers, so only one lookup
@@ -592,11 +875,12 @@ Library::sortname(const string& name)
 artist_ptr
 Library::load_artist(string n)
 {
+    reader r(*this);
     string sortname = Library::sortname(n);
-    sqlite3pp::query qry(m_db, "SELECT id,name FROM artist WHERE sortname = ?");
-    qry.bind(1, sortname.c_str(), true);
+    utils::statement_cache::query qry(r.stmts(), "SELECT id,name FROM artist WHERE sortname = ?");
+    qry->bind(1, sortname.c_str(), true);
     artist_ptr ptr;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ptr = artist_ptr(new Artist((*i).get<int>(0), (*i).get<string>(1)));
         break;
     }
@@ -606,18 +890,20 @@ Library::load_artist(string n)
 artist_ptr
 Library::load_artist(int n)
 {
-    return load_artist( m_db, n );
+    reader r(*this);
+    return load_artist( r.stmts(), n );
 }
 
 track_ptr
 Library::load_track(artist_ptr artp, string n)
 {
+    reader r(*this);
     string sortname = Library::sortname(n);
-    sqlite3pp::query qry(m_db, "SELECT id,name FROM track WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artp->id());
-    qry.bind(2, sortname.c_str(), true);
+    utils::statement_cache::query qry(r.stmts(), "SELECT id,name FROM track WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artp->id());
+    qry->bind(2, sortname.c_str(), true);
     track_ptr ptr;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ptr = track_ptr(new Track((*i).get<int>(0), (*i).get<string>(1), artp));
         break;
     }
@@ -627,18 +913,20 @@ Library::load_track(artist_ptr artp, string n)
 track_ptr
 Library::load_track(int n)
 {
-    return load_track( m_db, n );
+    reader r(*this);
+    return load_track( r.stmts(), n );
 }
 
 album_ptr
 Library::load_album(artist_ptr artp, string n)
 {
+    reader r(*this);
     string sortname = Library::sortname(n);
-    sqlite3pp::query qry(m_db, "SELECT id,name FROM album WHERE artist = ? AND sortname = ?");
-    qry.bind(1, artp->id());
-    qry.bind(2, sortname.c_str(), true);
+    utils::statement_cache::query qry(r.stmts(), "SELECT id,name FROM album WHERE artist = ? AND sortname = ?");
+    qry->bind(1, artp->id());
+    qry->bind(2, sortname.c_str(), true);
     album_ptr ptr;
-    for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+    for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
         ptr = album_ptr(new Album((*i).get<int>(0), (*i).get<string>(1), artp));
         break;
     }
@@ -648,7 +936,8 @@ Library::load_album(artist_ptr artp, string n)
 album_ptr
 Library::load_album(int n)
 {
-    return load_album( m_db, n );
+    reader r(*this);
+    return load_album( r.stmts(), n );
 }
 
 }
@@ -22,6 +22,7 @@
 #include <cstdio>
 #include <map>
 #include <vector>
+#include <boost/noncopyable.hpp>
 #include <boost/thread/mutex.hpp>
 
 
@@ -32,10 +33,12 @@
 #include "library_file.h"
 
 #include "sqlite3pp.h"
+#include "playdar/utils/statement_cache.hpp"
 
 namespace playdar {
 
 class MyApplication;
+class NgramIndex;
 
 class Library
 {
@@ -61,8 +64,19 @@ public:
     int num_tracks();
     
     int get_random_fid();
+    
+    /// time of the last scan that changed the library, 0 if unknown.
+    int last_modified();
+    void set_last_modified(int t);
 
     bool build_index(std::string);
+    bool update_index(std::string);
+    /// stored sortnames and ngram indexes depend on utils::sortname/match_name.
+    /// update_sortnames redoes them if made by an older version, see sortname_version.
+    bool sortnames_current();
+    void update_sortnames();
+    /// copies the ngram index of table into idx, see NgramIndex::load
+    bool load_ngram_index(const std::string& table, NgramIndex& idx);
     static std::string sortname(const std::string& name);
     std::map<std::string, int> ngrams(const std::string&);
 
@@ -72,12 +86,12 @@ public:
     // catalogue items
     artist_ptr  load_artist(std::string n);
     artist_ptr  load_artist(int n);
-    inline static artist_ptr load_artist( sqlite3pp::database& db, int n )
+    inline static artist_ptr load_artist( utils::statement_cache& db, int n )
     {
-        sqlite3pp::query qry(db, "SELECT id,name FROM artist WHERE id = ?");
-        qry.bind(1, n);
+        utils::statement_cache::query qry(db, "SELECT id,name FROM artist WHERE id = ?");
+        qry->bind(1, n);
         artist_ptr ptr;
-        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
             ptr = artist_ptr(new Artist((*i).get<int>(0), (*i).get<std::string>(1)));
             break;
         }
@@ -86,12 +100,12 @@ public:
     
     album_ptr   load_album(artist_ptr artp, std::string n);
     album_ptr   load_album(int n);
-    inline static album_ptr load_album( sqlite3pp::database& db, int n )
+    inline static album_ptr load_album( utils::statement_cache& db, int n )
     {
-        sqlite3pp::query qry(db, "SELECT id,name,artist FROM album WHERE id = ?");
-        qry.bind(1, n);
+        utils::statement_cache::query qry(db, "SELECT id,name,artist FROM album WHERE id = ?");
+        qry->bind(1, n);
         album_ptr ptr;
-        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
             ptr = album_ptr(new Album((*i).get<int>(0), (*i).get<std::string>(1), load_artist( db, (*i).get<int>(2))));
             break;
         }
@@ -100,12 +114,12 @@ public:
     
     track_ptr   load_track(artist_ptr artp, std::string n);
     track_ptr   load_track(int n);
-    inline static track_ptr load_track( sqlite3pp::database& db, int n )
+    inline static track_ptr load_track( utils::statement_cache& db, int n )
     {
-        sqlite3pp::query qry(db, "SELECT id,name,artist FROM track WHERE id = ?");
-        qry.bind(1, n);
+        utils::statement_cache::query qry(db, "SELECT id,name,artist FROM track WHERE id = ?");
+        qry->bind(1, n);
         track_ptr ptr;
-        for(sqlite3pp::query::iterator i = qry.begin(); i!=qry.end(); ++i){
+        for(sqlite3pp::query::iterator i = qry->begin(); i!=qry->end(); ++i){
             ptr = track_ptr(new Track((*i).get<int>(0), (*i).get<std::string>(1), load_artist(db, (*i).get<int>(2))));
             break;
         }
@@ -120,22 +134,27 @@ public:
     std::string get_field(std::string, int, std::string);
 
     std::vector<int> get_fids_for_tid(int tid);
+    /// the files for each of tids, in that order and best bitrate first,
+    /// with their names. one query, instead of get_fids_for_tid and then
+    /// a file_from_fid and name lookups per file.
+    std::vector<LibraryFile> files_for_tracks(const std::vector<int>& tids);
     LibraryFile_ptr file_from_fid(int fid);
 
-    inline static LibraryFile_ptr file_from_fid( sqlite3pp::database& db, int fid )
+    inline static LibraryFile_ptr file_from_fid( utils::statement_cache& db, int fid )
     {
-        sqlite3pp::query qry(db,
+        utils::statement_cache::query qry(db,
                              "SELECT file.url, file.size, file.mimetype, file.duration, file.bitrate, "
                              "file_join.artist, file_join.album, file_join.track "
                              "FROM file, file_join "
                              "WHERE file.id = file_join.file "
                              "AND file.id = ?");
-        qry.bind(1, fid);
-        sqlite3pp::query::iterator i( qry.begin() );
-        if (i == qry.end())
+        qry->bind(1, fid);
+        sqlite3pp::query::iterator i( qry->begin() );
+        if (i == qry->end())
             return LibraryFile_ptr((LibraryFile*)0);
         
         LibraryFile_ptr p(new LibraryFile);
+        p->id = fid;
         p->url = std::string((*i).get<const char *>(0));
         p->size = (*i).get<int>(1);
         p->mimetype = std::string((*i).get<const char *>(2));
@@ -147,17 +166,55 @@ public:
         return p;   
     }
     
+    /// the connection used for writing. readers should use a reader.
     sqlite3pp::database& db() { return m_db; }
     std::string dbfilepath() const { return m_dbfilepath; }
     
+private:
+    struct connection;
+public:
+    /// a read-only connection borrowed from the library's pool, and given
+    /// back when this goes out of scope. reads on different connections
+    /// run concurrently, and (with the db in WAL mode) alongside a writer.
+    /// sees the db as last committed.
+    class reader : boost::noncopyable
+    {
+    public:
+        explicit reader( Library& lib );
+        ~reader();
+        sqlite3pp::database& db() { return m_conn->db; }
+        utils::statement_cache& stmts() { return m_conn->stmts; }
+    private:
+        Library& m_lib;
+        connection* m_conn;
+    };
+    
     // DB helper:
     template <typename T> T db_get_one(std::string sql, T def);
     
 private:
     void check_db();
     void create_db_schema();
+    bool write_index(const std::string& table, 
+                     const std::vector< std::pair<int, std::string> >& names, 
+                     bool full, int upto);
+    int indexed_upto(const std::string& table);
+    // bump when utils::sortname/match_name change, to redo stored names:
+    static const int sortname_version = 1;
     sqlite3pp::database m_db;
-    boost::mutex m_mut;
+    utils::statement_cache m_stmts; // on m_db
+    boost::mutex m_mut; // for m_db and the caches
+    // idle read-only connections, see reader:
+    struct connection
+    {
+        explicit connection( const std::string& path )
+            : db( path.c_str() ), stmts( db )
+        {}
+        sqlite3pp::database db;
+        utils::statement_cache stmts;
+    };
+    std::vector< connection* > m_readers;
+    boost::mutex m_mut_readers;
     std::string m_dbfilepath;
     // name -> id caches
     std::map< std::string, int > m_artistcache;
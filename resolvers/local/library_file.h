@@ -27,6 +27,7 @@ namespace playdar {
 class LibraryFile
 {
 public:
+    int id;
     std::string url;
     int size;
     std::string mimetype;
@@ -35,6 +36,10 @@ public:
     int piartid;
     int pialbid;
     int pitrkid;
+    // names, only filled in by Library::files_for_tracks:
+    std::string artist;
+    std::string album;
+    std::string track;
 };
 
 }
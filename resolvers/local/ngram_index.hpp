@@ -0,0 +1,249 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __NGRAM_INDEX_H__
+#define __NGRAM_INDEX_H__
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "playdar/types.h"
+#include "sqlite3pp.h"
+
+namespace playdar {
+
+/*
+    In-memory copy of one of the <table>_search_index ngram tables, so
+    candidates can be found without going to sqlite.
+
+    Stored as an inverted index: the distinct ngrams in sorted order, and
+    for each a run of postings sorted by id. Each posting packs the id and
+    how many times the ngram occurs in that name into 32 bits.
+
+    A name scores the sum of those counts over the query's ngrams, same
+    as the SQL search did. Read-only once loaded, so it can be searched
+    from several threads.
+*/
+class NgramIndex
+{
+public:
+    NgramIndex() {}
+    
+    /// reads the index table, plus track->artist for the track table.
+    /// @return false if the ids are too big to pack; the index is then
+    ///         left empty and callers should search the db instead.
+    bool load( sqlite3pp::database& db, const std::string& table )
+    {
+        clear();
+        {
+            sqlite3pp::query qry(db, std::string("SELECT ngram, id, num FROM " + table + 
+                                                 "_search_index ORDER BY ngram, id").c_str());
+            for(sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i)
+            {
+                const char * ngram = (*i).get<const char *>(0);
+                int id = (*i).get<int>(1);
+                int num = (*i).get<int>(2);
+                if( id < 0 || id > max_id )
+                {
+                    clear();
+                    return false;
+                }
+                if( m_grams.empty() || m_grams.back() != ngram )
+                {
+                    m_grams.push_back( ngram );
+                    m_offsets.push_back( m_postings.size() );
+                }
+                m_postings.push_back( pack( id, num ) );
+            }
+        }
+        m_offsets.push_back( m_postings.size() );
+        
+        if( table == "track" )
+        {
+            sqlite3pp::query qry(db, "SELECT artist, id FROM track ORDER BY artist, id");
+            for(sqlite3pp::query::iterator i = qry.begin(); i != qry.end(); ++i)
+            {
+                m_by_artist[ (*i).get<int>(0) ].push_back( (*i).get<int>(1) );
+            }
+        }
+        return true;
+    }
+    
+    void clear()
+    {
+        m_grams.clear();
+        m_offsets.clear();
+        m_postings.clear();
+        m_by_artist.clear();
+    }
+    
+    size_t num_ngrams() const   { return m_grams.size(); }
+    size_t num_postings() const { return m_postings.size(); }
+    
+    /// best matching names for the ngrams, highest score first.
+    std::vector<scorepair> search( const std::map<std::string,int>& ngrams,
+                                   size_t limit ) const
+    {
+        // merge the query ngrams' posting runs in id order, summing
+        // counts, and keep the best few:
+        std::priority_queue< cursor, std::vector<cursor>, std::greater<cursor> > merge;
+        for( std::map<std::string,int>::const_iterator it = ngrams.begin(); 
+             it != ngrams.end(); ++it )
+        {
+            cursor c;
+            if( !find( it->first, c.pos, c.end ) ) continue;
+            c.id = id_of( m_postings[c.pos] );
+            merge.push( c );
+        }
+        top_scores top( limit );
+        int cur_id = -1;
+        float cur_score = 0;
+        while( !merge.empty() )
+        {
+            cursor c = merge.top();
+            merge.pop();
+            if( (int) c.id != cur_id )
+            {
+                if( cur_id >= 0 ) top.add( cur_id, cur_score );
+                cur_id = c.id;
+                cur_score = 0;
+            }
+            cur_score += num_of( m_postings[c.pos] );
+            // on to the next posting in the same run, if any:
+            if( ++c.pos < c.end )
+            {
+                c.id = id_of( m_postings[c.pos] );
+                merge.push( c );
+            }
+        }
+        if( cur_id >= 0 ) top.add( cur_id, cur_score );
+        return top.sorted();
+    }
+    
+    /// as search(), but only tracks by the given artist. track index only.
+    std::vector<scorepair> search_for_artist( int artistid,
+                                              const std::map<std::string,int>& ngrams,
+                                              size_t limit ) const
+    {
+        top_scores top( limit );
+        std::map< int, std::vector<int> >::const_iterator tracks = m_by_artist.find( artistid );
+        if( tracks == m_by_artist.end() ) return top.sorted();
+        
+        // artists have few tracks, so look each one up in every run:
+        std::vector< std::pair<size_t, size_t> > runs;
+        for( std::map<std::string,int>::const_iterator it = ngrams.begin(); 
+             it != ngrams.end(); ++it )
+        {
+            size_t begin, end;
+            if( find( it->first, begin, end ) ) runs.push_back( std::make_pair( begin, end ) );
+        }
+        for( std::vector<int>::const_iterator t = tracks->second.begin(); 
+             t != tracks->second.end(); ++t )
+        {
+            float score = 0;
+            const boost::uint32_t lo = pack( *t, 0 );
+            for( size_t r = 0; r < runs.size(); ++r )
+            {
+                std::vector<boost::uint32_t>::const_iterator p = 
+                    std::lower_bound( m_postings.begin() + runs[r].first,
+                                      m_postings.begin() + runs[r].second, lo );
+                if( p != m_postings.begin() + runs[r].second && id_of( *p ) == (boost::uint32_t) *t )
+                    score += num_of( *p );
+            }
+            if( score > 0 ) top.add( *t, score );
+        }
+        return top.sorted();
+    }
+    
+private:
+    // ids get 24 bits, counts 8:
+    static const int max_id = (1 << 24) - 1;
+    
+    static boost::uint32_t pack( int id, int num )
+    {
+        return ((boost::uint32_t) id << 8) | (boost::uint32_t)(num > 255 ? 255 : num);
+    }
+    static boost::uint32_t id_of( boost::uint32_t p ) { return p >> 8; }
+    static int num_of( boost::uint32_t p ) { return p & 0xFF; }
+    
+    /// postings of ngram are m_postings[begin, end)
+    bool find( const std::string& ngram, size_t& begin, size_t& end ) const
+    {
+        std::vector<std::string>::const_iterator g = 
+            std::lower_bound( m_grams.begin(), m_grams.end(), ngram );
+        if( g == m_grams.end() || *g != ngram ) return false;
+        size_t n = g - m_grams.begin();
+        begin = m_offsets[n];
+        end = m_offsets[n+1];
+        return begin < end;
+    }
+    
+    // position in one ngram's run of postings, while merging:
+    struct cursor
+    {
+        boost::uint32_t id;
+        size_t pos, end;
+        bool operator>( const cursor& o ) const { return id > o.id; }
+    };
+    
+    /// keeps the best "limit" (id, score)s added.
+    class top_scores
+    {
+    public:
+        top_scores( size_t limit ) : m_limit( limit ) {}
+        void add( int id, float score )
+        {
+            scorepair sp;
+            sp.id = id;
+            sp.score = score;
+            if( m_limit == 0 || m_heap.size() < m_limit )
+            {
+                m_heap.push_back( sp );
+                std::push_heap( m_heap.begin(), m_heap.end(), sortbyscore() );
+            }
+            else if( score > m_heap.front().score )
+            {
+                std::pop_heap( m_heap.begin(), m_heap.end(), sortbyscore() );
+                m_heap.back() = sp;
+                std::push_heap( m_heap.begin(), m_heap.end(), sortbyscore() );
+            }
+        }
+        std::vector<scorepair> sorted()
+        {
+            std::sort_heap( m_heap.begin(), m_heap.end(), sortbyscore() );
+            return m_heap;
+        }
+    private:
+        size_t m_limit;
+        std::vector<scorepair> m_heap; // lowest score at the front
+    };
+    
+    std::vector<std::string> m_grams;        // sorted
+    std::vector<size_t> m_offsets;           // into m_postings, per gram, plus the end
+    std::vector<boost::uint32_t> m_postings; // packed (id, count), sorted by id per gram
+    std::map< int, std::vector<int> > m_by_artist; // track ids by artist
+};
+
+}
+
+#endif
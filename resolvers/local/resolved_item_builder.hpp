@@ -35,27 +35,35 @@ public:
 
     static void createFromFid(Library& lib, int fid, json_spirit::Object& out)
     {
-        createFromFid( lib.db(), fid, out );
+        Library::reader r( lib );
+        createFromFid( r.stmts(), fid, out );
     }
     
-    static void createFromFid( sqlite3pp::database& db, int fid, Object& out)
+    static void createFromFid( utils::statement_cache& db, int fid, Object& out)
     {
         LibraryFile_ptr file( Library::file_from_fid(db, fid) );
-        
-        out.push_back( Pair("mimetype", file->mimetype) );
-        out.push_back( Pair("size", file->size) );
-        out.push_back( Pair("duration", file->duration) );
-        out.push_back( Pair("bitrate", file->bitrate) );
-        artist_ptr artobj = Library::load_artist( db, file->piartid);
-        track_ptr trkobj = Library::load_track( db, file->pitrkid);
-        out.push_back( Pair("artist", artobj->name()) );
-        out.push_back( Pair("track", trkobj->name()) );
-        // album metadata kinda optional for now
+        file->artist = Library::load_artist( db, file->piartid)->name();
+        file->track = Library::load_track( db, file->pitrkid)->name();
         if (file->pialbid) {
-            album_ptr albobj = Library::load_album(db, file->pialbid);
-            out.push_back( Pair("album", albobj->name()) );
+            file->album = Library::load_album(db, file->pialbid)->name();
+        }
+        createFromFile( *file, out );
+    }
+    
+    /// from a file that has its names, see Library::files_for_tracks
+    static void createFromFile( const LibraryFile& file, Object& out)
+    {
+        out.push_back( Pair("mimetype", file.mimetype) );
+        out.push_back( Pair("size", file.size) );
+        out.push_back( Pair("duration", file.duration) );
+        out.push_back( Pair("bitrate", file.bitrate) );
+        out.push_back( Pair("artist", file.artist) );
+        out.push_back( Pair("track", file.track) );
+        // album metadata kinda optional for now
+        if (file.pialbid) {
+            out.push_back( Pair("album", file.album) );
         }
-        out.push_back( Pair("url", file->url) );
+        out.push_back( Pair("url", file.url) );
     }
     
 };
@@ -18,8 +18,10 @@
 */
 #include "rs_local_library.h"
 #include <boost/foreach.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "library.h"
+#include "ngram_index.hpp"
 #include "playdar/utils/levenshtein.h"
 #include "resolved_item_builder.hpp"
 #include "playdar/resolver_query.hpp"
@@ -46,6 +48,7 @@ local::init(pa_ptr pap)
     m_library = new Library( m_pap->getstring( "database", default_db_path ).get_str());
 
     m_exiting = false;
+    m_last_modified = m_library->last_modified();
     log::info() << "Local library resolver: " << m_library->num_files() 
                 << " files indexed." << endl;
     if(m_library->num_files() == 0)
@@ -53,8 +56,23 @@ local::init(pa_ptr pap)
         log::info() << "WARNING! You don't have any files in your database!"
                     << "Run the scanner, then restart Playdar." << endl;
     }
-    // worker thread for doing actual resolving:
-    m_t = new boost::thread(boost::bind(&local::run, this));
+    else if(!m_library->sortnames_current())
+    {
+        log::warning() << "Library names were stored by an older version, some may"
+                          " not be found. Run the scanner to update them." << endl;
+    }
+    load_indexes();
+    // worker threads for doing actual resolving. each reads the db on
+    // its own connection, so they don't queue up behind each other:
+    int workers = m_pap->get<int>( "workers", 4 );
+    if( workers < 1 ) workers = 1;
+    for( int i = 0; i < workers; ++i )
+    {
+        m_workers.create_thread( boost::bind(&local::run, this) );
+    }
+    // queries answered from the result cache never reach us, so watch for
+    // library changes on a thread of our own rather than per query:
+    m_workers.create_thread( boost::bind(&local::watch_library, this) );
     
     return true;
 }
@@ -78,7 +96,7 @@ local::run()
             rq_ptr rq;
             {
                 boost::mutex::scoped_lock lk(m_mutex);
-                if(m_pending.size() == 0) m_cond.wait(lk);
+                while(m_pending.size() == 0 && !m_exiting) m_cond.wait(lk);
                 if(m_exiting) break;
                 rq = m_pending.back();
                 m_pending.pop_back();
@@ -95,10 +113,99 @@ local::run()
     }
 }
 
-// 
+/// thread that checks the library for changes every few seconds, and
+/// reloads the in-memory indexes when it has, so queries never wait for that.
+void
+local::watch_library()
+{
+    try
+    {
+        while(true)
+        {
+            {
+                boost::mutex::scoped_lock lk(m_mutex);
+                if(!m_exiting)
+                    m_watch_cond.timed_wait(lk, boost::posix_time::seconds(10));
+                if(m_exiting) break;
+            }
+            free_retired_indexes();
+            check_library_changed();
+        }
+    }
+    catch(...)
+    {
+        log::error() << "Local library watcher exiting on error" << endl;
+    }
+}
+
+/// if the scanner changed the library since we last looked, results
+/// the resolver has cached for recent queries may be wrong.
+void
+local::check_library_changed()
+{
+    int lm = m_library->last_modified();
+    if(lm != m_last_modified)
+    {
+        log::info() << "Local library changed, " << m_library->num_files() 
+                    << " files indexed." << endl;
+        m_last_modified = lm;
+        load_indexes();
+        m_pap->invalidate_result_cache();
+    }
+}
+
+/// loads the ngram indexes into memory, so find_candidates needn't query the db.
+void
+local::load_indexes()
+{
+    boost::shared_ptr<NgramIndex> artists( new NgramIndex );
+    boost::shared_ptr<NgramIndex> tracks( new NgramIndex );
+    if( !m_library->load_ngram_index( "artist", *artists ) ||
+        !m_library->load_ngram_index( "track", *tracks ) )
+    {
+        log::warning() << "Couldn't load ngram index into memory, "
+                       << "searching the database instead." << endl;
+        artists.reset();
+        tracks.reset();
+    }
+    else
+    {
+        log::info() << "Loaded ngram index: " 
+                    << artists->num_postings() + tracks->num_postings() 
+                    << " postings." << endl;
+    }
+    // searches underway keep using the old ones. they're freed here later,
+    // not by whichever search lets go of them last:
+    boost::mutex::scoped_lock lk(m_index_mutex);
+    if(m_artist_index) m_retired_indexes.push_back(m_artist_index);
+    if(m_track_index) m_retired_indexes.push_back(m_track_index);
+    m_artist_index = artists;
+    m_track_index = tracks;
+}
+
+/// frees replaced indexes once no search is using them.
+void
+local::free_retired_indexes()
+{
+    std::vector< boost::shared_ptr<const NgramIndex> > unused;
+    {
+        boost::mutex::scoped_lock lk(m_index_mutex);
+        std::vector< boost::shared_ptr<const NgramIndex> >::iterator it = m_retired_indexes.begin();
+        while(it != m_retired_indexes.end())
+        {
+            if(it->unique())
+            {
+                unused.push_back(*it);
+                it = m_retired_indexes.erase(it);
+            }
+            else ++it;
+        }
+    }
+    // unused goes out of scope, and frees them, without the lock held.
+}
 
 /// this is some what fugly atm, but gets the job done for now.
-/// it does the fuzzy library search using the ngram table from the db:
+/// it does the fuzzy library search using the ngram index:
 void
 local::process( rq_ptr rq )
 {
@@ -111,6 +218,9 @@ local::process( rq_ptr rq )
         return;
     }
     vector< json_spirit::Object > final_results;
+    using namespace boost::posix_time;
+    ptime started = microsec_clock::universal_time();
+    ptime searched = started;
     
     // check if this is a special "random" query
     if( rq->param("artist").get_str() == "*" &&
@@ -130,30 +240,49 @@ local::process( rq_ptr rq )
     {
         // get candidates (rough potential matches):
         vector<scorepair> candidates = find_candidates(rq, 10);
-        // now do the "real" scoring of candidate results:
-        string reason; // for scoring debug.
+        searched = microsec_clock::universal_time();
+        // multiple files in our collection may have matching metadata.
+        // fetch them all, for all candidates, in one go:
+        vector<int> tids;
+        tids.reserve(candidates.size());
         BOOST_FOREACH(scorepair &sp, candidates)
         {
-            // multiple files in our collection may have matching metadata.
-            // add them all to the results.
-            vector<int> fids = m_library->get_fids_for_tid(sp.id);
-            BOOST_FOREACH(int fid, fids)
-            {
-                json_spirit::Object js;
-                js.reserve(12);
-                ResolvedItemBuilder::createFromFid( *m_library, fid, js );
-                js.push_back( json_spirit::Pair( "sid", m_pap->gen_uuid()) );
-                js.push_back( json_spirit::Pair( "source", m_pap->hostname()) );
-                final_results.push_back( js );
-            }
+            tids.push_back(sp.id);
+        }
+        vector<LibraryFile> files = m_library->files_for_tracks(tids);
+        const string hostname( m_pap->hostname() );
+        final_results.reserve(files.size());
+        BOOST_FOREACH(const LibraryFile& f, files)
+        {
+            json_spirit::Object js;
+            js.reserve(12);
+            ResolvedItemBuilder::createFromFile( f, js );
+            js.push_back( json_spirit::Pair( "sid", m_pap->gen_uuid()) );
+            js.push_back( json_spirit::Pair( "source", hostname) );
+            final_results.push_back( js );
         }
     }
+    ptime fetched = microsec_clock::universal_time();
+    add_timing( (searched - started).total_microseconds(),
+                (fetched - searched).total_microseconds() );
     if(final_results.size())
     {
         m_pap->report_results( rq->id(), final_results );
     }
 }
 
+/// adds one query's time spent finding candidates, and fetching
+/// their files, to the totals shown on the stats page.
+void
+local::add_timing(long search_us, long fetch_us)
+{
+    boost::mutex::scoped_lock lk(m_timing_mutex);
+    m_timed_queries++;
+    m_search_us += search_us;
+    m_fetch_us += fetch_us;
+    m_query_latency.add( (unsigned int)((search_us + fetch_us) / 1000) );
+}
+
 /// Search library for candidates roughly matching the query.
 /// This works with track ids and associated metadata. It's possible
 /// that our library has many files for the same track id (ie, same metadata)
@@ -166,17 +295,32 @@ local::find_candidates(rq_ptr rq, unsigned int limit)
     vector<scorepair> candidates;
     float maxartscore = 0;
     
-    vector<scorepair> artistresults =
-        m_library->search_catalogue("artist", rq->param( "artist" ).get_str());
+    boost::shared_ptr<const NgramIndex> artist_index, track_index;
+    {
+        boost::mutex::scoped_lock lk(m_index_mutex);
+        artist_index = m_artist_index;
+        track_index = m_track_index;
+    }
+    const string& artist = rq->param( "artist" ).get_str();
+    const string& track = rq->param( "track" ).get_str();
+    // as Library::search_catalogue, which we do in memory if we can:
+    if(artist.length() < 3) return candidates;
+    map<string,int> trkgrams;
+    if(track_index) trkgrams = m_library->ngrams( track );
+    
+    vector<scorepair> artistresults = artist_index
+        ? artist_index->search( m_library->ngrams( artist ), 10 )
+        : m_library->search_catalogue("artist", artist);
     BOOST_FOREACH( scorepair & sp, artistresults )
     {
         if(maxartscore==0) maxartscore = sp.score;
         float artist_multiplier = (float)sp.score / maxartscore;
         float maxtrkscore = 0;
-        vector<scorepair> trackresults = 
-            m_library->search_catalogue_for_artist(sp.id, 
-                                                          "track",
-                                                          rq->param( "track" ).get_str());
+        vector<scorepair> trackresults;
+        if(!track_index)
+            trackresults = m_library->search_catalogue_for_artist(sp.id, "track", track);
+        else if(track.length() >= 3)
+            trackresults = track_index->search_for_artist(sp.id, trkgrams, 10);
         BOOST_FOREACH( scorepair & sptrk, trackresults )
         {
             if(maxtrkscore==0) maxtrkscore = sptrk.score;
@@ -269,6 +413,21 @@ local::anon_http_handler(const playdar_request& req, playdar_response& resp, pla
                            << "<tr><td>Albums</td><td>" << m_library->num_albums() << "</td></tr>\n" 
                            << "<tr><td>Tracks</td><td>" << m_library->num_tracks() << "</td></tr>\n" 
                << "</table>";
+       {
+           boost::mutex::scoped_lock lk(m_timing_mutex);
+           if(m_timed_queries)
+           {
+               reply << "<h3>Query Timing</h3>"
+                     << "<table>"
+                     << "<tr><td>Queries</td><td>" << m_timed_queries << "</td></tr>\n"
+                     << "<tr><td>Mean candidate search</td><td>" << (long)(m_search_us / m_timed_queries) << "us</td></tr>\n"
+                     << "<tr><td>Mean file fetch</td><td>" << (long)(m_fetch_us / m_timed_queries) << "us</td></tr>\n"
+                     << "<tr><td>Total, 50th / 95th percentile</td><td>" 
+                     << m_query_latency.percentile(50) << "ms / " 
+                     << m_query_latency.percentile(95) << "ms</td></tr>\n"
+                     << "</table>";
+           }
+       }
        resp = reply.str();
        return true;
    }
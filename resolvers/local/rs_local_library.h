@@ -24,19 +24,22 @@
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/shared_ptr.hpp>
 
 // All resolver plugins should include this header: 
 #include "playdar/playdar_plugin_include.h"
+#include "playdar/latency_histogram.hpp"
 
 namespace playdar {
     class Library;
+    class NgramIndex;
 namespace resolvers {
 
 
 class local : public ResolverPlugin<local>
 {
 public:
-    local(){}
+    local() : m_timed_queries(0), m_search_us(0), m_fetch_us(0) {}
     bool init(pa_ptr pap);
     void start_resolving(rq_ptr rq);
     void run();
@@ -69,9 +72,13 @@ protected:
 
     ~local() throw() 
     {
-        m_exiting = true;
+        {
+            boost::mutex::scoped_lock lk(m_mutex);
+            m_exiting = true;
+        }
         m_cond.notify_all();
-        m_t->join();
+        m_watch_cond.notify_all();
+        m_workers.join_all();
     };
     
 private:
@@ -82,11 +89,32 @@ private:
 
     std::deque<rq_ptr> m_pending;
 
-    boost::thread* m_t;
+    boost::thread_group m_workers; // "workers" in config, default 4
     boost::mutex m_mutex;
     boost::condition m_cond;
 
     std::vector<scorepair> find_candidates(rq_ptr rq, unsigned int limit = 0);
+    
+    // in-memory copies of the artist and track ngram indexes, null if
+    // they couldn't be loaded (then we search the db). replaced, not
+    // modified, when the library changes:
+    void load_indexes();
+    void free_retired_indexes();
+    boost::shared_ptr<const NgramIndex> m_artist_index, m_track_index;
+    std::vector< boost::shared_ptr<const NgramIndex> > m_retired_indexes;
+    boost::mutex m_index_mutex;
+
+    void watch_library();
+    void check_library_changed();
+    boost::condition m_watch_cond;
+    int m_last_modified;
+
+    // time spent in process(), for the stats page:
+    void add_timing(long search_us, long fetch_us);
+    boost::mutex m_timing_mutex;
+    unsigned long m_timed_queries;
+    double m_search_us, m_fetch_us;
+    LatencyHistogram m_query_latency;
 
 };
 
@@ -1,18 +1,34 @@
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
+#include <taglib/id3v2framefactory.h>
 
 #include <boost/foreach.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <sqlite3.h>
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
 #include "../library.h"
 
 #include "playdar/utils/urlencoding.hpp"
 
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <set>
 
 using namespace std;
 using namespace boost;
@@ -42,13 +58,111 @@ typedef bfs::directory_iterator DirIt;
 #endif
 
 
-bool add_file(const Path&, int mtime);
+/*
+    The scan is a pipeline, so slow disks (eg: network mounts) don't
+    leave the cpu idle, nor tag reading hold up the walk:
+
+    - the directory walk, on the main thread, queues audio files that
+      are new or changed since the last scan (by mtime),
+    - a pool of reader threads reads their tags with TagLib,
+    - one writer thread adds them to the library, and reports progress.
+
+    The queues are bounded, so a fast walk can't run far ahead.
+*/
+
+/// a blocking queue of bounded size. close() it when there's no more
+/// to come; pop() then returns false once it's empty.
+template <typename T>
+class work_queue
+{
+public:
+    explicit work_queue(size_t maxsize)
+        : m_maxsize(maxsize), m_closed(false)
+    {}
+
+    void push(const T& t)
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        while(m_q.size() >= m_maxsize) m_notfull.wait(lk);
+        m_q.push_back(t);
+        m_notempty.notify_one();
+    }
+
+    bool pop(T& t)
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        while(m_q.empty() && !m_closed) m_notempty.wait(lk);
+        if(m_q.empty()) return false;
+        t = m_q.front();
+        m_q.pop_front();
+        m_notfull.notify_one();
+        return true;
+    }
+
+    /// takes everything queued, waiting for at least one.
+    bool pop_all(std::deque<T>& out)
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        while(m_q.empty() && !m_closed) m_notempty.wait(lk);
+        if(m_q.empty()) return false;
+        out.swap(m_q);
+        m_q.clear();
+        m_notfull.notify_all();
+        return true;
+    }
+
+    void close()
+    {
+        boost::mutex::scoped_lock lk(m_mut);
+        m_closed = true;
+        m_notempty.notify_all();
+    }
+
+private:
+    std::deque<T> m_q;
+    size_t m_maxsize;
+    bool m_closed;
+    boost::mutex m_mut;
+    boost::condition m_notempty, m_notfull;
+};
+
+// an audio file the walk found new or changed:
+struct found_file
+{
+    Path path;
+    int mtime;
+};
+
+// what a reader made of it:
+struct tagged_file
+{
+    bool ok; // false if unreadable or missing tags
+    string url, display;
+    int mtime, size, duration, bitrate, tracknum;
+    string mimetype, artist, album, track;
+};
+
+bool read_file(const found_file&, tagged_file&);
+bool add_tagged(const tagged_file&);
+void reader_thread();
+void writer_thread();
 bool add_dir(const Path&);
+bool is_audio(const Path&);
+bool watch(const Path&, map<string, int>& mtimes);
 string ext2mime(const string& ext);
 
 Library *gLibrary;
 
-int scanned, skipped, ignored = 0;
+work_queue<found_file> gFound(1000);
+work_queue<tagged_file> gTagged(1000);
+bool gWriteFailed = false;
+boost::mutex gOutMut; // for cout, used by the walk and the writer
+
+int skipped = 0, ignored = 0; // counted by the walk
+int scanned = 0, unreadable = 0; // counted by the writer
+// url -> mtime of files we couldn't tag, so --watch doesn't read them
+// again until they change. written by the writer, then by the watcher:
+map<string, int> gUntaggable;
 
 
 // replace whitespace and other control codes with ' ' and replace multiple whitespace with single
@@ -96,6 +210,17 @@ string urlify(const string& p)
     return urlpath;
 }
 
+// is this file an audio file we understand?
+bool is_audio(const Path& p)
+{
+    string extu(toUtf8(bfs::extension(p)));
+    string ext = to_lower_copy(extu);
+    return  ext == ".mp3" ||
+            ext == ".m4a" || 
+            ext == ".mp4" ||  
+            ext == ".aac";
+}
+
 bool scan(const Path& p, map<string, int>& mtimes)
 {
     try
@@ -106,30 +231,31 @@ bool scan(const Path& p, map<string, int>& mtimes)
         DirIt end_itr;
         for(DirIt itr( p ); itr != end_itr; ++itr){
             if ( bfs::is_directory( itr->status() ) ){
-                cout << "DIR:\t" << toUtf8(itr->path().string()) << endl;
+                {
+                    boost::mutex::scoped_lock lk(gOutMut);
+                    cout << "DIR:\t" << toUtf8(itr->path().string()) << endl;
+                }
                 scan(itr->path(), mtimes);
             } else {
-                // is this file an audio file we understand?
-                string extu(toUtf8(bfs::extension(itr->path())));
-                string ext = to_lower_copy(extu);
-                if( ext == ".mp3" ||
-                    ext == ".m4a" || 
-                    ext == ".mp4" ||  
-                    ext == ".aac" )
+                if( is_audio(itr->path()) )
                 {
                     string url = urlify( toUtf8(itr->string()) );
                     int mtime = bfs::last_write_time(itr->path());
 
                     map<string, int>::iterator mtimeit = mtimes.find(url);
                     if (mtimeit == mtimes.end() // not scanned previously
-                        || mtimes[url] != mtime) // modified since last time
+                        || mtimeit->second != mtime) // modified since last time
                     {
-                        add_file(itr->path(), mtime);
+                        found_file ff;
+                        ff.path = itr->path();
+                        ff.mtime = mtime;
+                        gFound.push(ff);
                     } else {
-                        ignored++;
+                        skipped++;
                     }
                 } else {
                     ignored++;
+                    boost::mutex::scoped_lock lk(gOutMut);
                     cout << "Ignoring: " << itr->string() << endl;
                 }
             }
@@ -160,66 +286,433 @@ bool add_dir(const Path &p)
     return false;
 }
 
-bool add_file(const Path& p, int mtime)
+// runs on a reader thread, so only touches the file and ff/out:
+bool read_file(const found_file& ff, tagged_file& out)
 {
+    const Path& p = ff.path;
+    out.ok = false;
+    out.display = toUtf8(p.string());
+    // turn it into a url by prepending file://
+    // because we pass all urls to curl:
+    out.url = urlify( toUtf8(p.string()) );
+    out.mtime = ff.mtime;
     TagLib::FileRef f(p.string().c_str());
     if (!f.isNull() && f.tag()) {
         TagLib::Tag *tag = f.tag();
-        int filesize = bfs::file_size(p);
-        int bitrate = 0;
-        int duration = 0;
+        out.size = bfs::file_size(p);
+        out.bitrate = 0;
+        out.duration = 0;
         if (f.audioProperties()) {
             TagLib::AudioProperties *properties = f.audioProperties();
-            duration = properties->length();
-            bitrate = properties->bitrate();
+            out.duration = properties->length();
+            out.bitrate = properties->bitrate();
         }
-        string artist = tag->artist().toCString(true);
-        string album  = tag->album().toCString(true);
-        string track  = tag->title().toCString(true);
-        boost::trim(artist);
-        boost::trim(album);
-        boost::trim(track);
-        if (artist.length()==0 || track.length()==0) {
-            cout << "NOTAGS:\t" << toUtf8(p.string()) << endl;
-            ignored++;
+        out.artist = tag->artist().toCString(true);
+        out.album  = tag->album().toCString(true);
+        out.track  = tag->title().toCString(true);
+        out.tracknum = tag->track();
+        boost::trim(out.artist);
+        boost::trim(out.album);
+        boost::trim(out.track);
+        if (out.artist.length()==0 || out.track.length()==0) {
+            out.display = "NOTAGS:\t" + out.display;
             return false;
         }
 
         string ext(toUtf8(bfs::extension(p)));
-        string mimetype = ext2mime(to_lower_copy(ext));
-        
-        // turn it into a url by prepending file://
-        // because we pass all urls to curl:
-        string urlpath = urlify( toUtf8(p.string()) );
-        
-        gLibrary->add_file( urlpath, 
-                            mtime, 
-                            filesize, 
-                            string(""), //TODO file hash?
-                            mimetype,
-                            duration,
-                            bitrate,
-                            artist, 
-                            album, 
-                            track, 
-                            tag->track() );
-
-        // fixspaces ensures the field separation doesn't get messed up
-        // this output is all for display purposes, so munged control-codes are ok
-        cout << "TRACK:\t" 
-             << fixspaces(artist) << "\t" 
-             << fixspaces(album)  << "\t" 
-             << fixspaces(track)  << "\t"
-             << fixspaces(toUtf8(p.string())) << endl;
-
-        scanned++;
+        out.mimetype = ext2mime(to_lower_copy(ext));
+        out.ok = true;
         return true;
-    } else {
-        ignored++;
+    }
+    out.display.clear(); // not worth mentioning
+    return false;
+}
+
+void reader_thread()
+{
+    found_file ff;
+    while(gFound.pop(ff))
+    {
+        tagged_file tf;
+        try
+        {
+            read_file(ff, tf);
+        }
+        catch(const std::exception& e)
+        {
+            tf.ok = false;
+            tf.display = "FAILED:\t" + tf.display + " " + e.what();
+        }
+        gTagged.push(tf);
+    }
+}
+
+// adds what read_file found to the library, or says why not:
+bool add_tagged(const tagged_file& tf)
+{
+    if(!tf.ok)
+    {
+        if(tf.url.length()) gUntaggable[tf.url] = tf.mtime;
+        boost::mutex::scoped_lock lk(gOutMut);
+        if(tf.display.length()) cout << tf.display << endl;
+        unreadable++;
         return false;
     }
+    gUntaggable.erase(tf.url);
+    gLibrary->add_file( tf.url, 
+                        tf.mtime, 
+                        tf.size, 
+                        string(""), //TODO file hash?
+                        tf.mimetype,
+                        tf.duration,
+                        tf.bitrate,
+                        tf.artist, 
+                        tf.album, 
+                        tf.track, 
+                        tf.tracknum );
+
+    // fixspaces ensures the field separation doesn't get messed up
+    // this output is all for display purposes, so munged control-codes are ok
+    boost::mutex::scoped_lock lk(gOutMut);
+    cout << "TRACK:\t" 
+         << fixspaces(tf.artist) << "\t" 
+         << fixspaces(tf.album)  << "\t" 
+         << fixspaces(tf.track)  << "\t"
+         << fixspaces(tf.display) << endl;
+    scanned++;
+    return true;
+}
+
+// the only thread that writes to the library, taking whatever the
+// readers have done so far:
+void writer_thread()
+{
+    using namespace boost::posix_time;
+    const ptime start = microsec_clock::universal_time();
+    ptime lastreport = start;
+    int done = 0;
+    std::deque<tagged_file> batch;
+    try
+    {
+        while(gTagged.pop_all(batch))
+        {
+            BOOST_FOREACH(const tagged_file& tf, batch)
+            {
+                done++;
+                add_tagged(tf);
+            }
+            batch.clear();
+            ptime now = microsec_clock::universal_time();
+            if((now - lastreport).total_seconds() >= 5)
+            {
+                lastreport = now;
+                boost::mutex::scoped_lock lk(gOutMut);
+                double secs = (now - start).total_milliseconds() / 1000.0;
+                cout << "PROGRESS:\t" << done << " files read, " 
+                     << (int)(done / secs) << " files/sec" << endl;
+            }
+        }
+    }
+    catch(...)
+    {
+        cerr << "Failed adding files to the library" << endl;
+        gWriteFailed = true;
+        // keep draining, so the readers don't block:
+        while(gTagged.pop_all(batch)) batch.clear();
+    }
+    double secs = (microsec_clock::universal_time() - start).total_milliseconds() / 1000.0;
+    if(done && secs > 0)
+    {
+        boost::mutex::scoped_lock lk(gOutMut);
+        cout << "Read " << done << " files in " << secs << "s, " 
+             << (int)(done / secs) << " files/sec" << endl;
+    }
+}
+
+#ifdef __linux__
+
+/*
+    --watch: after the scan, keep the library up to date with inotify.
+    Changes are applied in batches, once things have been quiet for a
+    couple of seconds: files are added/removed, only new names are
+    indexed, and last_modified is bumped so a running local resolver
+    reloads its index within seconds.
+*/
+
+class watcher
+{
+public:
+    watcher(const Path& root, map<string, int>& mtimes)
+        : m_root(root), m_mtimes(mtimes), m_fd(-1)
+    {}
+
+    ~watcher()
+    {
+        if(m_fd >= 0) close(m_fd);
+    }
+
+    bool run()
+    {
+        m_fd = inotify_init();
+        if(m_fd < 0)
+        {
+            cerr << "inotify_init failed" << endl;
+            return false;
+        }
+        sync_dir(m_root);
+        apply(); // anything changed since the scan
+        cout << "Watching " << m_watches.size() << " directories for changes..." << endl;
+        time_t firstpending = 0;
+        std::vector<char> buf(64 * 1024);
+        while(true)
+        {
+            struct pollfd pfd;
+            pfd.fd = m_fd;
+            pfd.events = POLLIN;
+            int r = poll(&pfd, 1, 2000);
+            if(r < 0 && errno != EINTR) return false;
+            if(r > 0)
+            {
+                ssize_t len = read(m_fd, &buf[0], buf.size());
+                if(len < 0 && errno != EINTR) return false;
+                for(ssize_t i = 0; i < len; )
+                {
+                    const struct inotify_event* ev = 
+                        reinterpret_cast<const struct inotify_event*>(&buf[i]);
+                    handle(ev);
+                    i += sizeof(struct inotify_event) + ev->len;
+                }
+                if(!firstpending && pending()) firstpending = time(0);
+            }
+            // apply once quiet, or every 10s during a long copy:
+            if(pending() && (r == 0 || time(0) - firstpending >= 10))
+            {
+                apply();
+                firstpending = 0;
+            }
+        }
+    }
+
+private:
+    static const uint32_t dir_mask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE |
+                                     IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF;
+
+    bool pending() const
+    {
+        return !m_add.empty() || !m_remove.empty() || !m_removedirs.empty();
+    }
+
+    void handle(const struct inotify_event* ev)
+    {
+        if(ev->mask & IN_Q_OVERFLOW)
+        {
+            cout << "Missed some changes, checking everything." << endl;
+            sync_dir(m_root);
+            return;
+        }
+        if(ev->mask & IN_IGNORED)
+        {
+            m_watches.erase(ev->wd);
+            return;
+        }
+        if(ev->mask & IN_MOVE_SELF)
+        {
+            // the dir went somewhere else, so the path we have is wrong.
+            // if it's still under m_root, IN_MOVED_TO watches it again:
+            map<int, Path>::iterator self = m_watches.find(ev->wd);
+            if(self != m_watches.end()) unwatch_under(self->second);
+            return;
+        }
+        map<int, Path>::const_iterator it = m_watches.find(ev->wd);
+        if(it == m_watches.end() || !ev->len) return;
+        Path p = it->second / string(ev->name);
+        string url = urlify(p.string());
+        if(ev->mask & IN_ISDIR)
+        {
+            if(ev->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                m_removedirs.erase(url + "/");
+                sync_dir(p);
+            }
+            else if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                if(ev->mask & IN_MOVED_FROM) unwatch_under(p);
+                forget_under(url + "/");
+                m_removedirs.insert(url + "/");
+            }
+            return;
+        }
+        if(!is_audio(p)) return;
+        // a new file is ready when closed, not when created:
+        if(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+        {
+            m_remove.erase(url);
+            m_add[url] = p;
+        }
+        else if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            m_add.erase(url);
+            m_remove.insert(url);
+            gUntaggable.erase(url);
+        }
+    }
+
+    /// stops watching dir and the dirs under it.
+    void unwatch_under(const Path& dir)
+    {
+        const string d = dir.string();
+        map<int, Path>::iterator it = m_watches.begin();
+        while(it != m_watches.end())
+        {
+            const string w = it->second.string();
+            if(w == d || (w.length() > d.length() && 
+                          w.compare(0, d.length(), d) == 0 && w[d.length()] == '/'))
+            {
+                inotify_rm_watch(m_fd, it->first);
+                m_watches.erase(it++);
+            }
+            else ++it;
+        }
+    }
+
+    /// watches dir and everything under it, and queues any audio files
+    /// that are new or changed, or gone, since we last looked.
+    void sync_dir(const Path& dir)
+    {
+        string prefix = urlify(dir.string()) + "/";
+        set<string> seen;
+        walk(dir, seen);
+        for(map<string, int>::const_iterator it = m_mtimes.lower_bound(prefix);
+            it != m_mtimes.end() && it->first.compare(0, prefix.length(), prefix) == 0;
+            ++it)
+        {
+            if(!seen.count(it->first) && !m_add.count(it->first)) m_remove.insert(it->first);
+        }
+    }
+
+    void walk(const Path& dir, set<string>& seen)
+    {
+        try
+        {
+            int wd = inotify_add_watch(m_fd, dir.string().c_str(), dir_mask);
+            if(wd >= 0) m_watches[wd] = dir;
+            DirIt end_itr;
+            for(DirIt itr( dir ); itr != end_itr; ++itr)
+            {
+                if(bfs::is_directory(itr->status()))
+                {
+                    walk(itr->path(), seen);
+                }
+                else if(is_audio(itr->path()))
+                {
+                    string url = urlify(itr->path().string());
+                    seen.insert(url);
+                    int mtime = bfs::last_write_time(itr->path());
+                    map<string, int>::const_iterator mt = m_mtimes.find(url);
+                    map<string, int>::const_iterator ut = gUntaggable.find(url);
+                    if((mt == m_mtimes.end() || mt->second != mtime) &&
+                       (ut == gUntaggable.end() || ut->second != mtime))
+                    {
+                        m_remove.erase(url);
+                        m_add[url] = itr->path();
+                    }
+                }
+            }
+        }
+        catch(std::exception const& e)
+        { 
+            cerr << e.what() << endl;
+        }
+    }
+
+    // drops queued additions under a directory that went away:
+    void forget_under(const string& prefix)
+    {
+        map<string, Path>::iterator it = m_add.lower_bound(prefix);
+        while(it != m_add.end() && it->first.compare(0, prefix.length(), prefix) == 0)
+            m_add.erase(it++);
+    }
+
+    void apply()
+    {
+        if(!pending()) return;
+        int changed = 0;
+        sqlite3pp::transaction xct(gLibrary->db());
+        BOOST_FOREACH(const string& prefix, m_removedirs)
+        {
+            map<string, int>::iterator it = m_mtimes.lower_bound(prefix);
+            while(it != m_mtimes.end() && it->first.compare(0, prefix.length(), prefix) == 0)
+            {
+                if(gLibrary->remove_file(it->first)) changed++;
+                m_mtimes.erase(it++);
+            }
+            it = gUntaggable.lower_bound(prefix);
+            while(it != gUntaggable.end() && it->first.compare(0, prefix.length(), prefix) == 0)
+                gUntaggable.erase(it++);
+        }
+        BOOST_FOREACH(const string& url, m_remove)
+        {
+            if(!m_mtimes.erase(url)) continue;
+            if(gLibrary->remove_file(url)) changed++;
+            boost::mutex::scoped_lock lk(gOutMut);
+            cout << "REMOVED:\t" << fixspaces(url) << endl;
+        }
+        for(map<string, Path>::const_iterator it = m_add.begin(); it != m_add.end(); ++it)
+        {
+            found_file ff;
+            ff.path = it->second;
+            tagged_file tf;
+            try
+            {
+                ff.mtime = bfs::last_write_time(ff.path);
+                read_file(ff, tf);
+            }
+            catch(std::exception const&)
+            {
+                continue; // gone again already
+            }
+            m_mtimes[it->first] = ff.mtime;
+            if(add_tagged(tf)) changed++;
+        }
+        m_add.clear();
+        m_remove.clear();
+        m_removedirs.clear();
+        if(changed)
+        {
+            gLibrary->update_index("artist");
+            gLibrary->update_index("album");
+            gLibrary->update_index("track");
+            gLibrary->set_last_modified(time(0));
+        }
+        xct.commit();
+    }
+
+    Path m_root;
+    map<string, int>& m_mtimes;
+    int m_fd;
+    map<int, Path> m_watches; // watch descriptor -> dir
+    // changes not applied yet, by url:
+    map<string, Path> m_add;
+    set<string> m_remove;
+    set<string> m_removedirs; // url prefixes
+};
+
+bool watch(const Path& dir, map<string, int>& mtimes)
+{
+    watcher w(dir, mtimes);
+    return w.run();
+}
+
+#else
+
+bool watch(const Path&, map<string, int>&)
+{
+    cerr << "Watching for changes needs inotify, which this platform doesn't have." << endl;
+    return false;
 }
 
+#endif
+
 string ext2mime(const string& ext)
 { 
     if(ext==".mp3") return "audio/mpeg";
@@ -237,12 +730,29 @@ int wmain(int argc, wchar_t* argv[])
 int main(int argc, char* argv[])
 #endif
 {
+    // --watch: keep running, and apply changes as they happen
+    bool watching = false;
+    if (argc>3 && string(toUtf8(argv[argc-1])) == "--watch") {
+        watching = true;
+        argc--;
+    }
     if (argc<3 || argc==1) {
-        cerr<<"Usage: "<< toUtf8(argv[0]) << " <collection.db> <scan_dir>"<<endl;
+        cerr<<"Usage: "<< toUtf8(argv[0]) << " <collection.db> <scan_dir> [reader_threads] [--watch]"<<endl;
         return 1;
     }
+    // tag reading is mostly waiting on the disk, so more threads than
+    // cores can help, particularly on network mounts:
+    int numreaders = 4;
+    if (argc>3) numreaders = atoi(string(toUtf8(argv[3])).c_str());
+    if (numreaders<1) numreaders = 1;
     try {
         gLibrary = new Library(toUtf8(argv[1]));
+        // names stored by an older version are redone here rather than
+        // when playdar starts, which would hold it up for a big library:
+        if (!gLibrary->sortnames_current()) {
+            cout << "Updating names for the new normalization..." << endl;
+            gLibrary->update_sortnames();
+        }
 
         // get last scan date:
         cout << "Loading data from last scan..." << flush;
@@ -253,28 +763,47 @@ int main(int argc, char* argv[])
         sqlite3pp::transaction xct(gLibrary->db());
         {
             // first scan for mp3/aac/etc files:
+            // (TagLib makes this singleton lazily, make sure it's
+            //  made before the readers race to it)
+            TagLib::ID3v2::FrameFactory::instance();
+            boost::thread_group readers;
+            for (int i = 0; i < numreaders; i++)
+                readers.create_thread(&reader_thread);
+            boost::thread writer(&writer_thread);
+            bool walked = true;
             try
             {
                 scan(dir, mtimes);
-                cout << "Scan complete ok." << endl;
             }
             catch(...)
+            {
+                walked = false;
+            }
+            gFound.close();
+            readers.join_all();
+            gTagged.close();
+            writer.join();
+            if (!walked || gWriteFailed)
             {
                 cerr << "Scan failed." << endl;
                 xct.rollback();
                 return 1;
             }
+            cout << "Scan complete ok." << endl;
             // now create fuzzy text index:
             try
             {
                 cout << endl << "Building search indexes..." << endl;
-                gLibrary->build_index("artist");
-                gLibrary->build_index("album");
-                gLibrary->build_index("track");
+                // only names new in this scan need indexing:
+                gLibrary->update_index("artist");
+                gLibrary->update_index("album");
+                gLibrary->update_index("track");
+                // tells a running local resolver that cached results are stale:
+                if(scanned) gLibrary->set_last_modified(time(0));
                 xct.commit();
                 cout << "Finished,   scanned: " << scanned 
                     << " skipped: " << skipped 
-                    << " ignored: " << ignored 
+                    << " ignored: " << ignored + unreadable 
                     << endl;
             }
             catch(...)
@@ -284,6 +813,14 @@ int main(int argc, char* argv[])
                 return 1;
             }
         }
+        if (watching) {
+            // now including what the scan added:
+            mtimes = gLibrary->file_mtimes();
+            if (!watch(dir, mtimes)) {   // returns only if it fails
+                delete gLibrary;
+                return 1;
+            }
+        }
         delete gLibrary; 
     } catch (const std::exception& e) {
         cerr << "failed: " << e.what();
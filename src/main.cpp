@@ -104,6 +104,9 @@ void start_http_server(string ip, int port, int conc, MyApplication* app)
     if(conc<1) conc=1;
     log::info() << "HTTP server starting on: http://" << ip << ":" << port << "/" << " with " << conc << " threads" << endl;
     moost::http::server<playdar_request_handler> s(ip, port, conc);
+    s.set_keepalive( app->conf()->get<int>("http_keepalive_timeout", 15),
+                     app->conf()->get<int>("http_keepalive_max", 100) );
+    s.set_read_timeout( app->conf()->get<int>("http_read_timeout", 30) );
     s.request_handler().init(app);
     // tell app how to stop the http server:
     app->set_http_stopper( 
@@ -19,6 +19,8 @@
 #include "playdar/playdar_request.h"
 #include "playdar/utils/urlencoding.hpp"
 #include <boost/tokenizer.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
 #include <moost/http.hpp>
 
@@ -48,6 +50,7 @@ playdar_request::playdar_request( const moost::http::request& req )
     collect_parts( m_url, m_parts );
     
     m_useragent = req.header_value("User-Agent");
+    m_range = req.header_value("Range");
     
     // get rid of cruft from leading/trailing "/" and split:
     if(m_parts.size() && m_parts[0]=="") m_parts.erase(m_parts.begin());
@@ -70,6 +73,38 @@ playdar_request::collect_parts( const std::string & url, std::vector<std::string
 }
 
 
+/// suffix ranges ("bytes=-500") and multiple ranges aren't handled,
+/// the caller sends the whole thing instead, which the client must accept.
+bool
+playdar_request::byte_range( long long& offset, long long& length ) const
+{
+    std::string r = boost::trim_copy( m_range );
+    if( !boost::istarts_with( r, "bytes=" ) ) return false;
+    r = r.substr( 6 );
+    if( r.find(',') != std::string::npos ) return false;
+
+    size_t dash = r.find('-');
+    if( dash == 0 || dash == std::string::npos ) return false;
+    try
+    {
+        offset = boost::lexical_cast<long long>( boost::trim_copy( r.substr(0, dash) ) );
+        std::string last = boost::trim_copy( r.substr(dash + 1) );
+        if( last.empty() )
+        {
+            length = -1;
+            return true;
+        }
+        long long l = boost::lexical_cast<long long>( last );
+        if( l < offset ) return false;
+        length = l - offset + 1;
+        return true;
+    }
+    catch( boost::bad_lexical_cast& )
+    {
+        return false;
+    }
+}
+
 /// parse a querystring or form post body into a variables map
 int
 playdar_request::collect_params(const std::string & url, std::map<std::string,std::string> & vars)
@@ -259,6 +259,7 @@ playdar_request_handler::handle_root( const playdar_request& req,
            "<td>Weight</td>"
            "<td>Preference</td>"
            "<td>Target Time</td>"
+           "<td>Observed p50/p95</td>"
            "<td>Scope</td>"
            "<td>Configuration</td>"
            "</tr>"
@@ -278,6 +279,11 @@ playdar_request_handler::handle_root( const playdar_request& req,
             "<td>" << pap->weight() << "</td>"
             "<td>" << pap->preference() << "</td>"
             "<td>" << pap->targettime() << "ms</td>"
+            "<td>";
+        if(pap->latency().count())
+            os << pap->latency().percentile(50) << "ms / " 
+               << pap->latency().percentile(95) << "ms";
+        os  << "</td>"
             "<td>" << (pap->localonly()?"local":"global") << "</td>"
             "<td>";
         string name = pap->rs()->name();
@@ -466,8 +472,14 @@ playdar_request_handler::handle_queries_root(const playdar_request& req)
     app()->resolver()->qids(queries);
 
     ostringstream os;
-    os  << "<h2>Current Queries (" << queries.size() << ")</h2>"
-        "<table>"
+    os  << "<h2>Current Queries (" << queries.size() << ")</h2>";
+    if(const ResultCache * rc = app()->resolver()->result_cache())
+    {
+        os  << "<p>Result cache: " << rc->size() << "/" << rc->max_entries() 
+            << " entries, " << rc->hits() << " hits, " 
+            << rc->misses() << " misses</p>";
+    }
+    os  << "<table>"
         "<tr style=\"font-weight:bold;\">"
         "<td>QID</td>"
         "<td>Options</td>"
@@ -617,7 +629,11 @@ playdar_request_handler::handle_sid( const playdar_request& req,
     }
     
     source_uid sid = req.parts()[1];
-    serve_sid( rep, sid);
+    long long offset, length;
+    if( req.byte_range( offset, length ) )
+        serve_sid( rep, sid, offset, length );
+    else
+        serve_sid( rep, sid );
 }
 
 /// quick hack method for playing a song, if it can be found:
@@ -693,8 +709,10 @@ playdar_request_handler::serve_static_file(const moost::http::request& req, moos
 
 // Serves the music file based on a SID 
 // (from a playableitem resulting from a query)
+// or just part of it, if asked for a byte range and the SS can seek.
 void
-playdar_request_handler::serve_sid( moost::http::reply& rep, source_uid sid)
+playdar_request_handler::serve_sid( moost::http::reply& rep, source_uid sid,
+                                    long long offset, long long length )
 {
     log::info() << "Serving SID " << sid << endl;
     ss_ptr ss = app()->resolver()->get_ss(sid);
@@ -706,6 +724,9 @@ playdar_request_handler::serve_sid( moost::http::reply& rep, source_uid sid)
     }
     log::info() << "-> " << ss->debug() << endl;
 
+    if( offset >= 0 && ss->set_range( offset, length ) )
+        log::info() << "-> range from " << offset << ", length " << length << endl;
+
     boost::shared_ptr<HttpAsyncAdaptor> hp(new HttpAsyncAdaptor(rep.shared_from_this()));
     ss->start_reply(hp);
 }
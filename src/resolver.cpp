@@ -31,12 +31,15 @@
 
 #include "playdar/resolver.h"
 #include "playdar/ss_curl.hpp"
+#include "playdar/ss_localfile.hpp"
 #include "playdar/rs_script.h"
 #include "playdar/logger.h"
 
 // Generic track calculation stuff:
 #include "playdar/track_rq_builder.hpp"
-#include "playdar/utils/levenshtein.h"
+#include "playdar/scorer_editdistance.hpp"
+#include "playdar/scorer_token.hpp"
+#include "playdar/utils/normalize.hpp"
 #include "playdar/pluginadaptor_impl.hpp"
 
 // PDL stuff:
@@ -54,12 +57,22 @@ using namespace resolvers;
 using namespace std;
 
 Resolver::Resolver(MyApplication * app)
-    :m_app(app), m_exiting(false)
+    :m_app(app),
+     // one turn of the wheel spans the longest a qid waits, see dispatch:
+     m_expiry_wheel( (max_query_lifetime()+300) / expiry_granularity() + 1 ),
+     m_result_cache(0), m_cache_coalesce(false), m_scorer(0)
 {
     m_id_counter = 0;
     log::info() << "Resolver starting..." << endl;
     
-    m_t = new boost::thread(boost::bind(&Resolver::dispatch_runner, this));
+    // pool of threads that run the pipeline for dispatched queries, so one
+    // slow start_resolving() doesn't hold up every other query:
+    int nthreads = m_app->conf()->get<int>("dispatch_threads", 
+                        boost::thread::hardware_concurrency());
+    if(nthreads < 1) nthreads = 1;
+    log::info() << "Resolver using " << nthreads << " dispatch threads" << endl;
+    m_dispatch_pool.start(nthreads,
+        boost::bind(&Resolver::dispatch_runner, this, _1));
     
     // set up io_service with work so it never ends:
     m_io_service = new boost::asio::io_service();
@@ -67,6 +80,64 @@ Resolver::Resolver(MyApplication * app)
     m_iothr = new boost::thread(boost::bind(
                     &boost::asio::io_service::run,
                     m_io_service));
+
+    // query callbacks (comet sessions, http pollers, coalesced queries) are
+    // fired on threads of their own, so a slow one can't hold up resolvers
+    // reporting results, or the pipeline timers above:
+    int cbthreads = m_app->conf()->get<int>("callback_threads", 2);
+    if(cbthreads < 1) cbthreads = 1;
+    m_cb_io_service = new boost::asio::io_service();
+    m_cb_work = new boost::asio::io_service::work(*m_cb_io_service);
+    for(int i = 0; i < cbthreads; i++)
+    {
+        m_cb_threads.create_thread(
+            boost::bind(&Resolver::callback_runner, this));
+    }
+    
+    m_expiry_timer = new boost::asio::deadline_timer(*m_io_service);
+    m_expiry_timer->expires_from_now(boost::posix_time::seconds(expiry_granularity()));
+    m_expiry_timer->async_wait(boost::bind(&Resolver::expire_queries, this, 
+                                           boost::asio::placeholders::error));
+    
+    m_adaptive_pipeline = m_app->conf()->get<bool>("pipeline.adaptive", false);
+    m_adaptive_percentile = m_app->conf()->get<int>("pipeline.percentile", 95);
+    m_adaptive_min_samples = m_app->conf()->get<int>("pipeline.min_samples", 20);
+    m_adaptive_max_wait = m_app->conf()->get<int>("pipeline.max_wait", 5000);
+    m_solved_score = m_app->conf()->get<double>("pipeline.solved_score", 1.0);
+    m_enough_results = m_app->conf()->get<int>("pipeline.enough_results", 0);
+    m_enough_score = m_app->conf()->get<double>("pipeline.enough_score", 0.9);
+    m_enough_preference = m_app->conf()->get<int>("pipeline.enough_preference", 0);
+    if(m_adaptive_pipeline)
+    {
+        log::info() << "Pipeline scheduled from p" << m_adaptive_percentile
+                    << " resolver latency" << endl;
+    }
+    
+    int cache_entries = m_app->conf()->get<int>("result_cache.max_entries", 1000);
+    if(cache_entries > 0)
+    {
+        m_result_cache = new ResultCache(cache_entries, 
+                            m_app->conf()->get<int>("result_cache.ttl", 300));
+        m_cache_coalesce = m_app->conf()->get<bool>("result_cache.coalesce", false);
+        log::info() << "Result cache: " << cache_entries << " entries, ttl " 
+                    << m_result_cache->ttl() << "s"
+                    << (m_cache_coalesce ? ", coalescing" : "") << endl;
+    }
+    
+    string scoring = m_app->conf()->get<string>("scoring.method", "editdistance");
+    if(scoring == "token")
+    {
+        m_scorer = new TokenScorer(
+                        m_app->conf()->get<double>("scoring.min_similarity", 0.5));
+    }
+    else
+    {
+        if(scoring != "editdistance")
+            log::warning() << "Unknown scoring.method '" << scoring 
+                           << "', using editdistance" << endl;
+        m_scorer = new EditDistanceScorer;
+    }
+    log::info() << "Scoring results by " << m_scorer->name() << endl;
     
     // Initialize built-in curl SS facts:
     detect_curl_capabilities();
@@ -127,17 +198,27 @@ Resolver::detect_curl_capabilities()
         log::info() << "SS factory registered for: " << p << endl ;
         m_ss_factories[ p ] = ssf; // add an SS factory for this protocol
     }
+#ifndef WIN32
+    // local files don't need curl, the http server can send them itself:
+    m_ss_factories[ "file" ] = 
+        boost::bind( &Resolver::ss_ptr_generator<LocalFileStreamingStrategy>, this, _1 );
+    log::info() << "SS factory registered for: file (local)" << endl ;
+#endif
 }
 
 
 Resolver::~Resolver()
 {
-    m_exiting = true;
-    m_cond.notify_one();
-    m_t->join();
+    m_dispatch_pool.stop();
     delete m_work;
     m_io_service->stop();
     m_iothr->join();
+    delete m_cb_work;
+    m_cb_io_service->stop();
+    m_cb_threads.join_all();
+    delete m_expiry_timer;
+    delete m_result_cache;
+    delete m_scorer;
 }
 
 bool
@@ -318,60 +399,153 @@ Resolver::dispatch(rq_ptr rq)
 query_uid 
 Resolver::dispatch(rq_ptr rq, rq_callback_t cb) 
 {
-    boost::mutex::scoped_lock lk(m_mutex);
-    if(!add_new_query(rq))
     {
-        // already running
-        return rq->id();
+        boost::mutex::scoped_lock lk(m_mutex);
+        if(!add_new_query(rq))
+        {
+            // already running
+            return rq->id();
+        }
+        rq->set_callback_executor(
+            boost::bind(&Resolver::post_callbacks, this, _1));
+        if(cb) rq->register_callback(cb);
+        rq->set_solved_score(m_solved_score);
+
+        // setup comet callback if the request has a valid comet session id
+        const string& cometId(rq->comet_session_id());
+        if (cometId.length()) {
+            boost::mutex::scoped_lock cometlock(m_comets_mutex);
+            std::map< std::string, rq_callback_t >::const_iterator it = m_comets.find(cometId);
+            if (it != m_comets.end()) {
+                rq->register_callback(it->second);
+            }
+        }
+
+        // schedule a check to auto-cancel this query after a while.
+        // give 5 mins additional time to allow setup/results, otherwise it would never be stale
+        // at max_query_lifetime, because the first result updates the atime:
+        schedule_expiry(rq->id(), max_query_lifetime()+300);
     }
-    if(cb) rq->register_callback(cb);
 
-    // setup comet callback if the request has a valid comet session id
-    const string& cometId(rq->comet_session_id());
-    if (cometId.length()) {
-        boost::mutex::scoped_lock cometlock(m_comets_mutex);
-        std::map< std::string, rq_callback_t >::const_iterator it = m_comets.find(cometId);
-        if (it != m_comets.end()) {
-            rq->register_callback(it->second);
-        }
+    // not under m_mutex: forwarding results runs the query's callbacks,
+    // and other dispatches shouldn't wait for that.
+    if(m_result_cache && rq->isValidTrack() && serve_from_cache(rq))
+    {
+        // answered by an identical recent query, no need to resolve again
+        return rq->id();
     }
 
-    m_pending.push_front( pair<rq_ptr, unsigned short>(rq, 999) );
-    m_cond.notify_one();
-    // set up timer to auto-cancel this query after a while:
-    boost::asio::deadline_timer * t = new boost::asio::deadline_timer(*m_io_service);
-    // give 5 mins additional time to allow setup/results, otherwise it would never be stale
-    // at max_query_lifetime, because the first result updates the atime:
-    t->expires_from_now(boost::posix_time::seconds(max_query_lifetime()+300));
-    t->async_wait(boost::bind(&Resolver::cancel_query_timeout, this, rq->id()));
-    m_qidtimers[rq->id()] = t;
+    m_dispatch_pool.post( pair<rq_ptr, unsigned short>(rq, 999) );
     return rq->id();
 }
 
-/// thread that loops forever dispatching stuff in the queue
+/// key identifying identical track queries, for the result cache.
+/// origin is part of the key, as remote queries don't get local-only results.
+// static
+string
+Resolver::cache_key(const rq_ptr & rq)
+{
+    string album;
+    if(rq->param_exists("album") && rq->param_type("album") == json_spirit::str_type)
+        album = rq->param("album").get_str();
+    return sortname(rq->param("artist").get_str()) + "\t" + 
+           sortname(album) + "\t" +
+           sortname(rq->param("track").get_str()) + "\t" + 
+           (rq->origin_local() ? "L" : "R");
+}
+
+/// gives rq the results of a recent identical query, if there is one.
+/// returns true if rq is taken care of and doesn't need the pipeline.
+bool
+Resolver::serve_from_cache(rq_ptr rq)
+{
+    string key = cache_key(rq);
+    // one lock for both, so queries for the same track arriving together
+    // don't all miss and all run the pipeline:
+    rq_ptr cached = m_result_cache->lookup_or_insert(key, rq);
+    if(!cached) return false;
+    log::info() << "Result cache hit for " << rq->id() 
+                << " from " << cached->id() << endl;
+    if(m_cache_coalesce && (cached->solved() || !cached->stopped()))
+    {
+        // piggyback on the cached query: existing and future results of it
+        // are copied to this one, and it never runs the pipeline itself.
+        cached->register_callback(
+            boost::bind(&Resolver::forward_cached_result, this, rq->id(), _2), true);
+        return true;
+    }
+    BOOST_FOREACH(const ri_ptr & rip, cached->results())
+    {
+        forward_cached_result(rq->id(), rip);
+    }
+    if(rq->solved()) return true;
+    // not good enough, resolve it properly. this becomes the fresher entry:
+    m_result_cache->insert(key, rq);
+    return false;
+}
+
+/// adds a copy of a result from a cached query to the query qid.
+/// the copy gets its own sid, so it outlives the query it came from.
+void
+Resolver::forward_cached_result(const query_uid & qid, ri_ptr rip)
+{
+    rq_ptr rq = this->rq(qid);
+    if(!rq || rq->cancelled()) return;
+    ri_ptr copy( new ResolvedItem(*rip) );
+    copy->set_id( gen_uuid() );
+    m_sid2ri.set( copy->id(), copy );
+    // cancel_query erases the sids of the results it finds. if the query
+    // was cancelled first, this one isn't among them, so erase it here:
+    if( !rq->add_result( copy ) )
+        m_sid2ri.erase( copy->id() );
+}
+
 void
-Resolver::dispatch_runner()
+Resolver::invalidate_result_cache()
+{
+    if(!m_result_cache) return;
+    log::info() << "Result cache invalidated" << endl;
+    m_result_cache->clear();
+}
+
+/// runs the pipeline for a query taken off the dispatch queue.
+/// called on the dispatch threads, see "dispatch_threads" config.
+void
+Resolver::dispatch_runner(const pair<rq_ptr, unsigned short>& p)
 {
     try
     {
-        while(true)
-        {
-            pair<rq_ptr, unsigned short> p;
-            {
-                boost::mutex::scoped_lock lk(m_mutex);
-                if(m_pending.size() == 0) m_cond.wait(lk);
-                if(m_exiting) break;
-                p = m_pending.back();
-                m_pending.pop_back();
-            }
-            run_pipeline( p.first, p.second );
-        }
+        run_pipeline( p.first, p.second );
     }
     catch(...)
     {
-        log::error() << "Error exiting Resolver::dispatch_runner" << endl;
+        log::error() << "Error in Resolver::dispatch_runner, qid: " << p.first->id() << endl;
+    }
+}
+
+/// hands a query's callback delivery to the callback threads.
+void
+Resolver::post_callbacks(boost::function<void()> job)
+{
+    m_cb_io_service->post(job);
+}
+
+/// thread that fires query callbacks, see "callback_threads" config.
+void
+Resolver::callback_runner()
+{
+    while(true)
+    {
+        try
+        {
+            m_cb_io_service->run();
+            break;
+        }
+        catch(...)
+        {
+            log::error() << "Error in a query callback" << endl;
+        }
     }
-    log::info() << "Resolver dispatch_runner terminating" << endl;
 }
 
 /// go thru list of resolversservices and dispatch in order
@@ -388,7 +562,7 @@ Resolver::run_pipeline( rq_ptr rq, unsigned short lastweight )
         if(!started)
         {
             atweight = pap->weight();
-            mintime = pap->targettime();
+            mintime = pipeline_targettime(pap);
             started = true;
             //cout << "Pipeline at weight: " << atweight << endl;
         }
@@ -405,9 +579,9 @@ Resolver::run_pipeline( rq_ptr rq, unsigned short lastweight )
             // pass the timer pointer to the handler so it doesnt autodestruct:
             t->async_wait(boost::bind(&Resolver::run_pipeline_cont, this,
                                       rq, atweight, t));
-            break;
+            return;
         }
-        if(pap->targettime() < mintime) mintime = pap->targettime();
+        if(pipeline_targettime(pap) < mintime) mintime = pipeline_targettime(pap);
         
         if( pap->localonly() && !rq->origin_local() )
         {
@@ -418,9 +592,55 @@ Resolver::run_pipeline( rq_ptr rq, unsigned short lastweight )
             // dispatch to this resolver:
             //cout << "Pipeline dispatching to " << pap->rs()->name() 
             //     << " (lastweight: " << lastweight << ")" << endl;
+            pap->mark_dispatched(rq->id());
             pap->rs()->start_resolving(rq);
         }
     }
+    // that was the last weight. once it's had its time, the query has gone
+    // as far as it will (the result cache needs to know):
+    if(!started)
+    {
+        rq->stop();
+        return;
+    }
+    boost::shared_ptr<boost::asio::deadline_timer> 
+        t(new boost::asio::deadline_timer( m_work->get_io_service() ));
+    t->expires_from_now(boost::posix_time::milliseconds(mintime));
+    t->async_wait(boost::bind(&Resolver::pipeline_finished, this, rq, atweight, t));
+}
+
+void
+Resolver::pipeline_finished( rq_ptr rq,
+                        unsigned short lastweight,
+                        boost::shared_ptr<boost::asio::deadline_timer> oldtimer)
+{
+    if(!rq->cancelled()) record_timeouts(rq, lastweight);
+    rq->stop();
+}
+
+/// the resolvers of this weight have had their time. those that haven't
+/// reported count as a sample of at least their target time, otherwise
+/// one that often says nothing would look faster than it is.
+void
+Resolver::record_timeouts( const rq_ptr& rq, unsigned short weight )
+{
+    BOOST_FOREACH( pa_ptr pap, m_resolvers )
+    {
+        if(pap->weight() == weight) pap->forget_dispatched( rq->id(), true );
+    }
+}
+
+/// the configured targettime, or if adaptive scheduling is enabled and 
+/// we have seen enough results from this resolver, how long it actually
+/// takes to answer (at the configured percentile).
+unsigned int
+Resolver::pipeline_targettime( const pa_ptr& pap ) const
+{
+    if(!m_adaptive_pipeline || 
+       pap->latency().count() < m_adaptive_min_samples) 
+        return pap->targettime();
+    unsigned int t = pap->latency().percentile(m_adaptive_percentile);
+    return t > m_adaptive_max_wait ? m_adaptive_max_wait : t;
 }
 
 void
@@ -429,16 +649,53 @@ Resolver::run_pipeline_cont( rq_ptr rq,
                         boost::shared_ptr<boost::asio::deadline_timer> oldtimer)
 {
     //cout << "Pipeline continues.." << endl;
-    if(rq->solved())
+    if(rq->cancelled())
+    {
+        // nothing to do
+        return;
+    }
+    record_timeouts(rq, lastweight);
+    if(rq->solved() || enough_results(rq))
     {
         //cout << "Bailing from pipeline: SOLVED @ lastweight: " << lastweight 
         //     << endl;
+        stop_resolving(rq);
     }
     else
     {
-        boost::mutex::scoped_lock lk(m_mutex);
-        m_pending.push_front( pair<rq_ptr, unsigned short>(rq, lastweight) );
-        m_cond.notify_one();
+        m_dispatch_pool.post( pair<rq_ptr, unsigned short>(rq, lastweight) );
+    }
+}
+
+/// the "enough results" policy: at least pipeline.enough_results results
+/// scoring pipeline.enough_score or more, from resolvers with at least
+/// pipeline.enough_preference. disabled unless enough_results is set.
+bool
+Resolver::enough_results( const rq_ptr& rq )
+{
+    if(m_enough_results == 0) return false;
+    unsigned int n = 0;
+    BOOST_FOREACH( const ri_ptr& rip, rq->results() )
+    {
+        // results are sorted by score, so nothing further will do:
+        if(rip->score() < m_enough_score) break;
+        if(rip->preference() >= m_enough_preference &&
+           ++n >= m_enough_results) return true;
+    }
+    return false;
+}
+
+/// we're not going any further down the pipeline for this query, so tell 
+/// resolvers that were given it but haven't reported anything to give up.
+/// they were cut short rather than timed out, so that's no latency sample.
+void
+Resolver::stop_resolving( const rq_ptr& rq )
+{
+    rq->stop();
+    BOOST_FOREACH( pa_ptr pap, m_resolvers )
+    {
+        if(pap->forget_dispatched( rq->id(), false ))
+            pap->rs()->cancel_query( rq->id() );
     }
 }
 
@@ -454,47 +711,26 @@ Resolver::add_results(query_uid qid, const vector< ri_ptr >& results, string via
         return true;
     }
 
-    rq_ptr rq;
+    rq_ptr rq = this->rq(qid);
+    if(!rq) 
+        return false; // query was deleted
 
+    // setup sid mappings
+    string sid;
+    BOOST_FOREACH(const ri_ptr& rip, results)
     {
-        // scope lock to protect m_queries and m_sid2ri
-        boost::mutex::scoped_lock lock(m_mut_results);  
-        
-        if(!query_exists(qid)) 
-            return false; // query was deleted
-        rq = m_queries[qid];
-
-        // setup sid mappings
-        string sid;
-        BOOST_FOREACH(const ri_ptr& rip, results)
-        {
-            // update map of source id -> playable item
-            sid = rip->id();
-            if (sid.length()) {
-                m_sid2ri[sid] = rip;
-            }
+        // update map of source id -> playable item
+        sid = rip->id();
+        if (sid.length()) {
+            m_sid2ri.set(sid, rip);
         }
     }
 
     if (rq->isValidTrack()) {
         // these results are for a track query, score the unscored results
-        string reason;
-        BOOST_FOREACH(const ri_ptr& rip, results) {
-            // resolver fixes the score using a standard algorithm
-            // unless a non-zero score was specified by resolver.
-            if (rip->score() < 0 &&
-                rip->has_json_value<string>( "artist" ) &&
-                rip->has_json_value<string>( "track" ) )
-            {
-                float score = calculate_score( rq, rip, reason );
-                if (score > 0) {
-                    rip->set_score( score );
-                    rq->add_result( rip );
-                }
-            } else if (rip->score() > 0) {
-                rq->add_result( rip );
-            }
-        }
+        vector< ri_ptr > scored;
+        score_results( rq, results, scored );
+        rq->add_results( scored );
     } else {
         // some other type of query, doesn't need scoring.
         rq->add_results( results );
@@ -507,80 +743,36 @@ Resolver::add_results(query_uid qid, const vector< ri_ptr >& results, string via
 string 
 Resolver::sortname(const string& name) 
 { 
-    string data(name); 
-    std::transform(data.begin(), data.end(), data.begin(), ::tolower); 
-    boost::trim(data); 
-    return data; 
+    return utils::sortname(name);
 }
 
-
-/// caluclate score 0-1 based on how similar the names are.
-/// string similarity algo that combines art,alb,trk from the original
-/// query (rq) against a potential match (pi).
-/// this is mostly just edit-distance, with some extra checks.
-/// TODO albums are ignored atm.
-// static
-float 
-Resolver::calculate_score( const rq_ptr & rq, // query
-                                  const ri_ptr & ri, // candidate
-                                  string & reason )  // fail reason
-{
-    using namespace boost;
-    // original names from the query:
-    string o_art    = trim_copy(to_lower_copy(rq->param( "artist" ).get_str()));
-    string o_trk    = trim_copy(to_lower_copy(rq->param( "track" ).get_str()));
-    string o_alb    = trim_copy(to_lower_copy(rq->param( "album" ).get_str()));
-
-    // names from candidate result:
-    string art      = trim_copy(to_lower_copy(ri->json_value("artist", "" )));
-    string trk      = trim_copy(to_lower_copy(ri->json_value("track", "")));
-    string alb      = trim_copy(to_lower_copy(ri->json_value("album","")));
-    // short-circuit for exact match
-    if(o_art == art && o_trk == trk) return 1.0;
-    // the real deal, with edit distances:
-    unsigned int trked = playdar::utils::levenshtein( 
-                                                     sortname(trk),
-                                                     sortname(o_trk));
-    unsigned int arted = playdar::utils::levenshtein( 
-                                                     sortname(art),
-                                                     sortname(o_art));
-    // tolerances:
-    float tol_art = 1.5;
-    float tol_trk = 1.5;
-    //float tol_alb = 1.5; // album rating unsed atm.
-    
-    // names less than this many chars aren't dismissed based on % edit-dist:
-    unsigned int grace_len = 6; 
-    
-    // if % edit distance is greater than tolerance, fail them outright:
-    if( o_art.length() > grace_len &&
-       arted > o_art.length()/tol_art )
-    {
-        reason = "artist name tolerance";
-        return 0.0;
-    }
-    if( o_trk.length() > grace_len &&
-       trked > o_trk.length()/tol_trk )
-    {
-        reason = "track name tolerance";
-        return 0.0;
-    }
-    // if edit distance longer than original name, fail them outright:
-    if( arted >= o_art.length() )
-    {
-        reason = "artist name editdist >= length";
-        return 0.0;
-    }
-    if( trked >= o_trk.length() )
-    {
-        reason = "track name editdist >= length";
-        return 0.0;
+/// scores candidates for a track query in one pass, appending to scored
+/// those that matched. the resolver fixes the score using m_scorer,
+/// unless a non-zero score was specified by the resolver.
+void
+Resolver::score_results( const rq_ptr & rq,
+                         const vector< ri_ptr >& results,
+                         vector< ri_ptr >& scored )
+{
+    boost::shared_ptr< const ResolverQuery::normalized_track > q = rq->normalized();
+    string art, trk, reason; // reused for each candidate
+    scored.reserve( scored.size() + results.size() );
+    BOOST_FOREACH(const ri_ptr& rip, results) {
+        if (rip->score() < 0 &&
+            rip->has_json_value<string>( "artist" ) &&
+            rip->has_json_value<string>( "track" ) )
+        {
+            utils::match_name_into( rip->artist(), art );
+            utils::match_name_into( rip->track(), trk );
+            float score = m_scorer->score( *q, art, trk, reason );
+            if (score > 0) {
+                rip->set_score( score );
+                scored.push_back( rip );
+            }
+        } else if (rip->score() > 0) {
+            scored.push_back( rip );
+        }
     }
-    
-    // combine the edit distance of artist & track into a final score:
-    float artdist_pc = (o_art.length()-arted) / (float) o_art.length();
-    float trkdist_pc = (o_trk.length()-trked) / (float) o_trk.length();
-    return artdist_pc * trkdist_pc;
 }
 
 
@@ -593,85 +785,90 @@ Resolver::cancel_query(const query_uid & qid)
     BOOST_FOREACH( pa_ptr pap, m_resolvers )
     {
         pap->rs()->cancel_query( qid );
+        pap->forget_dispatched( qid, false );
     }
-    rq_ptr cq;
+    // removing from m_queries map means no-one can find and get a new shared_ptr given a qid.
+    // only one caller gets the rq back, so cleanup happens once:
+    rq_ptr cq = m_queries.take(qid);
+    if(!cq || cq->cancelled()) return;
+    // this disables callbacks and marks it as cancelled.
+    // the qid is left in the expiry wheel, and skipped when swept:
+    cq->cancel();
+    // cleanup registered source ids -> playable items:
+    vector< ri_ptr > results = cq->results();
+    BOOST_FOREACH( ri_ptr rip, results )
     {
-        // removing from m_queries map means no-one can find and get a new shared_ptr given a qid:
-        boost::mutex::scoped_lock lock(m_mut_results);
-        if(!query_exists(qid)) return;
-        cq = rq(qid);
-        if(!cq || cq->cancelled()) return;
-        // this disables callbacks and marks it as cancelled:
-        cq->cancel();
-        m_queries.erase(qid);
-        // stop and cleanup timer:
-        boost::asio::deadline_timer * t = m_qidtimers[qid];
-        if(t)
-        {
-            t->cancel();
-            delete(t);
-            m_qidtimers.erase(qid);
-        }
-        // cleanup registered source ids -> playable items:
-        vector< ri_ptr > results = cq->results();
-        BOOST_FOREACH( ri_ptr rip, results )
-        {
-            m_sid2ri.erase( rip->id() );
-        }
+        m_sid2ri.erase( rip->id() );
     }
     // the RQ should not be referenced anywhere and will destruct now.
     // a resolverservice may still be processing it, in which case it will destruct once done.
 }
 
-/// called when timer expires, so we can delete stale queries
+/// puts qid in the expiry wheel, to be checked in about secs seconds.
 void
-Resolver::cancel_query_timeout(query_uid qid)
+Resolver::schedule_expiry(const query_uid & qid, time_t secs)
 {
-    log::info() << "Stale timeout reached for QID: " << qid << endl;
-    rq_ptr rq;
-    {
-        boost::mutex::scoped_lock lock(m_mut_results);
-        if(!query_exists(qid)) return;
-        rq = this->rq(qid);
-        if(rq->cancelled()) return;
-    }
-    // check if it's stale enough to warrant cleaning up
+    m_expiry_wheel.schedule( qid, (secs + expiry_granularity() - 1) / expiry_granularity() );
+}
+
+/// called every expiry_granularity() seconds, so we can delete stale queries.
+/// checks the qids now due in the expiry wheel, and reschedules those still in use.
+void
+Resolver::expire_queries(const boost::system::error_code& e)
+{
+    if(e == boost::asio::error::operation_aborted) return;
+    vector< query_uid > due = m_expiry_wheel.advance();
     time_t now;
     time(&now);
-    time_t diff = now - rq->atime();
-    if( diff >= max_query_lifetime() ) // stale, clean it up
+    BOOST_FOREACH( const query_uid & qid, due )
     {
-        cancel_query( qid );
-    }
-    else if( m_qidtimers.find(qid) != m_qidtimers.end() ) // not stale, reset timer
-    {
-        log::info() << "Not stale, resetting timer." << endl;
-        m_qidtimers[qid]->expires_from_now(boost::posix_time::seconds(max_query_lifetime()-diff));
-        m_qidtimers[qid]->async_wait(boost::bind(&Resolver::cancel_query_timeout, this, qid));
+        rq_ptr rq = this->rq(qid);
+        if(!rq || rq->cancelled()) continue;
+        // check if it's stale enough to warrant cleaning up
+        time_t diff = now - rq->atime();
+        if( diff >= max_query_lifetime() ) // stale, clean it up
+        {
+            log::info() << "Stale timeout reached for QID: " << qid << endl;
+            cancel_query( qid );
+        }
+        else // not stale, check again once it could be
+        {
+            schedule_expiry( qid, max_query_lifetime()-diff );
+        }
     }
+    m_expiry_timer->expires_from_now(boost::posix_time::seconds(expiry_granularity()));
+    m_expiry_timer->async_wait(boost::bind(&Resolver::expire_queries, this, 
+                                           boost::asio::placeholders::error));
 }
 
 /// gets all the current results for a query
 /// but leaves query active. (ie, results may change later)
+/// returns no results if the query was deleted.
 vector< ri_ptr >
 Resolver::get_results(query_uid qid)
 {
-    boost::mutex::scoped_lock lock(m_mut_results);
-    if(!query_exists(qid)) throw; // query was deleted
-    return m_queries[qid]->results();
+    rq_ptr rq = this->rq(qid);
+    if(!rq) return vector< ri_ptr >(); // query was deleted
+    return rq->results();
+}
+
+/// only the results added since version "since" (see ResolverQuery::version),
+/// so pollers don't fetch the whole list each time.
+vector< ri_ptr >
+Resolver::get_results_since(query_uid qid, size_t since, size_t& version)
+{
+    version = 0;
+    rq_ptr rq = this->rq(qid);
+    if(!rq) return vector< ri_ptr >(); // query was deleted
+    return rq->results_since(since, version);
 }
 
 /// check how many results we found for this query id
 int 
 Resolver::num_results(query_uid qid)
 {
-    {
-        boost::mutex::scoped_lock lock(m_mut_results);
-        if(query_exists(qid)) 
-        {
-            return m_queries[qid]->results().size();
-        }
-    }
+    rq_ptr rq = this->rq(qid);
+    if(rq) return rq->num_results();
     cerr << "Query id '"<< qid <<"' does not exist" << endl;
     return 0;
 }
@@ -680,7 +877,7 @@ Resolver::num_results(query_uid qid)
 bool 
 Resolver::query_exists(const query_uid & qid)
 {
-    return (m_queries.find(qid) != m_queries.end());
+    return m_queries.exists(qid);
 }
 
 /// true on success, false if it already exists.
@@ -690,11 +887,10 @@ Resolver::add_new_query(boost::shared_ptr<ResolverQuery> rq)
     if (rq->id().length() == 0) {
         // create and assign an id to the request
         rq->set_id( gen_uuid() );
-    } else if (query_exists(rq->id())) {
+    }
+    if (!m_queries.insert(rq->id(), rq)) {
         return false;
     }
-
-    m_queries[rq->id()] = rq;
     {
         boost::mutex::scoped_lock lock(m_mut_qidlist);
         m_qidlist.push_front(rq->id());
@@ -705,8 +901,7 @@ Resolver::add_new_query(boost::shared_ptr<ResolverQuery> rq)
 boost::shared_ptr<ResolverQuery>
 Resolver::rq(const query_uid & qid)
 {
-    map< query_uid, rq_ptr >::iterator it = m_queries.find(qid);
-    return it == m_queries.end() ? boost::shared_ptr<ResolverQuery>() : it->second;
+    return m_queries.get(qid);
 }
 
 size_t
@@ -721,9 +916,8 @@ Resolver::num_seen_queries()
 ss_ptr
 Resolver::get_ss(const source_uid & sid)
 {
-    map< source_uid, ri_ptr >::iterator it = m_sid2ri.find(sid);
-    if (it != m_sid2ri.end()) {
-        ri_ptr rip( it->second );
+    ri_ptr rip = m_sid2ri.get(sid);
+    if (rip) {
         if( rip->url().empty() ) return ss_ptr();
 
         size_t offset = rip->url().find(':');
@@ -755,12 +949,7 @@ Resolver::get_ss(const source_uid & sid)
 ri_ptr
 Resolver::sid2ri( const source_uid& sid )
 {
-    map< source_uid, ri_ptr >::iterator it = m_sid2ri.find(sid);
-    if (it != m_sid2ri.end())
-        return it->second;
-    else
-        return ri_ptr();
-          
+    return m_sid2ri.get(sid);
 }
 
 template <class T>
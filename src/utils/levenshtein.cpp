@@ -4,49 +4,59 @@ namespace playdar { namespace utils {
 
 int levenshtein(const std::string & source, const std::string & target) 
 {
+  return levenshtein(source, target, -1);
+}
+
+int levenshtein(const std::string & source_in, const std::string & target_in,
+                int max_distance) 
+{
+  // The distance is symmetric, so run along the shorter string
+  // to keep the rows small.
+  const bool swap = target_in.length() > source_in.length();
+  const std::string & source = swap ? target_in : source_in;
+  const std::string & target = swap ? source_in : target_in;
   // Step 1
   const int n = source.length();
   const int m = target.length();
-  if (n == 0) {
-    return m;
+  if (max_distance >= 0 && n - m > max_distance) {
+    return max_distance + 1;
   }
   if (m == 0) {
     return n;
   }
-  // Good form to declare a TYPEDEF
-  typedef std::vector< std::vector<int> > Tmatrix; 
-  Tmatrix matrix(n+1);
-  // Size the vectors in the 2.nd dimension. Unfortunately C++ doesn't
-  // allow for allocation on declaration of 2.nd dimension of vec of vec
-  for (int i = 0; i <= n; i++) {
-    matrix[i].resize(m+1);
+  // Only the last three rows of the matrix are needed (two, plus one
+  // more for transpositions). Short names fit on the stack.
+  const int short_len = 64;
+  int stackrows[3 * (short_len + 1)];
+  std::vector<int> heaprows;
+  int * rows = stackrows;
+  if (m > short_len) {
+    heaprows.resize(3 * (m + 1));
+    rows = &heaprows[0];
   }
+  int * prev2 = rows;            // row i-2
+  int * prev = rows + (m + 1);   // row i-1
+  int * cur = rows + 2 * (m + 1);
   // Step 2
-  for (int i = 0; i <= n; i++) {
-    matrix[i][0]=i;
-  }
   for (int j = 0; j <= m; j++) {
-    matrix[0][j]=j;
+    prev[j] = j;
   }
+  // smallest value in the previous row:
+  int prevmin = 0;
   // Step 3
   for (int i = 1; i <= n; i++) {
     const char s_i = source[i-1];
+    cur[0] = i;
+    int rowmin = i;
     // Step 4
     for (int j = 1; j <= m; j++) {
       const char t_j = target[j-1];
       // Step 5
-      int cost;
-      if (s_i == t_j) {
-        cost = 0;
-      }
-      else {
-        cost = 1;
-      }
+      const int cost = (s_i == t_j) ? 0 : 1;
       // Step 6
-      const int above = matrix[i-1][j];
-      const int left = matrix[i][j-1];
-      const int diag = matrix[i-1][j-1];
-      //int cell = min( above + 1, min(left + 1, diag + cost));
+      const int above = prev[j];
+      const int left = cur[j-1];
+      const int diag = prev[j-1];
       int cell = (((left+1)>(diag+cost))?diag+cost:left+1);
       if(above+1 < cell) cell = above+1;
       // Step 6A: Cover transposition, in addition to deletion,
@@ -55,16 +65,25 @@ int levenshtein(const std::string & source, const std::string & target)
       // Enhanced Dynamic Programming ASM Algorithm"
       // (http://www.acm.org/~hlb/publications/asm/asm.html)
       if (i>2 && j>2) {
-        int trans=matrix[i-2][j-2]+1;
+        int trans=prev2[j-2]+1;
         if (source[i-2]!=t_j) trans++;
         if (s_i!=target[j-2]) trans++;
         if (cell>trans) cell=trans;
       }
-      matrix[i][j]=cell;
+      cur[j]=cell;
+      if (cell < rowmin) rowmin = cell;
+    }
+    // Cells only build on the two rows above, so once two rows in a
+    // row are over the limit, the result will be too:
+    if (max_distance >= 0 && rowmin > max_distance && prevmin > max_distance) {
+      return max_distance + 1;
     }
+    prevmin = rowmin;
+    int * t = prev2; prev2 = prev; prev = cur; cur = t;
   }
   // Step 7
-  return matrix[n][m];
+  const int d = prev[m];
+  return (max_distance >= 0 && d > max_distance) ? max_distance + 1 : d;
 }
 
 }}
@@ -0,0 +1,103 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// The Resolver's dispatch pool, utils::worker_pool, across 1..16 threads.
+// Queries arrive at a steady rate, and the fake pipeline for one in every
+// 20 blocks for 50ms, as a resolver plugin waiting on the network would;
+// the rest are answered straight away. Reports how long the quick ones
+// waited to start, and the rate the pool got through them all.
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/utils/worker_pool.hpp"
+
+using namespace boost::posix_time;
+
+namespace {
+
+const int queries = 2000;
+const int per_second = 500;
+const int block_every = 20;
+const int block_ms = 50;
+
+struct query
+{
+    query() : n(0) {}
+    query(int n, ptime posted) : n(n), posted(posted) {}
+    int n;
+    ptime posted;
+};
+
+boost::mutex mut;
+boost::condition cond;
+std::vector<long> waits; // microseconds from post to start, quick queries only
+int finished = 0;
+
+/// stands in for Resolver::run_pipeline
+void run_pipeline(const query& q)
+{
+    ptime started = microsec_clock::universal_time();
+    if (q.n % block_every == 0)
+        boost::this_thread::sleep(milliseconds(block_ms));
+    boost::mutex::scoped_lock lk(mut);
+    if (q.n % block_every)
+        waits.push_back((started - q.posted).total_microseconds());
+    if (++finished == queries) cond.notify_all();
+}
+
+void run(int threads)
+{
+    waits.clear();
+    finished = 0;
+    playdar::utils::worker_pool<query> pool;
+    pool.start(threads, &run_pipeline);
+    ptime start = microsec_clock::universal_time();
+    for (int i = 0; i < queries; ++i)
+    {
+        // keep to the arrival rate, however far behind the pool is:
+        ptime due = start + microseconds((long)i * 1000000 / per_second);
+        ptime now = microsec_clock::universal_time();
+        if (due > now) boost::this_thread::sleep(due - now);
+        pool.post(query(i, microsec_clock::universal_time()));
+    }
+    {
+        boost::mutex::scoped_lock lk(mut);
+        while (finished < queries) cond.wait(lk);
+    }
+    double secs = (microsec_clock::universal_time() - start).total_milliseconds() / 1000.0;
+    std::sort(waits.begin(), waits.end());
+    std::cout << threads << " threads: " << (int)(queries / secs) << " queries/s, "
+              << "quick queries waited p50 " << waits[waits.size() / 2] / 1000.0
+              << "ms, p99 " << waits[waits.size() * 99 / 100] / 1000.0
+              << "ms, max " << waits.back() / 1000.0 << "ms" << std::endl;
+}
+
+}
+
+int main()
+{
+    std::cout << queries << " queries at " << per_second << "/s, 1 in " << block_every
+              << " blocking for " << block_ms << "ms" << std::endl;
+    for (int threads = 1; threads <= 16; threads *= 2)
+        run(threads);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// Stale-query expiry for 1M queries: utils::expiry_wheel, advanced by one
+// repeating timer as the Resolver does, against a deadline_timer per
+// query. Each query is scheduled to be checked at some point in the next
+// six hours, and the whole span is then swept. Timers expiring in the
+// past stand in for the six hours, so both run as fast as they can.
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/utils/expiry_wheel.hpp"
+
+using namespace boost::posix_time;
+
+namespace {
+
+const size_t num = 1000000;
+const size_t granularity = 60;                          // Resolver::expiry_granularity()
+const size_t slots = (21600 + 300) / granularity + 1;   // as the Resolver sizes it
+
+size_t checked = 0;
+
+void check_query(const std::string& qid)
+{
+    checked += qid.size() ? 1 : 0;
+}
+
+void timer_fired(const boost::system::error_code& e, const std::string& qid)
+{
+    if (!e) check_query(qid);
+}
+
+long rss_bytes()
+{
+    long pages = 0, resident = 0;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (f && fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    if (f) fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+double secs_since(const ptime& start)
+{
+    return (microsec_clock::universal_time() - start).total_microseconds() / 1000000.0;
+}
+
+void report(const char* what, double schedule, double sweep, long bytes)
+{
+    std::cout << what << ": schedule " << schedule << "s, sweep " << sweep << "s, "
+              << (long)(num / (schedule + sweep)) << " queries/s, "
+              << bytes / (long)num << " bytes per query, " << checked << " checked" << std::endl;
+}
+
+}
+
+int main()
+{
+    // query uids, as gen_uuid() makes them:
+    std::vector<std::string> qids;
+    qids.reserve(num);
+    for (size_t i = 0; i < num; ++i)
+    {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "%08lx-0000-4000-8000-%012lx",
+                 (unsigned long)((i * 2654435761u) & 0xffffffff), (unsigned long)i);
+        qids.push_back(buf);
+    }
+
+    {
+        checked = 0;
+        long before = rss_bytes();
+        ptime start = microsec_clock::universal_time();
+        playdar::utils::expiry_wheel<std::string> wheel(slots);
+        for (size_t i = 0; i < num; ++i)
+            wheel.schedule(qids[i], 1 + i % slots);
+        double schedule = secs_since(start);
+        long bytes = rss_bytes() - before;
+        start = microsec_clock::universal_time();
+        for (size_t t = 0; t < slots; ++t)
+        {
+            std::vector<std::string> due = wheel.advance();
+            for (size_t j = 0; j < due.size(); ++j) check_query(due[j]);
+        }
+        report("expiry wheel", schedule, secs_since(start), bytes);
+    }
+
+    {
+        checked = 0;
+        long before = rss_bytes();
+        ptime start = microsec_clock::universal_time();
+        boost::asio::io_service ios;
+        std::vector< boost::shared_ptr<boost::asio::deadline_timer> > timers;
+        timers.reserve(num);
+        ptime base = microsec_clock::universal_time() - hours(7);
+        for (size_t i = 0; i < num; ++i)
+        {
+            boost::shared_ptr<boost::asio::deadline_timer> t(new boost::asio::deadline_timer(ios));
+            t->expires_at(base + seconds((1 + i % slots) * granularity));
+            t->async_wait(boost::bind(&timer_fired, boost::asio::placeholders::error, qids[i]));
+            timers.push_back(t);
+        }
+        double schedule = secs_since(start);
+        long bytes = rss_bytes() - before;
+        start = microsec_clock::universal_time();
+        ios.run();
+        report("timer per query", schedule, secs_since(start), bytes);
+    }
+    return 0;
+}
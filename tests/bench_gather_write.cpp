@@ -0,0 +1,196 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Streaming replies through the http server, a producer thread writing
+// content while a client on loopback reads it. Each case runs with one
+// queued buffer per socket write, as before gather writes, and with the
+// default gather. Cases:
+//  - comet: many small events, each written as the JSON and ",\r\n"
+//  - stream: a big file in 16KB chunks, the producer ignoring the high
+//    water mark, then honouring it (waiting for the drain callback).
+//    "peak queued" is the most the producer got ahead of the client.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "moost/http/server.hpp"
+
+using namespace boost::posix_time;
+using boost::asio::ip::tcp;
+
+namespace {
+
+const int port = 60302;
+const int comet_events = 10000;
+const long stream_bytes = 50 * 1024 * 1024;
+const int stream_chunk = 16 * 1024;
+
+// bytes the client has read, and the producer's peak lead over it:
+boost::mutex progress_mut;
+long received = 0, peak_queued = 0;
+
+// for a producer honouring the high water mark:
+boost::mutex drain_mut;
+boost::condition drain_cond;
+bool drained = false;
+
+void on_drain()
+{
+    boost::mutex::scoped_lock lk(drain_mut);
+    drained = true;
+    drain_cond.notify_all();
+}
+
+void produced(long bytes)
+{
+    boost::mutex::scoped_lock lk(progress_mut);
+    if (bytes - received > peak_queued) peak_queued = bytes - received;
+}
+
+void write(boost::shared_ptr<moost::http::reply> rep, const std::string& s, bool honour_mark)
+{
+    {
+        boost::mutex::scoped_lock lk(drain_mut);
+        drained = false;
+    }
+    if (rep->write_content(s) || !honour_mark) return;
+    boost::mutex::scoped_lock lk(drain_mut);
+    while (!drained) drain_cond.wait(lk);
+}
+
+void comet(boost::shared_ptr<moost::http::reply> rep)
+{
+    std::string event(100, 'x');
+    event = "{\"qid\":\"" + event + "\"}";
+    for (int i = 0; i < comet_events; ++i)
+    {
+        rep->write_content(event);
+        rep->write_content(",\r\n");
+    }
+    rep->write_finish();
+}
+
+void stream(boost::shared_ptr<moost::http::reply> rep, bool honour_mark)
+{
+    std::string chunk(stream_chunk, 'a');
+    long sent = 0;
+    while (sent < stream_bytes)
+    {
+        write(rep, chunk, honour_mark);
+        sent += chunk.length();
+        produced(sent);
+    }
+    rep->write_finish();
+}
+
+struct handler : moost::http::request_handler_base<handler>
+{
+    // /<what>/<max gather>
+    void handle_request(const moost::http::request& req, moost::http::reply& rep)
+    {
+        boost::shared_ptr<moost::http::reply> r = rep.shared_from_this();
+        size_t slash = req.uri.rfind('/');
+        r->set_max_gather(std::atoi(req.uri.c_str() + slash + 1));
+        r->set_drain_cb(&on_drain);
+        std::string what = req.uri.substr(0, slash);
+        if (what == "/comet")
+            boost::thread(boost::bind(&comet, r));
+        else
+            boost::thread(boost::bind(&stream, r, what == "/stream_mark"));
+    }
+};
+
+/// fetches uri, @return seconds until all of it was read
+double fetch(const std::string& uri)
+{
+    {
+        boost::mutex::scoped_lock lk(progress_mut);
+        received = peak_queued = 0;
+    }
+    boost::asio::io_service ios;
+    tcp::socket sock(ios);
+    sock.connect(tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+    std::string req = "GET " + uri + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ptime start = microsec_clock::universal_time();
+    boost::asio::write(sock, boost::asio::buffer(req));
+    char buf[64 * 1024];
+    boost::system::error_code ec;
+    while (!ec)
+    {
+        size_t n = sock.read_some(boost::asio::buffer(buf), ec);
+        boost::mutex::scoped_lock lk(progress_mut);
+        received += n;
+    }
+    return (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+}
+
+/// best of a few runs, in ms
+long best_ms(const std::string& uri, long& peak)
+{
+    double best = 1e9;
+    for (int i = 0; i < 5; ++i)
+    {
+        double secs = fetch(uri);
+        if (secs < best)
+        {
+            best = secs;
+            boost::mutex::scoped_lock lk(progress_mut);
+            peak = peak_queued;
+        }
+    }
+    return (long)(best * 1000);
+}
+
+void report(const std::string& what, const std::string& uri, bool show_peak)
+{
+    std::cout << what << ":";
+    const char * gathers[] = { "1", "64" };
+    for (int g = 0; g < 2; ++g)
+    {
+        long peak = 0;
+        long ms = best_ms(uri + "/" + gathers[g], peak);
+        std::cout << " gather " << gathers[g] << " " << ms << "ms";
+        if (show_peak) std::cout << " (peak queued " << peak / 1024 << "KB)";
+        std::cout << (g ? "" : ",");
+    }
+    std::cout << std::endl;
+}
+
+}
+
+int main()
+{
+    moost::http::server<handler> s("127.0.0.1", port, 1);
+    boost::thread srv(boost::bind(&moost::http::server<handler>::run, &s));
+    boost::this_thread::sleep(milliseconds(200));
+
+    report("10k comet events", "/comet", false);
+    report("50MB stream, ignoring the mark", "/stream", true);
+    report("50MB stream, honouring the mark", "/stream_mark", true);
+
+    s.stop();
+    srv.join();
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// utils::levenshtein, with and without a cutoff, against the old
+// full-matrix version it replaced. Pairs are every name against every
+// other (mostly far apart, as most candidates are) plus each name
+// against a copy with a typo (close, so the cutoff can't help).
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/utils/levenshtein.h"
+
+using namespace boost::posix_time;
+
+namespace {
+
+const char * names[] = {
+    "radiohead", "karma police", "the beatles", "yesterday", "jay-z",
+    "empire state of mind", "daft punk", "get lucky", "bob marley",
+    "is this love", "portishead", "glory box", "eminem", "stan",
+    "massive attack", "teardrop", "bjork", "hyperballad", "guns n roses",
+    "sweet child o mine", "rihanna", "umbrella", "nirvana",
+    "smells like teen spirit", "metallica", "enter sandman",
+    "the rolling stones", "paint it black", "simon and garfunkel",
+    "the boxer", "red hot chili peppers", "californication", "pink floyd",
+    "another brick in the wall part 2", "queen", "bohemian rhapsody",
+    "coldplay", "yellow", "the killers", "mr brightside",
+};
+const size_t num_names = sizeof(names) / sizeof(names[0]);
+
+// the implementation before the cutoff was added, for comparison:
+int matrix_levenshtein(const std::string& source, const std::string& target)
+{
+    const int n = source.length();
+    const int m = target.length();
+    if (n == 0) return m;
+    if (m == 0) return n;
+    std::vector< std::vector<int> > matrix(n+1);
+    for (int i = 0; i <= n; i++) matrix[i].resize(m+1);
+    for (int i = 0; i <= n; i++) matrix[i][0] = i;
+    for (int j = 0; j <= m; j++) matrix[0][j] = j;
+    for (int i = 1; i <= n; i++) {
+        const char s_i = source[i-1];
+        for (int j = 1; j <= m; j++) {
+            const char t_j = target[j-1];
+            const int cost = (s_i == t_j) ? 0 : 1;
+            const int above = matrix[i-1][j];
+            const int left = matrix[i][j-1];
+            const int diag = matrix[i-1][j-1];
+            int cell = (((left+1)>(diag+cost))?diag+cost:left+1);
+            if (above+1 < cell) cell = above+1;
+            if (i>2 && j>2) {
+                int trans = matrix[i-2][j-2]+1;
+                if (source[i-2] != t_j) trans++;
+                if (s_i != target[j-2]) trans++;
+                if (cell > trans) cell = trans;
+            }
+            matrix[i][j] = cell;
+        }
+    }
+    return matrix[n][m];
+}
+
+// the cutoff EditDistanceScorer passes for a query name:
+int cutoff(const std::string& q)
+{
+    int max = q.length() ? (int) q.length() - 1 : 0;
+    if (q.length() > 6 && (int)(q.length() / 1.5f) < max)
+        max = (int)(q.length() / 1.5f);
+    return max;
+}
+
+struct pair_t
+{
+    std::string a, b;
+    int max;
+};
+
+enum variant { matrix, rows, rows_cutoff };
+
+double run(const std::vector<pair_t>& pairs, variant v, long& sink)
+{
+    const int rounds = 200;
+    ptime start = microsec_clock::universal_time();
+    for (int r = 0; r < rounds; ++r)
+        for (size_t i = 0; i < pairs.size(); ++i)
+        {
+            const pair_t& p = pairs[i];
+            if (v == matrix) sink += matrix_levenshtein(p.a, p.b);
+            else if (v == rows) sink += playdar::utils::levenshtein(p.a, p.b);
+            else sink += playdar::utils::levenshtein(p.a, p.b, p.max);
+        }
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return rounds * pairs.size() / secs;
+}
+
+void report(const char * what, const std::vector<pair_t>& pairs)
+{
+    // the new versions must agree with the old one (up to the cutoff):
+    int wrong = 0;
+    for (size_t i = 0; i < pairs.size(); ++i)
+    {
+        const pair_t& p = pairs[i];
+        int d = matrix_levenshtein(p.a, p.b);
+        int capped = d > p.max ? p.max + 1 : d;
+        if (playdar::utils::levenshtein(p.a, p.b) != d ||
+            playdar::utils::levenshtein(p.a, p.b, p.max) != capped)
+            ++wrong;
+    }
+    long sink = 0;
+    double m = run(pairs, matrix, sink);
+    double r = run(pairs, rows, sink);
+    double c = run(pairs, rows_cutoff, sink);
+    std::cout << what << " (" << pairs.size() << "), pairs/s: matrix " << (long)m
+              << ", rows " << (long)r << " (x" << (int)(r / m * 10) / 10.0
+              << "), rows+cutoff " << (long)c << " (x" << (int)(c / m * 10) / 10.0
+              << ")" << (wrong ? ", DISAGREE" : "") << (sink < 0 ? " " : "")
+              << std::endl;
+}
+
+}
+
+int main()
+{
+    std::vector<pair_t> far, close;
+    for (size_t i = 0; i < num_names; ++i)
+    {
+        for (size_t j = 0; j < num_names; ++j)
+        {
+            if (i == j) continue;
+            pair_t p = { names[j], names[i], cutoff(names[i]) };
+            far.push_back(p);
+        }
+        // a typo: two letters swapped and one dropped
+        std::string typo = names[i];
+        if (typo.length() > 3)
+        {
+            std::swap(typo[1], typo[2]);
+            typo.erase(typo.length() - 2, 1);
+        }
+        pair_t p = { typo, names[i], cutoff(names[i]) };
+        close.push_back(p);
+    }
+    report("different names", far);
+    report("names with typos", close);
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Streaming a local file through the http server, two ways:
+//  - write_file: the reply sends it from the connection (sendfile), as
+//    LocalFileStreamingStrategy does.
+//  - write_content: a thread per stream reads it in 16KB chunks into the
+//    reply's queue, honouring the high water mark, as a file:// url going
+//    through CurlStreamingStrategy did.
+// Clients run in a child process, so the CPU time, memory and threads
+// measured are the server's own. Figures: throughput at 1 and at
+// concurrent_streams streams, server CPU per Gbit, and memory and threads
+// per stream with that many slow clients.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "moost/http/server.hpp"
+
+using namespace boost::posix_time;
+using boost::asio::ip::tcp;
+
+namespace {
+
+const int port = 60303;
+const long file_bytes = 50 * 1024 * 1024;
+const int concurrent_streams = 32;
+const int chunk = 16 * 1024;
+const long slow_rate = 4 * 1024 * 1024; // bytes/s per slow client
+const int slow_secs = 3;
+
+std::string file_path;
+
+// one write_content producer, paused by the reply's high water mark:
+struct producer
+{
+    producer() : drained(false) {}
+    void on_drain()
+    {
+        boost::mutex::scoped_lock lk(mut);
+        drained = true;
+        cond.notify_all();
+    }
+    boost::mutex mut;
+    boost::condition cond;
+    bool drained;
+};
+
+void produce(boost::shared_ptr<moost::http::reply> rep, boost::shared_ptr<producer> p, int fd)
+{
+    std::vector<char> buf(chunk);
+    ssize_t n;
+    while ((n = read(fd, &buf[0], buf.size())) > 0)
+    {
+        {
+            boost::mutex::scoped_lock lk(p->mut);
+            p->drained = false;
+        }
+        if (!rep->write_content(std::string(&buf[0], n)))
+        {
+            boost::mutex::scoped_lock lk(p->mut);
+            // a client that went away never drains; give up then:
+            while (!p->drained)
+                if (!p->cond.timed_wait(lk, seconds(2))) { close(fd); return; }
+        }
+    }
+    close(fd);
+    rep->write_finish();
+}
+
+struct handler : moost::http::request_handler_base<handler>
+{
+    void handle_request(const moost::http::request& req, moost::http::reply& rep)
+    {
+        int fd = open(file_path.c_str(), O_RDONLY);
+        rep.add_header("Content-Length", file_bytes);
+        rep.add_header("Content-Type", "audio/mpeg");
+        if (req.uri == "/write_file")
+        {
+            rep.write_file(fd, 0, file_bytes);
+            return;
+        }
+        boost::shared_ptr<moost::http::reply> r = rep.shared_from_this();
+        boost::shared_ptr<producer> p(new producer);
+        r->set_drain_cb(boost::bind(&producer::on_drain, p));
+        boost::thread(boost::bind(&produce, r, p, fd));
+    }
+};
+
+// --- the client process ---
+
+boost::mutex client_mut;
+long client_bytes = 0;
+
+void client(const std::string& uri, long rate)
+{
+    long got = 0;
+    try
+    {
+        boost::asio::io_service ios;
+        tcp::socket sock(ios);
+        sock.connect(tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+        std::string req = "GET " + uri + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+        boost::asio::write(sock, boost::asio::buffer(req));
+        std::vector<char> buf(64 * 1024);
+        ptime start = microsec_clock::universal_time();
+        boost::system::error_code ec;
+        while (!ec)
+        {
+            got += sock.read_some(boost::asio::buffer(buf, rate ? chunk : buf.size()), ec);
+            if (!rate) continue;
+            long ms = (microsec_clock::universal_time() - start).total_milliseconds();
+            if (ms >= slow_secs * 1000) break;
+            long due_ms = got * 1000 / rate;
+            if (due_ms > ms) boost::this_thread::sleep(milliseconds(due_ms - ms));
+        }
+    }
+    catch (std::exception&)
+    {
+    }
+    boost::mutex::scoped_lock lk(client_mut);
+    client_bytes += got;
+}
+
+/// reads "<uri> <streams> <rate>" lines, answers "<bytes> <seconds>"
+void client_process(int in, int out)
+{
+    FILE * cmds = fdopen(in, "r");
+    char uri[64];
+    int streams;
+    long rate;
+    while (fscanf(cmds, "%63s %d %ld", uri, &streams, &rate) == 3)
+    {
+        client_bytes = 0;
+        ptime start = microsec_clock::universal_time();
+        boost::thread_group group;
+        for (int i = 0; i < streams; ++i)
+            group.create_thread(boost::bind(&client, std::string(uri), rate));
+        group.join_all();
+        double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+        char line[64];
+        int n = snprintf(line, sizeof(line), "%ld %f\n", client_bytes, secs);
+        if (write(out, line, n) != n) break;
+    }
+    _exit(0);
+}
+
+// --- measuring the server ---
+
+double cpu_seconds()
+{
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+long rss_bytes()
+{
+    long pages = 0, resident = 0;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (f && fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    if (f) fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+int num_threads()
+{
+    int n = 0;
+    DIR * d = opendir("/proc/self/task");
+    if (!d) return 0;
+    while (readdir(d)) ++n;
+    closedir(d);
+    return n - 2; // . and ..
+}
+
+int to_client, from_client;
+
+struct result
+{
+    double gbits, secs, cpu;
+    long rss;
+    int threads;
+};
+
+result run(const std::string& uri, int streams, long rate)
+{
+    result r;
+    long rss_before = rss_bytes();
+    int threads_before = num_threads();
+    double cpu_before = cpu_seconds();
+    std::ostringstream cmd;
+    cmd << uri << " " << streams << " " << rate << "\n";
+    if (write(to_client, cmd.str().data(), cmd.str().length()) < 0) exit(1);
+    r.rss = 0;
+    r.threads = 0;
+    if (rate)
+    {
+        // in the middle of the slow streams:
+        boost::this_thread::sleep(milliseconds(slow_secs * 1000 / 2));
+        r.rss = rss_bytes() - rss_before;
+        r.threads = num_threads() - threads_before;
+    }
+    char line[64];
+    ssize_t n = read(from_client, line, sizeof(line) - 1);
+    if (n <= 0) exit(1);
+    line[n] = 0;
+    long bytes = 0;
+    sscanf(line, "%ld %lf", &bytes, &r.secs);
+    r.gbits = bytes * 8 / 1e9;
+    // the producer threads may still be finishing, give them a moment:
+    boost::this_thread::sleep(milliseconds(200));
+    r.cpu = cpu_seconds() - cpu_before;
+    return r;
+}
+
+/// best of two
+result best(const std::string& uri, int streams)
+{
+    result a = run(uri, streams, 0);
+    result b = run(uri, streams, 0);
+    return a.gbits / a.secs >= b.gbits / b.secs ? a : b;
+}
+
+}
+
+int main()
+{
+    char path[] = "/tmp/bench_local_stream_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return 1;
+    file_path = path;
+    std::string block(1024 * 1024, 0);
+    for (size_t i = 0; i < block.size(); ++i) block[i] = (char)(i * 7);
+    for (long i = 0; i < file_bytes / (long)block.size(); ++i)
+        if (write(fd, block.data(), block.size()) < 0) return 1;
+    close(fd);
+
+    // start the clients' process before any threads:
+    int cmd_pipe[2], result_pipe[2];
+    if (pipe(cmd_pipe) || pipe(result_pipe)) return 1;
+    pid_t child = fork();
+    if (child == 0)
+    {
+        close(cmd_pipe[1]);
+        close(result_pipe[0]);
+        client_process(cmd_pipe[0], result_pipe[1]);
+    }
+    close(cmd_pipe[0]);
+    close(result_pipe[1]);
+    to_client = cmd_pipe[1];
+    from_client = result_pipe[0];
+
+    moost::http::server<handler> s("127.0.0.1", port, 4);
+    boost::thread srv(boost::bind(&moost::http::server<handler>::run, &s));
+    boost::this_thread::sleep(milliseconds(200));
+
+    const char * paths[] = { "/write_content", "/write_file" };
+    std::cout << "50MB file (page cached), loopback:" << std::endl;
+    for (int p = 0; p < 2; ++p)
+    {
+        result one = best(paths[p], 1);
+        result many = best(paths[p], concurrent_streams);
+        result slow = run(paths[p], concurrent_streams, slow_rate);
+        std::cout << "  " << paths[p] + 1 << ": 1 stream "
+                  << (int)(one.gbits / one.secs * 10) / 10.0 << " Gbit/s, "
+                  << concurrent_streams << " streams "
+                  << (int)(many.gbits / many.secs * 10) / 10.0 << " Gbit/s, "
+                  << "CPU per Gbit " << (int)(many.cpu / many.gbits * 1000) << "ms; "
+                  << concurrent_streams << " slow streams: "
+                  << slow.rss / concurrent_streams / 1024 << "KB and "
+                  << (double)slow.threads / concurrent_streams << " threads per stream"
+                  << std::endl;
+    }
+
+    close(to_client);
+    waitpid(child, 0, 0);
+    s.stop();
+    srv.join();
+    std::remove(path);
+    return 0;
+}
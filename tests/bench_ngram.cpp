@@ -0,0 +1,193 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Candidate search in the local library, as local::find_candidates does
+// it: the artist search, then a track search within each artist found.
+// Once with the in-memory NgramIndex, once with the SQL search_catalogue
+// queries. Names are generated; usage: bench_ngram [num_tracks]
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "library.h"
+#include "ngram_index.hpp"
+
+using namespace playdar;
+using namespace boost::posix_time;
+
+namespace {
+
+const int tracks_per_artist = 12;
+const int num_queries = 500;
+
+const char * syllables[] = {
+    "ka", "ro", "mi", "tel", "sun", "dar", "ve", "lo", "shi", "ban",
+    "quo", "ir", "nex", "pa", "ul", "gri", "mo", "zen", "ha", "tor",
+};
+
+unsigned rnd = 12345;
+unsigned next_rnd()
+{
+    rnd = rnd * 1103515245u + 12345u;
+    return rnd >> 8;
+}
+
+std::string word()
+{
+    std::string w;
+    for(int n = 2 + next_rnd() % 3; n > 0; --n)
+        w += syllables[next_rnd() % (sizeof(syllables) / sizeof(syllables[0]))];
+    return w;
+}
+
+std::string name(int words)
+{
+    std::string s = word();
+    while(--words > 0) s += " " + word();
+    return s;
+}
+
+// a typo: two letters swapped
+std::string typo(std::string s)
+{
+    if(s.length() > 4) std::swap(s[2], s[3]);
+    return s;
+}
+
+struct query
+{
+    std::string artist, track;
+};
+
+/// the candidate search, as local::find_candidates
+size_t find_candidates(Library& lib, const NgramIndex* artists,
+                       const NgramIndex* tracks, const query& q)
+{
+    std::vector<scorepair> artistresults = artists
+        ? artists->search(lib.ngrams(q.artist), 10)
+        : lib.search_catalogue("artist", q.artist);
+    std::map<std::string,int> trkgrams;
+    if(tracks) trkgrams = lib.ngrams(q.track);
+    size_t found = 0;
+    for(size_t i = 0; i < artistresults.size(); ++i)
+    {
+        found += tracks
+            ? tracks->search_for_artist(artistresults[i].id, trkgrams, 10).size()
+            : lib.search_catalogue_for_artist(artistresults[i].id, "track", q.track).size();
+    }
+    return found;
+}
+
+double run(Library& lib, const NgramIndex* artists, const NgramIndex* tracks,
+           const std::vector<query>& queries, size_t& found)
+{
+    ptime start = microsec_clock::universal_time();
+    for(size_t i = 0; i < queries.size(); ++i)
+        found += find_candidates(lib, artists, tracks, queries[i]);
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return queries.size() / secs;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    const int num_tracks = argc > 1 ? atoi(argv[1]) : 100000;
+    const int num_artists = num_tracks / tracks_per_artist + 1;
+    char path[] = "/tmp/bench_ngram_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) return 1;
+    close(fd);
+    std::string dbfile(path);
+
+    std::vector<query> queries;
+    {
+        Library lib(dbfile);
+        // straight into the tables in one transaction, add_file is too
+        // slow for this many:
+        sqlite3pp::database db(dbfile.c_str());
+        db.execute("BEGIN");
+        std::vector<std::string> artists;
+        for(int a = 1; a <= num_artists; ++a)
+        {
+            std::string n = name(1 + a % 3);
+            artists.push_back(n);
+            sqlite3pp::command cmd(db, "INSERT OR IGNORE INTO artist(id, name, sortname) VALUES(?, ?, ?)");
+            cmd.bind(1, a);
+            cmd.bind(2, n.c_str(), true);
+            cmd.bind(3, (n + " " + name(1)).c_str(), true); // unique
+            cmd.execute();
+        }
+        for(int t = 1; t <= num_tracks; ++t)
+        {
+            int a = 1 + (t - 1) % num_artists;
+            std::string n = name(1 + t % 4);
+            char sortname[32];
+            snprintf(sortname, sizeof(sortname), " %d", t); // unique
+            sqlite3pp::command cmd(db, "INSERT INTO track(id, artist, name, sortname) VALUES(?, ?, ?, ?)");
+            cmd.bind(1, t);
+            cmd.bind(2, a);
+            cmd.bind(3, n.c_str(), true);
+            cmd.bind(4, (n + sortname).c_str(), true);
+            cmd.execute();
+            if(t % (num_tracks / num_queries + 1) == 0)
+            {
+                query q = { typo(artists[a - 1]), typo(n) };
+                queries.push_back(q);
+            }
+        }
+        db.execute("COMMIT");
+    }
+
+    Library lib(dbfile);
+    ptime start = microsec_clock::universal_time();
+    lib.build_index("artist");
+    lib.build_index("track");
+    std::cout << num_artists << " artists, " << num_tracks << " tracks, indexed in "
+              << (microsec_clock::universal_time() - start).total_milliseconds() << "ms" << std::endl;
+
+    NgramIndex artists, tracks;
+    start = microsec_clock::universal_time();
+    if(!lib.load_ngram_index("artist", artists) || !lib.load_ngram_index("track", tracks))
+    {
+        std::cout << "couldn't load the index" << std::endl;
+        return 1;
+    }
+    std::cout << "loaded " << artists.num_postings() + tracks.num_postings()
+              << " postings into memory in "
+              << (microsec_clock::universal_time() - start).total_milliseconds() << "ms" << std::endl;
+
+    size_t found_db = 0, found_mem = 0;
+    double db_rate = run(lib, 0, 0, queries, found_db);
+    double mem_rate = run(lib, &artists, &tracks, queries, found_mem);
+    std::cout << queries.size() << " searches, per second: sql " << (long)db_rate
+              << ", in memory " << (long)mem_rate << " (x" << (int)(mem_rate / db_rate)
+              << "); candidates found: sql " << found_db << ", in memory " << found_mem
+              << std::endl;
+
+    std::remove(dbfile.c_str());
+    std::remove((dbfile + "-wal").c_str());
+    std::remove((dbfile + "-shm").c_str());
+    return 0;
+}
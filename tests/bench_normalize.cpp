@@ -0,0 +1,130 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// utils::sortname and utils::match_name against the byte-wise
+// lowercase + trim + fixspaces the library used before (copied below),
+// on plain ASCII names and on names with accents. Also checks that
+// ASCII names still get the same sortname as before.
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/utils/normalize.hpp"
+
+using namespace boost::posix_time;
+
+namespace {
+
+const char * ascii_names[] = {
+    "Radiohead", "Karma Police", "  The Beatles ", "Yesterday - Remastered 2009",
+    "Jay-Z feat. Alicia Keys", "Empire State of Mind", "Daft Punk",
+    "Get Lucky (Radio Edit)", "Bob Marley & The Wailers", "Is This Love",
+    "Guns N' Roses", "Sweet Child O' Mine", "Red Hot Chili Peppers",
+    "Another Brick in the Wall,  Part 2", "Simon and Garfunkel", "The Boxer",
+};
+
+const char * accented_names[] = {
+    "Björk", "Motörhead", "Beyoncé", "Sigur Rós", "Mötley Crüe",
+    "Hüsker Dü", "Blue Öyster Cult", "Françoise Hardy", "Céline Dion",
+    "Antonín Dvořák", "Ólafur Arnalds", "Émilie Simon", "Jóhann Jóhannsson",
+    "Amadou & Mariam – Sabali", "Røyksopp", "Die Ärzte",
+};
+
+std::string fixspaces(const std::string& s)
+{
+    std::string r;
+    bool prevWasSpace = false;
+    r.reserve(s.length());
+    for (std::string::const_iterator i = s.begin(); i != s.end(); i++) {
+        if (*i > 0 && *i <= ' ') {
+            if (!prevWasSpace) {
+                r += ' ';
+                prevWasSpace = true;
+            }
+        } else {
+            r += *i;
+            prevWasSpace = false;
+        }
+    }
+    return r;
+}
+
+// the old Library::sortname:
+std::string bytewise_sortname(const std::string& name)
+{
+    std::string data(name);
+    std::transform(data.begin(), data.end(), data.begin(), ::tolower);
+    boost::trim(data);
+    return fixspaces(data);
+}
+
+enum variant { bytewise, sortname, match_name };
+
+double run(const std::vector<std::string>& names, variant v, size_t& sink)
+{
+    const int rounds = 50000;
+    ptime start = microsec_clock::universal_time();
+    for (int r = 0; r < rounds; ++r)
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (v == bytewise) sink += bytewise_sortname(names[i]).length();
+            else if (v == sortname) sink += playdar::utils::sortname(names[i]).length();
+            else sink += playdar::utils::match_name(names[i]).length();
+        }
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return rounds * names.size() / secs;
+}
+
+void report(const char * what, const std::vector<std::string>& names)
+{
+    size_t sink = 0;
+    double b = run(names, bytewise, sink);
+    double s = run(names, sortname, sink);
+    double m = run(names, match_name, sink);
+    std::cout << what << ", names/s: byte-wise " << (long)b
+              << ", sortname " << (long)s << " (x" << (int)(s / b * 10) / 10.0
+              << "), match_name " << (long)m << " (x" << (int)(m / b * 10) / 10.0
+              << ")" << (sink == 0 ? " " : "") << std::endl;
+}
+
+}
+
+int main()
+{
+    std::vector<std::string> ascii(ascii_names,
+        ascii_names + sizeof(ascii_names) / sizeof(ascii_names[0]));
+    std::vector<std::string> accented(accented_names,
+        accented_names + sizeof(accented_names) / sizeof(accented_names[0]));
+
+    int differ = 0;
+    for (size_t i = 0; i < ascii.size(); ++i)
+        if (playdar::utils::sortname(ascii[i]) != bytewise_sortname(ascii[i]))
+            ++differ;
+    if (differ)
+        std::cout << differ << " ASCII name(s) got a different sortname" << std::endl;
+
+    report("ASCII", ascii);
+    report("accented", accented);
+    return 0;
+}
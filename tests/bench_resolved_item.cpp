@@ -0,0 +1,132 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ResolvedItem's typed fields against the map of json values it used to
+// keep everything in (a copy of the old accessors is below). Each round
+// does what happens to a query's results: build them from the resolver's
+// json, sort them by score, read sid and url, and write them out as json.
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/resolved_item.h"
+
+using namespace playdar;
+using namespace boost::posix_time;
+
+namespace {
+
+const int num_results = 50;
+
+// the old ResolvedItem storage and accessors:
+class map_item
+{
+public:
+    map_item( const json_spirit::Object& jsonobj )
+    {
+        json_spirit::obj_to_map( jsonobj, m_jsonmap );
+    }
+    json_spirit::Object get_json() const
+    {
+        json_spirit::Object o;
+        json_spirit::map_to_obj( m_jsonmap, o );
+        return o;
+    }
+    const std::string id() const  { return json_value( "sid", std::string() ); }
+    const float score() const     { return (float) json_value( "score", -1.0 ); }
+    const std::string url() const { return json_value( "url", std::string() ); }
+
+    template< typename T >
+    T json_value( const std::string& s, const T& def ) const
+    {
+        std::map< std::string, json_spirit::Value >::const_iterator i = m_jsonmap.find( s );
+        return i != m_jsonmap.end() && i->second.type() == json_type<T>()
+            ? i->second.get_value<T>()
+            : def;
+    }
+private:
+    template< typename T > static json_spirit::Value_type json_type();
+    std::map< std::string, json_spirit::Value > m_jsonmap;
+};
+
+template<> json_spirit::Value_type map_item::json_type<std::string>() { return json_spirit::str_type; }
+template<> json_spirit::Value_type map_item::json_type<double>() { return json_spirit::real_type; }
+
+template< typename Item >
+bool by_score( const boost::shared_ptr<Item>& a, const boost::shared_ptr<Item>& b )
+{
+    return a->score() > b->score();
+}
+
+template< typename Item >
+double run( const std::vector<json_spirit::Object>& objs, size_t& sink )
+{
+    const int rounds = 2000;
+    ptime start = microsec_clock::universal_time();
+    for( int r = 0; r < rounds; ++r )
+    {
+        std::vector< boost::shared_ptr<Item> > items;
+        for( size_t i = 0; i < objs.size(); ++i )
+            items.push_back( boost::shared_ptr<Item>( new Item( objs[i] ) ) );
+        std::sort( items.begin(), items.end(), by_score<Item> );
+        for( size_t i = 0; i < items.size(); ++i )
+        {
+            sink += items[i]->id().length() + items[i]->url().length();
+            sink += items[i]->get_json().size();
+        }
+    }
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return rounds * objs.size() / secs;
+}
+
+}
+
+int main()
+{
+    // as the local library reports them:
+    std::vector<json_spirit::Object> objs;
+    for( int i = 0; i < num_results; ++i )
+    {
+        using json_spirit::Pair;
+        json_spirit::Object o;
+        o.push_back( Pair( "artist", "Some Artist" ) );
+        o.push_back( Pair( "track", "A Track Name" ) );
+        o.push_back( Pair( "album", "The Album" ) );
+        o.push_back( Pair( "mimetype", "audio/mpeg" ) );
+        o.push_back( Pair( "size", 4000000 + i ) );
+        o.push_back( Pair( "duration", 240 ) );
+        o.push_back( Pair( "bitrate", 192 ) );
+        o.push_back( Pair( "url", "/home/someone/Music/Some Artist/The Album/A Track Name.mp3" ) );
+        o.push_back( Pair( "score", ( i * 37 % num_results ) / (double) num_results ) );
+        o.push_back( Pair( "sid", "8c1d5f2e-4f2a-4b1e-9c1e-0123456789ab" ) );
+        o.push_back( Pair( "source", "localhost" ) );
+        objs.push_back( o );
+    }
+    size_t sink = 0;
+    double old_rate = run<map_item>( objs, sink );
+    double new_rate = run<ResolvedItem>( objs, sink );
+    std::cout << "results/s (build, sort, read, to json): map " << (long)old_rate
+              << ", typed fields " << (long)new_rate << " (x"
+              << (int)( new_rate / old_rate * 10 ) / 10.0 << ")"
+              << ( sink == 0 ? " " : "" ) << std::endl;
+    return 0;
+}
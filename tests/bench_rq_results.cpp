@@ -0,0 +1,172 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Polling a query's results, as API clients do every second: against
+// the old results(), which sorted the whole list under the query lock on
+// every call and copied it out. Polls either find nothing new (the usual
+// case once a query has been answered) or one new result each time.
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/resolver_query.hpp"
+
+using namespace playdar;
+using namespace boost::posix_time;
+
+namespace {
+
+const int polls = 20000;
+
+// the old ResolverQuery results:
+struct sort_on_read
+{
+    void add_result( ri_ptr rip )
+    {
+        boost::mutex::scoped_lock lock( mut );
+        results.push_back( rip );
+    }
+    std::vector< ri_ptr > get()
+    {
+        boost::mutex::scoped_lock lock( mut );
+        std::sort( results.begin(), results.end(), &ResolverQuery::sorter );
+        return results;
+    }
+    boost::mutex mut;
+    std::vector< ri_ptr > results;
+};
+
+ri_ptr result( int i )
+{
+    ri_ptr rip( new ResolvedItem );
+    rip->set_score( ( i * 37 % 100 ) / 100.0 );
+    rip->set_preference( 100 );
+    return rip;
+}
+
+double rate( int n, const ptime& start )
+{
+    return n / ( (microsec_clock::universal_time() - start).total_microseconds() / 1e6 );
+}
+
+// polls of a query with num results, and nothing new:
+void answered( int num )
+{
+    sort_on_read old_rq;
+    rq_ptr rq( new ResolverQuery );
+    for( int i = 0; i < num; ++i )
+    {
+        old_rq.add_result( result( i ) );
+        rq->add_result( result( i ) );
+    }
+    size_t sink = 0;
+    ptime start = microsec_clock::universal_time();
+    for( int i = 0; i < polls; ++i )
+        sink += old_rq.get().size();
+    double sorting = rate( polls, start );
+
+    start = microsec_clock::universal_time();
+    for( int i = 0; i < polls; ++i )
+        sink += rq->results().size();
+    double copy = rate( polls, start );
+
+    start = microsec_clock::universal_time();
+    for( int i = 0; i < polls; ++i )
+        sink += rq->results_snapshot()->size();
+    double snapshot = rate( polls, start );
+
+    // as get_results with "since":
+    size_t version = rq->version();
+    start = microsec_clock::universal_time();
+    for( int i = 0; i < polls; ++i )
+        sink += rq->results_since( version, version ).size();
+    double since = rate( polls, start );
+
+    std::cout << num << " results, polls/s: sort on read " << (long)sorting
+              << ", results() " << (long)copy
+              << ", snapshot " << (long)snapshot
+              << ", since " << (long)since
+              << ( sink == 0 ? " " : "" ) << std::endl;
+}
+
+// queries filling up to num results, polled after each one arrives:
+void arriving( int num )
+{
+    const int queries = polls / num;
+    std::vector< ri_ptr > rs;
+    for( int i = 0; i < num; ++i ) rs.push_back( result( i ) );
+    size_t sink = 0;
+
+    ptime start = microsec_clock::universal_time();
+    for( int q = 0; q < queries; ++q )
+    {
+        sort_on_read old_rq;
+        for( int i = 0; i < num; ++i )
+        {
+            old_rq.add_result( rs[i] );
+            sink += old_rq.get().size();
+        }
+    }
+    double sorting = rate( queries * num, start );
+
+    start = microsec_clock::universal_time();
+    for( int q = 0; q < queries; ++q )
+    {
+        rq_ptr rq( new ResolverQuery );
+        for( int i = 0; i < num; ++i )
+        {
+            rq->add_result( rs[i] );
+            sink += rq->results().size();
+        }
+    }
+    double copy = rate( queries * num, start );
+
+    start = microsec_clock::universal_time();
+    for( int q = 0; q < queries; ++q )
+    {
+        rq_ptr rq( new ResolverQuery );
+        size_t version = 0;
+        for( int i = 0; i < num; ++i )
+        {
+            rq->add_result( rs[i] );
+            sink += rq->results_since( version, version ).size();
+        }
+    }
+    double since = rate( queries * num, start );
+
+    std::cout << "filling to " << num << " results, polls/s: sort on read " << (long)sorting
+              << ", results() " << (long)copy
+              << ", since " << (long)since
+              << ( sink == 0 ? " " : "" ) << std::endl;
+}
+
+}
+
+int main()
+{
+    answered( 10 );
+    answered( 100 );
+    answered( 1000 );
+    arriving( 10 );
+    arriving( 100 );
+    return 0;
+}
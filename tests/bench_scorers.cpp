@@ -0,0 +1,172 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Accuracy and speed of the result scorers (see "scoring.method") on
+// labelled query/candidate pairs. A result is accepted if it scores > 0,
+// as in Resolver::score_results. Also what scoring costs if the query's
+// names are normalized again for every candidate, as they used to be.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/resolver_query.hpp"
+#include "playdar/scorer_editdistance.hpp"
+#include "playdar/scorer_token.hpp"
+#include "playdar/utils/normalize.hpp"
+
+using namespace playdar;
+using namespace boost::posix_time;
+
+namespace {
+
+struct labelled
+{
+    const char * q_artist, * q_track;
+    const char * artist, * track;
+    bool same; // is it the track asked for?
+};
+
+const labelled pairs[] = {
+    // same recording, extra qualifiers or featured artists:
+    { "Radiohead", "Karma Police", "Radiohead", "Karma Police (Live)", true },
+    { "Radiohead", "Karma Police", "Radiohead", "Karma Police - Remastered", true },
+    { "The Beatles", "Yesterday", "The Beatles", "Yesterday - Remastered 2009", true },
+    { "Jay-Z", "Empire State of Mind", "Jay-Z feat. Alicia Keys", "Empire State of Mind", true },
+    { "Daft Punk", "Get Lucky", "Daft Punk ft. Pharrell Williams", "Get Lucky (Radio Edit)", true },
+    { "Bob Marley", "Is This Love", "Bob Marley & The Wailers", "Is This Love", true },
+    { "Portishead", "Glory Box", "Portishead", "Glory Box (Album Version)", true },
+    { "Eminem", "Stan", "Eminem feat. Dido", "Stan", true },
+    { "Massive Attack", "Teardrop", "Massive Attack", "Teardrop (Mad Professor Remix)", true },
+    // same, spelling and punctuation:
+    { "Bjork", "Hyperballad", "Björk", "Hyperballad", true },
+    { "Guns N Roses", "Sweet Child O Mine", "Guns N' Roses", "Sweet Child O' Mine", true },
+    { "Rhianna", "Umbrella", "Rihanna", "Umbrella", true },
+    { "Nirvana", "Smells Like Teen Spirt", "Nirvana", "Smells Like Teen Spirit", true },
+    { "Metallica", "Enter Sandman", "Metallica", "Enter Sandman", true },
+    { "The Rolling Stones", "Paint It Black", "Rolling Stones", "Paint It, Black", true },
+    { "Simon & Garfunkel", "The Boxer", "Simon and Garfunkel", "The Boxer", true },
+    { "Beyonce", "Halo", "Beyoncé", "Halo", true },
+    { "Red Hot Chili Peppers", "Californication", "Red Hot Chilli Peppers", "Californication", true },
+    // different tracks with similar names:
+    { "Rush", "Part 2", "Rush", "Part 3", false },
+    { "Pink Floyd", "Another Brick in the Wall Part 1", "Pink Floyd", "Another Brick in the Wall Part 2", false },
+    { "Radiohead", "Creep", "Radiohead", "Reckoner", false },
+    { "Blur", "Song 2", "Blur", "Song 3", false },
+    { "Oasis", "Wonderwall", "Oasis", "Wonder", false },
+    { "Muse", "Uprising", "Muse", "Up", false },
+    { "U2", "One", "U2", "Ones", false },
+    { "Queen", "Bohemian Rhapsody", "Queen", "Bohemian Like You", false },
+    { "Coldplay", "Yellow", "Coldplay", "Yellow Submarine", false },
+    // different artists:
+    { "Nirvana", "Lithium", "Evanescence", "Lithium", false },
+    { "The Killers", "Human", "Human League", "Human", false },
+    { "Prince", "Purple Rain", "Princess Superstar", "Purple Rain", false },
+    { "Madonna", "Frozen", "Within Temptation", "Frozen", false },
+    { "Genesis", "Mama", "My Chemical Romance", "Mama", false },
+    { "Muse", "Hysteria", "Def Leppard", "Hysteria", false },
+    { "Air", "Sexy Boy", "Hair", "Sexy Boy", false },
+};
+const size_t num_pairs = sizeof(pairs) / sizeof(pairs[0]);
+
+void run( const Scorer& scorer,
+          const std::vector< boost::shared_ptr<const ResolverQuery::normalized_track> >& qs,
+          const std::vector<std::string>& arts, const std::vector<std::string>& trks )
+{
+    size_t tp = 0, fp = 0, fn = 0, tn = 0;
+    std::string reason;
+    for( size_t i = 0; i < num_pairs; ++i )
+    {
+        float s = scorer.score( *qs[i], arts[i], trks[i], reason );
+        bool accepted = s > 0;
+        if( accepted && pairs[i].same ) ++tp;
+        else if( accepted ) ++fp;
+        else if( pairs[i].same ) ++fn;
+        else ++tn;
+        if( accepted != pairs[i].same )
+            std::cout << "  wrong: " << pairs[i].artist << " - " << pairs[i].track
+                      << " for " << pairs[i].q_artist << " - " << pairs[i].q_track
+                      << " (" << s << ")" << std::endl;
+    }
+
+    const int rounds = 20000;
+    float sink = 0;
+    ptime start = microsec_clock::universal_time();
+    for( int r = 0; r < rounds; ++r )
+        for( size_t i = 0; i < num_pairs; ++i )
+            sink += scorer.score( *qs[i], arts[i], trks[i], reason );
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+    std::cout << std::setw(13) << scorer.name()
+              << ": accuracy " << (tp + tn) << "/" << num_pairs
+              << " (missed " << fn << ", wrongly accepted " << fp << "), "
+              << (long)( rounds * num_pairs / secs ) << " pairs/s"
+              << (sink < 0 ? " " : "") << std::endl;
+}
+
+/// as run(), timing only, but working out the query's normalized names
+/// for each candidate instead of once per query.
+void run_renormalizing( const Scorer& scorer, const std::vector< rq_ptr >& rqs,
+                        const std::vector<std::string>& arts, const std::vector<std::string>& trks )
+{
+    const int rounds = 20000;
+    float sink = 0;
+    std::string reason;
+    ptime start = microsec_clock::universal_time();
+    for( int r = 0; r < rounds; ++r )
+        for( size_t i = 0; i < num_pairs; ++i )
+        {
+            // set_param drops the query's cached normalized names:
+            rqs[i]->set_param( "track", std::string( pairs[i].q_track ) );
+            sink += scorer.score( *rqs[i]->normalized(), arts[i], trks[i], reason );
+        }
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+    std::cout << std::setw(13) << scorer.name()
+              << ": normalizing the query per candidate, "
+              << (long)( rounds * num_pairs / secs ) << " pairs/s"
+              << (sink < 0 ? " " : "") << std::endl;
+}
+
+}
+
+int main()
+{
+    // queries are normalized once each, as the resolver does, and the
+    // candidates' names with utils::match_name:
+    std::vector< rq_ptr > rqs;
+    std::vector< boost::shared_ptr<const ResolverQuery::normalized_track> > qs;
+    std::vector<std::string> arts, trks;
+    for( size_t i = 0; i < num_pairs; ++i )
+    {
+        rq_ptr rq( new ResolverQuery );
+        rq->set_param( "artist", std::string( pairs[i].q_artist ) );
+        rq->set_param( "track", std::string( pairs[i].q_track ) );
+        rqs.push_back( rq );
+        qs.push_back( rq->normalized() );
+        arts.push_back( utils::match_name( pairs[i].artist ) );
+        trks.push_back( utils::match_name( pairs[i].track ) );
+    }
+    run( EditDistanceScorer(), qs, arts, trks );
+    run( TokenScorer(), qs, arts, trks );
+    run_renormalizing( EditDistanceScorer(), rqs, arts, trks );
+    run_renormalizing( TokenScorer(), rqs, arts, trks );
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The Resolver's query registry under contention: utils::sharded_map
+// against a std::map behind one mutex, as m_queries was. Each thread
+// mostly looks queries up (rq, sid2ri, get_results), and sometimes adds
+// one and cancels it again, the way dispatch and expiry do.
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/utils/sharded_map.hpp"
+
+using namespace boost::posix_time;
+
+namespace {
+
+typedef boost::shared_ptr<int> value;
+
+const int live_keys = 10000;
+const int ops_per_thread = 400000;
+const int lookups_per_write = 20;
+
+struct locked_map
+{
+    value get(const std::string& k) const
+    {
+        boost::mutex::scoped_lock lk(mut);
+        std::map<std::string, value>::const_iterator it = map.find(k);
+        return it == map.end() ? value() : it->second;
+    }
+    bool insert(const std::string& k, const value& v)
+    {
+        boost::mutex::scoped_lock lk(mut);
+        return map.insert(std::make_pair(k, v)).second;
+    }
+    value take(const std::string& k)
+    {
+        boost::mutex::scoped_lock lk(mut);
+        std::map<std::string, value>::iterator it = map.find(k);
+        if(it == map.end()) return value();
+        value v = it->second;
+        map.erase(it);
+        return v;
+    }
+
+    mutable boost::mutex mut;
+    std::map<std::string, value> map;
+};
+
+std::vector<std::string> keys;
+
+template <typename Map>
+void worker(Map* m, int seed)
+{
+    unsigned r = seed * 2654435761u + 1;
+    int found = 0;
+    for(int i = 0; i < ops_per_thread; ++i)
+    {
+        r = r * 1103515245u + 12345u;
+        const std::string& k = keys[(r >> 8) % keys.size()];
+        if(i % lookups_per_write)
+        {
+            if(m->get(k)) ++found;
+        }
+        else
+        {
+            value v = m->take(k);
+            m->insert(k, v ? v : value(new int(i)));
+        }
+    }
+    if(found < 0) std::cout << found;
+}
+
+template <typename Map>
+double run(int nthreads)
+{
+    Map m;
+    for(size_t i = 0; i < keys.size(); ++i)
+        m.insert(keys[i], value(new int(i)));
+    ptime start = microsec_clock::universal_time();
+    boost::thread_group group;
+    for(int t = 0; t < nthreads; ++t)
+        group.create_thread(boost::bind(&worker<Map>, &m, t));
+    group.join_all();
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return nthreads * ops_per_thread / secs;
+}
+
+}
+
+int main()
+{
+    for(int i = 0; i < live_keys; ++i)
+    {
+        // qids look like uuids:
+        char qid[40];
+        snprintf(qid, sizeof(qid), "%08x-4f2a-%04x-9c1e-%012x",
+                 i * 2654435761u, i & 0xffff, i * 40503u);
+        keys.push_back(qid);
+    }
+
+    std::cout << live_keys << " queries, " << lookups_per_write
+              << " lookups per add/cancel, ops/s:" << std::endl;
+    int maxthreads = boost::thread::hardware_concurrency();
+    if(maxthreads < 8) maxthreads = 8;
+    for(int n = 1; n <= maxthreads; n *= 2)
+        std::cout << "  " << n << " thread(s): single mutex "
+                  << (long)run<locked_map>(n) << ", sharded "
+                  << (long)run< playdar::utils::sharded_map<std::string, value> >(n)
+                  << std::endl;
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Library lookups through a utils::statement_cache, against preparing
+// the statements every time (a cache that keeps nothing). Each lookup is
+// what serving a local file does: file_from_fid, then load_track, which
+// also loads the artist.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "library.h"
+
+using namespace playdar;
+using namespace boost::posix_time;
+
+namespace {
+
+const int num_files = 2000;
+const int lookups = 20000;
+
+/// @return microseconds per lookup
+double run(utils::statement_cache& sc, size_t& sink)
+{
+    ptime start = microsec_clock::universal_time();
+    for(int i = 0; i < lookups; ++i)
+    {
+        LibraryFile_ptr f = Library::file_from_fid(sc, 1 + i * 7 % num_files);
+        if(!f) continue;
+        track_ptr t = Library::load_track(sc, f->pitrkid);
+        if(t) sink += t->name().length();
+    }
+    return (microsec_clock::universal_time() - start).total_microseconds() / (double)lookups;
+}
+
+}
+
+int main()
+{
+    char path[] = "/tmp/bench_statement_cache_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) return 1;
+    close(fd);
+    std::string dbfile(path);
+    {
+        Library lib(dbfile);
+        lib.db().execute("BEGIN");
+        for(int i = 0; i < num_files; ++i)
+        {
+            char n[64];
+            snprintf(n, sizeof(n), "/music/artist %d/album/track %d.mp3", i / 10, i);
+            char artist[32], track[32];
+            snprintf(artist, sizeof(artist), "Artist %d", i / 10);
+            snprintf(track, sizeof(track), "Track %d", i);
+            lib.add_file(n, 0, 4000000, "", "audio/mpeg", 240, 192,
+                         artist, "Album", track, i % 10);
+        }
+        lib.db().execute("COMMIT");
+    }
+
+    size_t sink = 0;
+    {
+        sqlite3pp::database db(dbfile.c_str());
+        utils::statement_cache cached(db);
+        // keeps no idle statements, so each is prepared when used:
+        utils::statement_cache uncached(db, 0);
+        double with = run(cached, sink);
+        double without = run(uncached, sink);
+        std::cout << num_files << " files, per lookup: prepared each time "
+                  << (int)without << "us, statement cache " << (int)with << "us"
+                  << (sink == 0 ? " " : "") << std::endl;
+    }
+    std::remove(dbfile.c_str());
+    std::remove((dbfile + "-wal").c_str());
+    std::remove((dbfile + "-shm").c_str());
+    return 0;
+}
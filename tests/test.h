@@ -0,0 +1,52 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __PLAYDAR_TEST_H__
+#define __PLAYDAR_TEST_H__
+
+// Minimal checks for the programs in tests/. Each is a plain executable
+// run by ctest, failing if its exit status is non-zero.
+
+#include <iostream>
+
+namespace playdar {
+
+inline int& test_failure_count()
+{
+    static int n = 0;
+    return n;
+}
+
+/// exit status for main(): the number of failed checks (capped).
+inline int test_failures()
+{
+    int n = test_failure_count();
+    if(n) std::cout << n << " check(s) failed" << std::endl;
+    return n > 100 ? 100 : n;
+}
+
+}
+
+#define CHECK(cond) \
+    do { if(!(cond)) { \
+        std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " \
+                  << #cond << std::endl; \
+        ++playdar::test_failure_count(); \
+    } } while(0)
+
+#endif
@@ -0,0 +1,85 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// utils::expiry_wheel hands each item back on exactly the tick it was
+// scheduled for, including around the wheel's size, where the slot index
+// wraps, and beyond it, where items go round more than once.
+
+#include <iostream>
+#include <vector>
+
+#include "playdar/utils/expiry_wheel.hpp"
+#include "test.h"
+
+using namespace playdar;
+
+namespace {
+
+const size_t slots = 8;
+
+/// the tick (1-based) on which an item scheduled ahead, after having
+/// advanced already ticks, is handed back, or 0 if it never is.
+size_t due_on(size_t already, size_t ahead)
+{
+    utils::expiry_wheel<size_t> w(slots);
+    for(size_t i = 0; i < already; i++) w.advance();
+    w.schedule(ahead, ahead);
+    size_t tick = 0;
+    for(size_t t = 1; t <= 4 * slots; t++)
+    {
+        std::vector<size_t> due = w.advance();
+        if(due.empty()) continue;
+        CHECK(due.size() == 1 && due[0] == ahead);
+        if(tick) return 0; // handed back twice
+        tick = t;
+    }
+    return tick;
+}
+
+}
+
+int main()
+{
+    // from every position of the wheel, so the slot index wraps at each:
+    for(size_t already = 0; already < slots; already++)
+    {
+        CHECK(due_on(already, 1) == 1);
+        CHECK(due_on(already, slots - 1) == slots - 1);
+        CHECK(due_on(already, slots) == slots);
+        CHECK(due_on(already, slots + 1) == slots + 1);
+        CHECK(due_on(already, 2 * slots) == 2 * slots);
+        CHECK(due_on(already, 3 * slots + 3) == 3 * slots + 3);
+    }
+    // 0 ahead means the next tick:
+    CHECK(due_on(0, 0) == 1);
+
+    // items due on the same tick come back in the order scheduled, whether
+    // they went round the wheel or not:
+    utils::expiry_wheel<size_t> w(slots);
+    w.schedule(1, slots + 2);
+    w.advance();
+    w.advance();
+    w.schedule(2, slots);
+    w.schedule(3, slots);
+    for(size_t t = 0; t < slots - 1; t++) CHECK(w.advance().empty());
+    std::vector<size_t> due = w.advance();
+    CHECK(due.size() == 3 && due[0] == 1 && due[1] == 2 && due[2] == 3);
+    for(size_t t = 0; t < 2 * slots; t++) CHECK(w.advance().empty());
+
+    return test_failures();
+}
@@ -0,0 +1,308 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Keep-alive in the http server under load: many clients each sending
+// requests one after another on a single connection, all answered on it,
+// against a new connection per request ("Connection: close"). Requests
+// are /api/?method=stat, answered by the api plugin as
+// playdar_request_handler does, with the rest of playdar stubbed out.
+// Also the timeouts: a client that never sends a request is dropped after
+// the read timeout, an idle one after the keep-alive timeout.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "moost/http/server.hpp"
+#include "playdar/auth.h"
+#include "playdar/playdar_request.h"
+#include "playdar/resolver_service.h"
+#include "test.h"
+
+using namespace boost::posix_time;
+using boost::asio::ip::tcp;
+using namespace playdar;
+
+namespace {
+
+int port; // any free one, as bound by the server
+const int clients = 200;
+const int requests_per_client = 50;
+const int close_requests_per_client = 10;
+
+/// what the api plugin asks of playdar for method=stat
+class stub_adaptor : public PluginAdaptor
+{
+public:
+    std::string classname() const { return "api"; }
+    std::string playdar_version() const { return "test"; }
+    void set(const std::string&, json_spirit::Value) {}
+    json_spirit::Value getstring(const std::string&, const std::string& def) const { return def; }
+    json_spirit::Value getint(const std::string&, const int def) const { return def; }
+    json_spirit::Value get_json(const std::string&) const { return json_spirit::Value(); }
+    bool report_results(const query_uid&, const std::vector< json_spirit::Object >&) { return false; }
+    std::string gen_uuid() const { return "uuid"; }
+    bool query_exists(const query_uid&) { return false; }
+    std::vector< ri_ptr > get_results(query_uid) { return std::vector< ri_ptr >(); }
+    std::vector< ri_ptr > get_results_since(query_uid, size_t, size_t& version)
+    { version = 0; return std::vector< ri_ptr >(); }
+    int num_results(query_uid) { return 0; }
+    rq_ptr rq(const query_uid&) { return rq_ptr(); }
+    void cancel_query(const query_uid&) {}
+    void invalidate_result_cache() {}
+    const std::string hostname() const { return "localhost"; }
+    const json_spirit::Object capabilities() const { return json_spirit::Object(); }
+    ss_ptr get_ss(const source_uid&) { return ss_ptr(); }
+    ri_ptr get_ri(const source_uid&) { return ri_ptr(); }
+    query_uid dispatch(boost::shared_ptr<ResolverQuery>) { return query_uid(); }
+    query_uid dispatch(boost::shared_ptr<ResolverQuery>, rq_callback_t) { return query_uid(); }
+};
+
+// exported by the api plugin, what the loader creates it with:
+extern "C" PDL::DynamicClass* Createapi();
+
+ResolverServicePlugin* api_plugin;
+auth* api_auth;
+
+/// as playdar_request_handler::handle_pluginurl and serve_body
+struct handler : moost::http::request_handler_base<handler>
+{
+    void handle_request(const moost::http::request& req, moost::http::reply& rep)
+    {
+        playdar_request preq(req);
+        playdar_response resp;
+        if (!api_plugin->anon_http_handler(preq, resp, *api_auth))
+        {
+            rep.stock_reply(moost::http::reply::not_found);
+            return;
+        }
+        rep.set_status(resp.response_code());
+        typedef std::pair<std::string, std::string> SPair;
+        BOOST_FOREACH(SPair p, resp.headers())
+            rep.add_header(p.first, p.second);
+        rep.add_header("Content-Length", resp.str().length());
+        rep.write_content(resp.str());
+        rep.write_finish();
+    }
+};
+
+boost::mutex results_mut;
+int answered = 0, failed = 0;
+
+/// a request for the api's stat method, answered with a jsonp callback
+/// named after it, so each reply can be matched to its request.
+std::string stat_request(int client, int n, bool keep_alive, std::string& callback)
+{
+    std::ostringstream cb;
+    cb << "c" << client << "_" << n;
+    callback = cb.str();
+    return "GET /api/?method=stat&jsonp=" + callback + " HTTP/1.1\r\nHost: localhost\r\n"
+        + (keep_alive ? "" : "Connection: close\r\n") + "\r\n";
+}
+
+bool is_stat_reply(const std::string& body, const std::string& callback)
+{
+    return body.compare(0, callback.length() + 1, callback + "(") == 0 &&
+           body.find("\"playdar\"") != std::string::npos;
+}
+
+/// reads one reply, @return false if the connection broke.
+bool read_reply(tcp::socket& sock, boost::asio::streambuf& buf, std::string& body)
+{
+    boost::asio::read_until(sock, buf, "\r\n\r\n");
+    std::istream is(&buf);
+    std::string line;
+    size_t length = 0;
+    bool keep_alive = false;
+    while (std::getline(is, line) && line != "\r")
+    {
+        if (line.compare(0, 15, "Content-Length:") == 0)
+            length = std::atoi(line.c_str() + 15);
+        if (line.compare(0, 22, "Connection: keep-alive") == 0)
+            keep_alive = true;
+    }
+    if (buf.size() < length)
+        boost::asio::read(sock, buf, boost::asio::transfer_at_least(length - buf.size()));
+    body.resize(length);
+    is.read(&body[0], length);
+    return keep_alive;
+}
+
+void client(int n)
+{
+    int ok = 0;
+    try
+    {
+        boost::asio::io_service ios;
+        tcp::socket sock(ios);
+        sock.connect(tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+        boost::asio::streambuf buf;
+        for (int i = 0; i < requests_per_client; ++i)
+        {
+            std::string callback;
+            boost::asio::write(sock, boost::asio::buffer(stat_request(n, i, true, callback)));
+            std::string body;
+            bool keep_alive = read_reply(sock, buf, body);
+            if (!is_stat_reply(body, callback)) break;
+            ++ok;
+            // every request on the same connection, until the server's max:
+            if (!keep_alive) break;
+        }
+    }
+    catch (std::exception&)
+    {
+    }
+    boost::mutex::scoped_lock lk(results_mut);
+    answered += ok;
+    if (ok != requests_per_client) ++failed;
+}
+
+/// as client(), but a new connection for every request
+void closing_client(int n)
+{
+    int ok = 0;
+    try
+    {
+        boost::asio::io_service ios;
+        for (int i = 0; i < close_requests_per_client; ++i)
+        {
+            tcp::socket sock(ios);
+            sock.connect(tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+            boost::asio::streambuf buf;
+            std::string callback;
+            boost::asio::write(sock, boost::asio::buffer(stat_request(n, i, false, callback)));
+            std::string body;
+            bool keep_alive = read_reply(sock, buf, body);
+            if (keep_alive || !is_stat_reply(body, callback)) break;
+            ++ok;
+        }
+    }
+    catch (std::exception&)
+    {
+    }
+    boost::mutex::scoped_lock lk(results_mut);
+    answered += ok;
+    if (ok != close_requests_per_client) ++failed;
+}
+
+/// runs clients of the given kind, @return requests/s
+double load(void (*kind)(int), int requests_each)
+{
+    answered = failed = 0;
+    ptime start = microsec_clock::universal_time();
+    boost::thread_group group;
+    for (int i = 0; i < clients; ++i)
+        group.create_thread(boost::bind(kind, i));
+    group.join_all();
+    double secs = (microsec_clock::universal_time() - start).total_milliseconds() / 1000.0;
+    CHECK(failed == 0);
+    CHECK(answered == clients * requests_each);
+    return answered / secs;
+}
+
+/// seconds until the server closes a connection that sends what's given, or -1.
+double seconds_until_closed(const std::string& send)
+{
+    boost::asio::io_service ios;
+    tcp::socket sock(ios);
+    sock.connect(tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+    boost::asio::streambuf buf;
+    if (send.length())
+    {
+        boost::asio::write(sock, boost::asio::buffer(send));
+        std::string body;
+        read_reply(sock, buf, body);
+    }
+    ptime start = microsec_clock::universal_time();
+    boost::system::error_code ec;
+    char c;
+    sock.read_some(boost::asio::buffer(&c, 1), ec);
+    if (ec != boost::asio::error::eof && ec != boost::asio::error::connection_reset)
+        return -1;
+    return (microsec_clock::universal_time() - start).total_milliseconds() / 1000.0;
+}
+
+}
+
+int main()
+{
+    char authdb[] = "/tmp/test_keepalive_XXXXXX";
+    int fd = mkstemp(authdb);
+    if (fd < 0) return 1;
+    close(fd);
+    api_auth = new auth(authdb);
+    api_plugin = dynamic_cast<ResolverServicePlugin*>(Createapi());
+    if (!api_plugin || !api_plugin->init(pa_ptr(new stub_adaptor))) return 1;
+
+    moost::http::server<handler> s("127.0.0.1", 0, 4);
+    s.set_keepalive(5, requests_per_client);
+    s.set_read_timeout(1);
+    boost::thread srv(boost::bind(&moost::http::server<handler>::run, &s));
+    while ((port = s.port()) == 0)
+        boost::this_thread::sleep(milliseconds(10));
+
+    double kept = load(&client, requests_per_client);
+    double closed = load(&closing_client, close_requests_per_client);
+    std::cout << clients << " clients, api stat requests/s: keep-alive " << (int)kept
+              << ", connection per request " << (int)closed << std::endl;
+
+    // malformed after an HTTP/1.1 request line: the 400 isn't kept alive,
+    // there's no telling where the next request would start:
+    {
+        boost::asio::io_service ios;
+        tcp::socket sock(ios);
+        sock.connect(tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), port));
+        boost::asio::write(sock, boost::asio::buffer(
+            std::string("GET / HTTP/1.1\r\nnot a header\r\n\r\n")));
+        boost::asio::streambuf buf;
+        std::string body;
+        CHECK(!read_reply(sock, buf, body));
+        boost::system::error_code ec;
+        char c;
+        sock.read_some(boost::asio::buffer(&c, 1), ec);
+        CHECK(ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset);
+    }
+
+    // the timeouts are only checked to have passed, and the connection closed
+    // well within the next one, so a loaded machine doesn't fail them.
+    // nothing sent: dropped after the 1s read timeout, not the 5s keep-alive one:
+    double silent = seconds_until_closed("");
+    std::cout << "silent client closed after " << silent << "s" << std::endl;
+    CHECK(silent >= 0.9 && silent < 4.5);
+
+    // idle after a request: the 5s keep-alive timeout applies instead:
+    std::string callback;
+    double idle = seconds_until_closed(stat_request(0, 0, true, callback));
+    std::cout << "idle client closed after " << idle << "s" << std::endl;
+    CHECK(idle >= 4.9 && idle < 60);
+
+    s.stop();
+    srv.join();
+    api_plugin->Destroy();
+    delete api_auth;
+    std::remove(authdb);
+    return test_failures();
+}
@@ -0,0 +1,85 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// ResultCache::lookup_or_insert, as serve_from_cache uses it: of several
+// identical queries dispatched at once, exactly one misses and runs the
+// pipeline, and the rest are all answered from it.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "playdar/result_cache.hpp"
+#include "test.h"
+
+using namespace playdar;
+
+namespace {
+
+const int threads = 16;
+const int rounds = 200;
+
+boost::barrier* start;
+boost::mutex mut;
+std::vector<rq_ptr> queries; // dispatched, one per thread
+std::vector<rq_ptr> found;   // what each got from the cache
+
+void dispatch(ResultCache* cache, const std::string* key, int n)
+{
+    start->wait();
+    rq_ptr cached = cache->lookup_or_insert(*key, queries[n]);
+    boost::mutex::scoped_lock lk(mut);
+    found[n] = cached;
+}
+
+}
+
+int main()
+{
+    ResultCache cache(100, 300);
+    boost::barrier b(threads);
+    start = &b;
+    for(int r = 0; r < rounds; r++)
+    {
+        std::ostringstream key;
+        key << "artist\ttrack " << r;
+        const std::string k = key.str();
+        queries.clear();
+        for(int i = 0; i < threads; i++) queries.push_back(rq_ptr(new ResolverQuery));
+        found.assign(threads, rq_ptr());
+
+        boost::thread_group group;
+        for(int i = 0; i < threads; i++)
+            group.create_thread(boost::bind(&dispatch, &cache, &k, i));
+        group.join_all();
+
+        int misses = 0, winner = -1;
+        for(int i = 0; i < threads; i++)
+            if(!found[i]) { ++misses; winner = i; }
+        CHECK(misses == 1);
+        if(winner < 0) continue;
+        for(int i = 0; i < threads; i++)
+            if(i != winner) CHECK(found[i] == queries[winner]);
+        CHECK(cache.lookup(k) == queries[winner]);
+    }
+    CHECK(cache.misses() == (size_t)rounds);
+    return test_failures();
+}
@@ -0,0 +1,109 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A resolver reporting results mustn't wait for a slow query callback
+// (eg: a comet client on a bad connection) when the query has an executor.
+
+#include <iostream>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/resolver_query.hpp"
+#include "test.h"
+
+using namespace playdar;
+using namespace boost::posix_time;
+
+namespace {
+
+boost::mutex seen_mut;
+std::vector<source_uid> seen;
+
+void slow_callback(const query_uid&, ri_ptr rip)
+{
+    boost::this_thread::sleep(milliseconds(200));
+    boost::mutex::scoped_lock lk(seen_mut);
+    seen.push_back(rip->id());
+}
+
+size_t num_seen()
+{
+    boost::mutex::scoped_lock lk(seen_mut);
+    return seen.size();
+}
+
+ri_ptr result(const std::string& sid)
+{
+    ri_ptr rip(new ResolvedItem);
+    rip->set_id(sid);
+    rip->set_score(0.5);
+    return rip;
+}
+
+void post(boost::asio::io_service* ios, boost::function<void()> job)
+{
+    ios->post(job);
+}
+
+}
+
+int main()
+{
+    boost::asio::io_service ios;
+    boost::asio::io_service::work* work = new boost::asio::io_service::work(ios);
+    boost::thread cbthread(boost::bind(&boost::asio::io_service::run, &ios));
+
+    rq_ptr rq(new ResolverQuery);
+    rq->set_callback_executor(boost::bind(&post, &ios, _1));
+    rq->register_callback(&slow_callback);
+
+    // three results from the reporting thread, each callback takes 200ms:
+    ptime start = microsec_clock::universal_time();
+    rq->add_result(result("a"));
+    rq->add_result(result("b"));
+    rq->add_result(result("c"));
+    long reported_ms = (microsec_clock::universal_time() - start).total_milliseconds();
+    std::cout << "reporting took " << reported_ms << "ms" << std::endl;
+    CHECK(reported_ms < 100);
+
+    // ...they all arrive, in order, on the callback thread:
+    for(int i = 0; i < 100 && num_seen() < 3; i++)
+        boost::this_thread::sleep(milliseconds(20));
+    CHECK(num_seen() == 3);
+    CHECK(seen[0] == "a" && seen[1] == "b" && seen[2] == "c");
+
+    // without an executor callbacks still fire, on the reporting thread:
+    rq_ptr inline_rq(new ResolverQuery);
+    inline_rq->register_callback(&slow_callback);
+    CHECK(inline_rq->add_result(result("d")));
+    CHECK(num_seen() == 4);
+
+    // once cancelled, results are refused, so whoever reported one knows
+    // cancel_query won't have cleaned up after it:
+    inline_rq->cancel();
+    CHECK(!inline_rq->add_result(result("e")));
+    CHECK(inline_rq->results().size() == 1);
+
+    delete work;
+    cbthread.join();
+    return test_failures();
+}
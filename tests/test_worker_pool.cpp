@@ -0,0 +1,125 @@
+/*
+    Playdar - music content resolver
+    Copyright (C) 2009  Richard Jones
+    Copyright (C) 2009  Last.fm Ltd.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+// The Resolver's dispatch pool, utils::worker_pool: a query whose pipeline
+// blocks (a resolver plugin stuck on the network) mustn't hold up the
+// queries dispatched after it, as long as there's more than one thread.
+// stop() drops what's still queued and waits for what's running.
+
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "playdar/utils/worker_pool.hpp"
+#include "test.h"
+
+using namespace playdar;
+using namespace boost::posix_time;
+
+namespace {
+
+const int blocking = 0;
+const int fast_queries = 200;
+
+boost::mutex mut;
+boost::condition cond;
+bool released = false;
+int done = 0;
+
+/// stands in for Resolver::run_pipeline
+void run_pipeline(const int& q)
+{
+    boost::mutex::scoped_lock lk(mut);
+    if (q == blocking)
+    {
+        while (!released) cond.wait(lk);
+        return;
+    }
+    ++done;
+    cond.notify_all();
+}
+
+/// waits up to a second for n fast queries to be done.
+bool wait_done(int n)
+{
+    ptime until = microsec_clock::universal_time() + seconds(1);
+    boost::mutex::scoped_lock lk(mut);
+    while (done < n)
+        if (!cond.timed_wait(lk, until)) break;
+    return done >= n;
+}
+
+void reset()
+{
+    boost::mutex::scoped_lock lk(mut);
+    released = false;
+    done = 0;
+}
+
+void release()
+{
+    boost::mutex::scoped_lock lk(mut);
+    released = true;
+    cond.notify_all();
+}
+
+}
+
+int main()
+{
+    // several threads: the rest go round the blocked one
+    {
+        reset();
+        utils::worker_pool<int> pool;
+        pool.start(4, &run_pipeline);
+        pool.post(blocking);
+        for (int i = 1; i <= fast_queries; ++i) pool.post(i);
+        CHECK(wait_done(fast_queries));
+        release();
+    }
+
+    // one thread: everything waits behind it, until it's unblocked
+    {
+        reset();
+        utils::worker_pool<int> pool;
+        pool.start(1, &run_pipeline);
+        pool.post(blocking);
+        for (int i = 1; i <= fast_queries; ++i) pool.post(i);
+        CHECK(!wait_done(1));
+        release();
+        CHECK(wait_done(fast_queries));
+    }
+
+    // stop() while blocked: the queued ones are dropped
+    {
+        reset();
+        utils::worker_pool<int> pool;
+        pool.start(1, &run_pipeline);
+        pool.post(blocking);
+        for (int i = 1; i <= 10; ++i) pool.post(i);
+        boost::thread stopper(boost::bind(&utils::worker_pool<int>::stop, &pool));
+        boost::this_thread::sleep(milliseconds(200));
+        release();
+        stopper.join();
+        CHECK(done == 0);
+        CHECK(pool.pending() == 0);
+    }
+
+    return test_failures();
+}